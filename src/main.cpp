@@ -1,5 +1,9 @@
 #include "rt/ray_tracer.hpp"
 #include "rt/mesh.hpp"
+#include "rt/bvh_cache.hpp"
+#include "rt/obj_loader.hpp"
+#include "rt/paged_mesh.hpp"
+#include "rt/rtm/vec3_m128.hpp"
 
 void spheres_scene() {
     // World
@@ -205,7 +209,8 @@ void simple_light() {
     cam.render_tiles(world);
 }
 
-void cornell_box() {
+// Walls, light, two boxes, a sphere and a pyramid
+rt::hittable_list cornell_box_world() {
     rt::hittable_list world;
 
     auto red   = make_shared<rt::lambertian>(rt::color(.65, .05, .05));
@@ -221,14 +226,14 @@ void cornell_box() {
     world.add(make_shared<rt::quad>(rt::point3f(0,0,555), rt::vec3f(555,0,0), rt::vec3f(0,555,0), white));
 
     // left box
-    shared_ptr<rt::hittable> box1 = box(rt::point3f(0,0,0), rt::point3f(165,330,165), white);
-    box1 = make_shared<rt::rotate_y>(box1, 15.0f);
-    box1 = make_shared<rt::translate>(box1, rt::vec3f(265,0,295));
+    shared_ptr<rt::hittable> box1 = make_shared<rt::instance>(
+        box(rt::point3f(0,0,0), rt::point3f(165,330,165), white),
+        rt::affine3f::translation(rt::vec3f(265,0,295)) * rt::affine3f::rotation_y(15.0f));
     
     // right box
-    shared_ptr<rt::hittable> box2 = box(rt::point3f(0,0,0), rt::point3f(165,165,165), white);
-    box2 = make_shared<rt::rotate_y>(box2, -18.0f);
-    box2 = make_shared<rt::translate>(box2, rt::vec3f(130,0,65));
+    shared_ptr<rt::hittable> box2 = make_shared<rt::instance>(
+        box(rt::point3f(0,0,0), rt::point3f(165,165,165), white),
+        rt::affine3f::translation(rt::vec3f(130,0,65)) * rt::affine3f::rotation_y(-18.0f));
 
     // sphere
     auto sphere_mat = make_shared<rt::lambertian>(rt::color(0.4f, 0.2f, 0.1f));
@@ -247,6 +252,12 @@ void cornell_box() {
     world.add(box2);
     world.add(pyramid_obj);
 
+    return world;
+}
+
+void cornell_box() {
+    rt::hittable_list world = cornell_box_world();
+
     rt::Camera cam;
 
     cam.aspect_ratio      = 1.0f;
@@ -287,7 +298,7 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
 
     rt::hittable_list world;
 
-    world.add(make_shared<rt::bvh_node>(boxes1));
+    world.add(make_shared<rt::linear_bvh>(boxes1));
 
     // top light
     auto light = make_shared<rt::diffuse_light>(rt::color(7, 7, 7));
@@ -325,8 +336,9 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
         boxes2.add(make_shared<rt::sphere>(rt::point3f::random(0,165), 10.0f, white));
     }
 
-    world.add(make_shared<rt::translate>(
-        make_shared<rt::rotate_y>(make_shared<rt::bvh_node>(boxes2), 15.0f), rt::vec3f(-100, 270, 395)
+    world.add(make_shared<rt::instance>(
+        make_shared<rt::linear_bvh>(boxes2),
+        rt::affine3f::translation(rt::vec3f(-100, 270, 395)) * rt::affine3f::rotation_y(15.0f)
         )
     );
 
@@ -394,16 +406,17 @@ void three_D_model() {
 
     // // Dragon model
     // auto dragon_mat = make_shared<rt::lambertian>(rt::color(0.9, 0.8, 0));
-    // auto dragon_obj = rt::load_obj("model/dragon.obj", dragon_mat);
-    // rt::transform_mesh(*dragon_obj, 2.4f, rt::vec3f(278,100,210));
-    // auto dragon_bvh = make_shared<rt::bvh_node>(dragon_obj->objects, 0, dragon_obj->objects.size());
-    // world.add(dragon_bvh);
+    // auto dragon = rt::load_obj_mesh("model/dragon.obj", dragon_mat);
+    // rt::transform_mesh(*dragon, 2.4f, rt::vec3f(278,100,210));
+    // world.add(dragon);
 
     // Tea pot
     auto tea_mat = make_shared<rt::metal>(rt::color(0, 0, 0.8), 0.0f);
-    auto tea_pot = rt::load_obj("model/teapot.obj", tea_mat);
-    rt::transform_mesh(*tea_pot, 80.0f,rt::vec3f(278, 0, 278));
-    auto teapot_bvh = make_shared<rt::bvh_node>(tea_pot->objects, 0, tea_pot->objects.size());
+    // the teapot's long spout and handle triangles pay off with spatial splits
+    rt::bvh_build_options teapot_options;
+    teapot_options.split = rt::bvh_split::spatial;
+    auto teapot_bvh = rt::load_obj_cached("model/teapot.obj", tea_mat,
+        rt::affine3f::translation(rt::vec3f(278, 0, 278)) * rt::affine3f::scaling(80.0f), teapot_options);
     world.add(teapot_bvh);
 
     rt::Camera cam;
@@ -437,42 +450,40 @@ void multiple_models() {
     world.add(make_shared<rt::quad>(rt::point3f(555,555,555), rt::vec3f(-555,0,0), rt::vec3f(0,0,-555), white));
     world.add(make_shared<rt::quad>(rt::point3f(0,0,555), rt::vec3f(555,0,0), rt::vec3f(0,555,0), white));
 
-    // left box
-    shared_ptr<rt::hittable> box1 = box(rt::point3f(0,0,0), rt::point3f(165,165,165), white);
-    box1 = make_shared<rt::rotate_y>(box1, 15.0f);
-    box1 = make_shared<rt::translate>(box1, rt::vec3f(285,0,295));
-    world.add(box1);
+    // Everything that used to sit behind translate/rotate_y goes into one
+    // top-level BVH; each model is built once in its own object space.
+    auto instances = make_shared<rt::tlas>();
 
-    // right box
-    shared_ptr<rt::hittable> box2 = box(rt::point3f(0,0,0), rt::point3f(165,165,165), white);
-    box2 = make_shared<rt::rotate_y>(box2, -18.0f);
-    box2 = make_shared<rt::translate>(box2, rt::vec3f(130,0,65));
-    world.add(box2);
+    // left and right box share one BLAS
+    shared_ptr<rt::hittable> cube = box(rt::point3f(0,0,0), rt::point3f(165,165,165), white);
+    instances->add(cube, rt::affine3f::translation(rt::vec3f(285,0,295)) * rt::affine3f::rotation_y(15.0f));
+    instances->add(cube, rt::affine3f::translation(rt::vec3f(130,0,65)) * rt::affine3f::rotation_y(-18.0f));
 
     // Suzanne model
     auto dragon_mat = make_shared<rt::lambertian>(rt::color(0.9, 0.8, 0));
-    auto dragon_obj = rt::load_obj("model/suzanne.obj", dragon_mat);
-    rt::transform_mesh(*dragon_obj, 80.0f, rt::vec3f(110, 165, -450));
-    auto dragon_bvh = make_shared<rt::bvh_node>(dragon_obj->objects, 0, dragon_obj->objects.size());
-    auto rotated = make_shared<rt::rotate_y>(dragon_bvh, 200);
-    auto suzanne_final = make_shared<rt::translate>(rotated, rt::vec3f(278, 0, 278));
-    world.add(suzanne_final);
+    auto dragon_bvh = rt::load_obj_cached("model/suzanne.obj", dragon_mat);
+    instances->add(dragon_bvh, rt::affine3f::translation(rt::vec3f(278, 0, 278))
+                             * rt::affine3f::rotation_y(200.0f)
+                             * rt::affine3f::translation(rt::vec3f(110, 165, -450))
+                             * rt::affine3f::scaling(80.0f));
 
     // Tea pot
     auto tea_mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
-    auto tea_pot = rt::load_obj("model/teapot.obj", tea_mat);
-    rt::transform_mesh(*tea_pot, 40.0f,rt::vec3f(185, 160, 220));
-    auto teapot_bvh = make_shared<rt::bvh_node>(tea_pot->objects, 0, tea_pot->objects.size());
-    world.add(teapot_bvh);
+    rt::bvh_build_options teapot_options;
+    teapot_options.split = rt::bvh_split::spatial;
+    auto teapot_bvh = rt::load_obj_cached("model/teapot.obj", tea_mat, rt::affine3f(), teapot_options);
+    instances->add(teapot_bvh, rt::affine3f::translation(rt::vec3f(185, 160, 220)) * rt::affine3f::scaling(40.0f));
 
     // Spot the cow
     auto spot_mat = make_shared<rt::lambertian>(rt::color(0, 0.8, 0.9));
-    auto spot_obj = rt::load_obj("model/spot.obj", spot_mat);
-    rt::transform_mesh(*spot_obj, 90.0f, rt::vec3f(420, 60, 80));
-    auto spot_bvh = make_shared<rt::bvh_node>(spot_obj->objects, 0, spot_obj->objects.size());
-    auto spot_rotated = make_shared<rt::rotate_y>(spot_bvh, 45.0f);
-    auto spot_final = make_shared<rt::translate>(spot_rotated, rt::vec3f(65, 0, 290));
-    world.add(spot_final);
+    auto spot_bvh = rt::load_obj_cached("model/spot.obj", spot_mat);
+    instances->add(spot_bvh, rt::affine3f::translation(rt::vec3f(65, 0, 290))
+                           * rt::affine3f::rotation_y(45.0f)
+                           * rt::affine3f::translation(rt::vec3f(420, 60, 80))
+                           * rt::affine3f::scaling(90.0f));
+
+    instances->build();
+    world.add(instances);
 
     rt::Camera cam;
     cam.aspect_ratio      = 1.0f;
@@ -489,6 +500,1372 @@ void multiple_models() {
     cam.render_tiles(world);
 }
 
+// Build time and closest-hit throughput of the median and SAH builders, and of
+// the flattened and wide BVHs, on the meshes used by three_D_model() and
+// multiple_models().
+void bvh_builders_benchmark() {
+    struct model { std::string name; const char* file; float scale; rt::vec3f offset; };
+    const model models[] = {
+        {"teapot",  "model/teapot.obj",  80.0f, rt::vec3f(278, 0, 278)},
+        {"suzanne", "model/suzanne.obj", 80.0f, rt::vec3f(110, 165, -450)},
+        {"spot",    "model/spot.obj",    90.0f, rt::vec3f(420, 60, 80)},
+    };
+    const std::pair<std::string, rt::bvh_split> splits[] = {
+        {"median", rt::bvh_split::median},
+        {"sah",    rt::bvh_split::sah},
+    };
+
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    rt::benchmark::Benchmark bench("BVH build");
+
+    for (const auto& m : models) {
+        auto mesh = rt::load_obj(m.file, mat);
+        rt::transform_mesh(*mesh, m.scale, m.offset);
+
+        // Frame the model from the front; the list's own bbox predates transform_mesh
+        auto rays = rt::benchmark::framing_rays(rt::bvh_node(mesh->objects, 0, mesh->objects.size()).bounding_box());
+
+        for (const auto& [split_name, split] : splits) {
+            auto name = m.name + " " + split_name;
+            bench.run(name, [&] { rt::bvh_node bvh(mesh->objects, 0, mesh->objects.size(), split); }, 10);
+
+            rt::bvh_node bvh(mesh->objects, 0, mesh->objects.size(), split);
+            rt::benchmark::print_trace_result(name, rt::benchmark::trace_rays(bvh, rays, 4));
+            std::cout << std::endl;
+        }
+        bench.compare(m.name + " median", m.name + " sah");
+
+        // Same SAH split, stored as a flat node array
+        auto linear_name = m.name + " sah linear";
+        rt::bvh_build_options options;
+        bench.run(linear_name, [&] { rt::linear_bvh bvh(mesh->objects, options); }, 10);
+        rt::linear_bvh linear(mesh->objects, options);
+        rt::benchmark::print_trace_result(linear_name, rt::benchmark::trace_rays(linear, rays, 4));
+        std::cout << linear.node_count() << " nodes, " << linear.memory_bytes() / 1024 << " KiB" << std::endl;
+
+        // Same tree collapsed into 4- and 8-wide nodes
+        rt::bvh4 wide4(mesh->objects, options);
+        rt::benchmark::print_trace_result(m.name + " sah bvh4", rt::benchmark::trace_rays(wide4, rays, 4));
+        std::cout << wide4.node_count() << " nodes, " << wide4.memory_bytes() / 1024 << " KiB" << std::endl;
+        rt::bvh8 wide8(mesh->objects, options);
+        rt::benchmark::print_trace_result(m.name + " sah bvh8", rt::benchmark::trace_rays(wide8, rays, 4));
+        std::cout << wide8.node_count() << " nodes, " << wide8.memory_bytes() / 1024 << " KiB" << std::endl;
+        std::cout << std::endl;
+    }
+}
+
+// n random triangles of up to unit size scattered over a 200^3 cube: a
+// dragon-sized load without a dragon-sized OBJ file
+shared_ptr<rt::hittable_list> triangle_soup(int n, shared_ptr<rt::material> mat) {
+    auto soup = make_shared<rt::hittable_list>();
+    for (int i = 0; i < n; i++) {
+        auto p = rt::point3f::random(-100.0f, 100.0f);
+        soup->add(make_shared<rt::mesh_triangle>(p, p + rt::vec3f::random(0.0f, 1.0f),
+                                                 p + rt::vec3f::random(0.0f, 1.0f), mat));
+    }
+    return soup;
+}
+
+// Serial vs. parallel build time of the flat BVH for every model, plus a
+// dragon-sized synthetic load (a million triangles)
+void bvh_parallel_build_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    std::vector<std::pair<std::string, shared_ptr<rt::hittable_list>>> models = {
+        {"teapot",  rt::load_obj("model/teapot.obj", mat)},
+        {"suzanne", rt::load_obj("model/suzanne.obj", mat)},
+        {"spot",    rt::load_obj("model/spot.obj", mat)},
+    };
+
+    models.push_back({"1M triangle soup", triangle_soup(1'000'000, mat)});
+
+    rt::benchmark::Benchmark bench("Parallel BVH build");
+    std::cout << "OpenMP threads: " << omp_get_max_threads() << std::endl;
+
+    for (const auto& [name, mesh] : models) {
+        rt::bvh_build_options serial;
+        serial.parallel = false;
+        rt::bvh_build_options parallel;
+
+        std::cout << name << ": " << mesh->objects.size() << " triangles" << std::endl;
+        bench.run(name + " serial", [&] { rt::linear_bvh bvh(mesh->objects, serial); }, 5);
+        bench.run(name + " parallel", [&] { rt::linear_bvh bvh(mesh->objects, parallel); }, 5);
+        bench.compare(name + " serial", name + " parallel");
+        std::cout << std::endl;
+    }
+}
+
+// Frame loop of a small animation: a herd of instanced cows walking in a
+// circle, and a teapot deforming in place. Compares refitting the existing
+// BVHs against rebuilding them every frame.
+void bvh_animation_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    auto spot = rt::load_obj("model/spot.obj", mat);
+    auto spot_bvh = make_shared<rt::linear_bvh>(spot->objects);
+
+    const int herd_size = 400;
+    const int frames = 60;
+    auto herd_transform = [](int i, int frame) {
+        float angle = 360.0f * i / herd_size + 3.0f * frame;
+        float radius = 100.0f + 10.0f * (i % 8);
+        return rt::affine3f::rotation_y(angle)
+             * rt::affine3f::translation(rt::vec3f(radius, 0, 0))
+             * rt::affine3f::scaling(10.0f);
+    };
+
+    rt::tlas herd;
+    for (int i = 0; i < herd_size; i++)
+        herd.add(spot_bvh, herd_transform(i, 0));
+    herd.build();
+
+    auto rays = rt::benchmark::primary_rays(rt::point3f(0, 150, -300), rt::point3f(0, 0, 0),
+                                            rt::vec3f(0, 1, 0), 60, 256, 256);
+
+    double refit_ms = 0.0, rebuild_ms = 0.0, refit_mrays = 0.0, rebuild_mrays = 0.0;
+    int rebuilds = 0;
+    for (int frame = 1; frame <= frames; frame++) {
+        for (int i = 0; i < herd_size; i++)
+            herd.set_transform(i, herd_transform(i, frame));
+
+        auto start = std::chrono::steady_clock::now();
+        rebuilds += herd.update();
+        auto mid = std::chrono::steady_clock::now();
+        refit_mrays += rt::benchmark::trace_rays(herd, rays).mrays_per_sec();
+
+        auto mid2 = std::chrono::steady_clock::now();
+        herd.build();
+        auto end = std::chrono::steady_clock::now();
+        rebuild_mrays += rt::benchmark::trace_rays(herd, rays).mrays_per_sec();
+
+        refit_ms += std::chrono::duration<double, std::milli>(mid - start).count();
+        rebuild_ms += std::chrono::duration<double, std::milli>(end - mid2).count();
+    }
+    std::cout << "Herd of " << herd_size << " instances, " << frames << " frames" << std::endl
+              << "  update(): " << refit_ms / frames << " ms/frame, " << refit_mrays / frames
+              << " Mrays/s, " << rebuilds << " rebuilds" << std::endl
+              << "  build():  " << rebuild_ms / frames << " ms/frame, " << rebuild_mrays / frames
+              << " Mrays/s" << std::endl;
+
+    // Deforming mesh: a wave runs through the teapot's vertices every frame.
+    auto teapot = rt::load_obj("model/teapot.obj", mat);
+    rt::transform_mesh(*teapot, 80.0f, rt::vec3f(0, 0, 0));
+    std::vector<std::array<rt::point3f, 3>> rest;
+    for (const auto& obj : teapot->objects) {
+        auto tri = std::static_pointer_cast<rt::mesh_triangle>(obj);
+        rest.push_back({tri->v0, tri->v1, tri->v2});
+    }
+    rt::linear_bvh teapot_bvh(teapot->objects);
+    auto wave = [](const rt::point3f& p, int frame) {
+        return p + rt::vec3f(0, 20.0f * std::sin(0.02f * p.x() + 0.2f * frame), 0);
+    };
+
+    refit_ms = rebuild_ms = 0.0;
+    rebuilds = 0;
+    for (int frame = 1; frame <= frames; frame++) {
+        for (size_t i = 0; i < teapot->objects.size(); i++) {
+            auto tri = std::static_pointer_cast<rt::mesh_triangle>(teapot->objects[i]);
+            tri->v0 = wave(rest[i][0], frame);
+            tri->v1 = wave(rest[i][1], frame);
+            tri->v2 = wave(rest[i][2], frame);
+        }
+        auto start = std::chrono::steady_clock::now();
+        rebuilds += teapot_bvh.update();
+        auto mid = std::chrono::steady_clock::now();
+        rt::linear_bvh rebuilt(teapot->objects);
+        auto end = std::chrono::steady_clock::now();
+
+        refit_ms += std::chrono::duration<double, std::milli>(mid - start).count();
+        rebuild_ms += std::chrono::duration<double, std::milli>(end - mid).count();
+        if (frame % 20 == 0) {
+            std::cout << "  frame " << frame << ": SAH cost refit " << teapot_bvh.cost()
+                      << " vs rebuilt " << rebuilt.cost() << std::endl;
+        }
+    }
+    std::cout << "Deforming teapot (" << teapot->objects.size() << " triangles), " << frames << " frames" << std::endl
+              << "  update(): " << refit_ms / frames << " ms/frame, " << rebuilds << " rebuilds" << std::endl
+              << "  rebuild:  " << rebuild_ms / frames << " ms/frame" << std::endl;
+}
+
+// SAH vs. spatial-split (SBVH) flat BVHs on the models and on a mesh of long
+// diagonal slivers, the worst case for object splits
+void bvh_spatial_split_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    std::vector<std::pair<std::string, shared_ptr<rt::hittable_list>>> models = {
+        {"teapot",  rt::load_obj("model/teapot.obj", mat)},
+        {"suzanne", rt::load_obj("model/suzanne.obj", mat)},
+        {"spot",    rt::load_obj("model/spot.obj", mat)},
+    };
+    for (auto& [name, mesh] : models)
+        rt::transform_mesh(*mesh, 80.0f, rt::vec3f(0, 0, 0));
+
+    // A wavy sheet tessellated into long, thin strips and turned diagonally,
+    // so every triangle's box covers a wide band of its neighbours
+    auto slivers = make_shared<rt::hittable_list>();
+    auto sheet = rt::affine3f::rotation_x(30) * rt::affine3f::rotation_y(45);
+    auto sheet_point = [&](int i, int j) {
+        float x = 0.1f * i, z = 50.0f * j;
+        return sheet.transform_point(rt::point3f(x, 5.0f * std::sin(0.05f * x + 0.02f * z), z));
+    };
+    for (int i = 0; i < 2000; i++) {
+        for (int j = 0; j < 4; j++) {
+            slivers->add(make_shared<rt::mesh_triangle>(sheet_point(i, j), sheet_point(i + 1, j),
+                                                        sheet_point(i + 1, j + 1), mat));
+            slivers->add(make_shared<rt::mesh_triangle>(sheet_point(i, j), sheet_point(i + 1, j + 1),
+                                                        sheet_point(i, j + 1), mat));
+        }
+    }
+    models.push_back({"slivers", slivers});
+
+    const std::pair<std::string, rt::bvh_split> splits[] = {
+        {"sah",     rt::bvh_split::sah},
+        {"spatial", rt::bvh_split::spatial},
+    };
+    rt::benchmark::Benchmark bench("SBVH build");
+
+    for (const auto& [model_name, mesh] : models) {
+        auto rays = rt::benchmark::framing_rays(rt::linear_bvh(mesh->objects).bounding_box());
+
+        for (const auto& [split_name, split] : splits) {
+            auto name = model_name + " " + split_name;
+            rt::bvh_build_options options;
+            options.split = split;
+            bench.run(name, [&] { rt::linear_bvh bvh(mesh->objects, options); }, 3);
+
+            rt::linear_bvh bvh(mesh->objects, options);
+            rt::benchmark::print_trace_result(name, rt::benchmark::trace_rays(bvh, rays, 2));
+            std::cout << bvh.node_count() << " nodes, " << bvh.reference_count() << " references for "
+                      << mesh->objects.size() << " triangles, SAH cost " << bvh.cost() << ", "
+                      << bvh.memory_bytes() / 1024 << " KiB" << std::endl << std::endl;
+        }
+        bench.compare(model_name + " sah", model_name + " spatial");
+    }
+}
+
+// Memory footprint and trace throughput of every BVH layout, from the pointer
+// based bvh_node down to 8-bit quantized wide nodes, plus a regression check
+// of the quantized BVHs on a far cluster of tiny spheres
+void bvh_memory_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    std::vector<std::pair<std::string, shared_ptr<rt::hittable_list>>> models = {
+        {"teapot",  rt::load_obj("model/teapot.obj", mat)},
+        {"spot",    rt::load_obj("model/spot.obj", mat)},
+    };
+    for (auto& [name, mesh] : models)
+        rt::transform_mesh(*mesh, 80.0f, rt::vec3f(0, 0, 0));
+
+    models.push_back({"1M triangle soup", triangle_soup(1'000'000, mat)});
+
+    // Node bytes, not counting the per-primitive shared_ptr array every
+    // flat layout keeps in leaf order
+    auto report = [](const std::string& name, size_t node_bytes, size_t nodes, const rt::benchmark::trace_result& r) {
+        rt::benchmark::print_trace_result(name, r);
+        std::cout << "  " << nodes << " nodes, " << node_bytes / 1024 << " KiB of nodes" << std::endl;
+    };
+
+    for (const auto& [model_name, mesh] : models) {
+        const auto& objects = mesh->objects;
+        auto rays = rt::benchmark::framing_rays(rt::linear_bvh(objects).bounding_box());
+        std::cout << model_name << " (" << objects.size() << " triangles)" << std::endl;
+
+        {
+            // Every interior node is its own make_shared allocation: the node,
+            // plus the control block that the shared_ptr counts live in.
+            rt::bvh_node bvh(objects, 0, objects.size());
+            size_t nodes = objects.size() - 1;
+            report("bvh_node", nodes * (sizeof(rt::bvh_node) + 16), nodes, rt::benchmark::trace_rays(bvh, rays));
+        }
+        {
+            rt::linear_bvh bvh(objects);
+            report("linear_bvh", bvh.node_count() * sizeof(rt::bvh_flat_node), bvh.node_count(),
+                   rt::benchmark::trace_rays(bvh, rays));
+        }
+        {
+            rt::bvh4 bvh(objects);
+            report("bvh4", bvh.node_count() * sizeof(rt::bvh_wide_node<4>), bvh.node_count(),
+                   rt::benchmark::trace_rays(bvh, rays));
+        }
+        {
+            rt::qbvh4 bvh(objects);
+            report("qbvh4 (8 bit)", bvh.node_count() * sizeof(rt::qbvh4::node_type), bvh.node_count(),
+                   rt::benchmark::trace_rays(bvh, rays));
+        }
+        {
+            rt::quantized_bvh<4, uint16_t> bvh(objects);
+            report("qbvh4 (16 bit)", bvh.node_count() * sizeof(rt::quantized_bvh<4, uint16_t>::node_type),
+                   bvh.node_count(), rt::benchmark::trace_rays(bvh, rays));
+        }
+        {
+            rt::qbvh8 bvh(objects);
+            report("qbvh8 (8 bit)", bvh.node_count() * sizeof(rt::qbvh8::node_type), bvh.node_count(),
+                   rt::benchmark::trace_rays(bvh, rays));
+        }
+        std::cout << std::endl;
+    }
+
+    // A cluster of tiny spheres far from the camera: its node is so small
+    // next to the rounding bound of the quantized slab test that every box in
+    // it passes, empty slots included. Traversal must still end, and must
+    // find every hit linear_bvh finds.
+    rt::hittable_list far_cluster;
+    const rt::point3f cluster(1000, 1000, 1000);
+    for (int i = 0; i < 3; i++)
+        far_cluster.add(make_shared<rt::sphere>(cluster + rt::vec3f(i * 1e-6f, 0, 0), 1e-6f, mat));
+    for (int i = 0; i < 20; i++)
+        far_cluster.add(make_shared<rt::sphere>(rt::point3f::random(-50.0f, 50.0f), 2.0f, mat));
+    std::vector<rt::ray> cluster_rays;
+    for (int i = 0; i < 100'000; i++)
+        cluster_rays.emplace_back(rt::point3f(0, 0, 0), cluster + rt::vec3f::random(-2e-3f, 2e-3f), 0.0f);
+
+    rt::linear_bvh reference(far_cluster);
+    rt::qbvh4 cluster_qbvh4(far_cluster);
+    rt::quantized_bvh<4, uint16_t> cluster_qbvh4_16(far_cluster);
+    rt::qbvh8 cluster_qbvh8(far_cluster);
+    const std::pair<std::string, const rt::hittable*> cluster_worlds[] = {
+        {"qbvh4 (8 bit)", &cluster_qbvh4}, {"qbvh4 (16 bit)", &cluster_qbvh4_16}, {"qbvh8 (8 bit)", &cluster_qbvh8}};
+    std::cout << "far cluster of tiny spheres (" << far_cluster.objects.size() << " spheres)" << std::endl;
+    for (const auto& [name, world] : cluster_worlds) {
+        rt::benchmark::print_trace_result(name, rt::benchmark::trace_rays(*world, cluster_rays));
+        size_t missed = 0;
+        for (const auto& r : cluster_rays) {
+            rt::hit_record rec;
+            if (reference.hit(r, rt::interval(0.001f, INF), rec) && !world->occluded(r, rt::interval(0.001f, INF)))
+                missed++;
+        }
+        std::cout << "  missed vs. linear_bvh: " << missed << std::endl;
+    }
+}
+
+// A cloud of fast-falling spheres, like the bouncing spheres of the first
+// scene, traced at random shutter times: swept boxes
+// (linear_bvh) vs. boxes interpolated by ray time (motion_bvh), against the
+// same spheres frozen in place as the static baseline
+void motion_blur_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    rt::hittable_list moving, frozen;
+    for (int i = 0; i < 20000; i++) {
+        auto center1 = rt::point3f::random(-100.0f, 100.0f);
+        auto center2 = center1 + rt::vec3f(0.0f, random_float(-40.0f, -30.0f), 0.0f);
+        moving.add(make_shared<rt::sphere>(center1, center2, 1.0f, mat));
+        frozen.add(make_shared<rt::sphere>(center1 + 0.5f * (center2 - center1), 1.0f, mat));
+    }
+
+    auto rays = rt::benchmark::primary_rays(rt::point3f(0, 0, -300), rt::point3f(0, 0, 0),
+                                            rt::vec3f(0, 1, 0), 40, 512, 512);
+    for (auto& r : rays)
+        r = rt::ray(r.origin(), r.direction(), random_float());
+
+    rt::bvh_node swept_tree(moving);
+    rt::benchmark::print_trace_result("bvh_node, swept boxes", rt::benchmark::trace_rays(swept_tree, rays, 2));
+    rt::linear_bvh swept(moving);
+    rt::benchmark::print_trace_result("linear_bvh, swept boxes", rt::benchmark::trace_rays(swept, rays, 2));
+    rt::motion_bvh interpolated(moving);
+    rt::benchmark::print_trace_result("motion_bvh", rt::benchmark::trace_rays(interpolated, rays, 2));
+    std::cout << "  " << interpolated.node_count() << " nodes, " << interpolated.memory_bytes() / 1024 << " KiB" << std::endl;
+    rt::linear_bvh still(frozen);
+    rt::benchmark::print_trace_result("linear_bvh, static spheres", rt::benchmark::trace_rays(still, rays, 2));
+}
+
+// Shadow rays from the primary hits of a teapot standing among spheres,
+// traced as closest-hit queries and as any-hit occluded() queries
+void shadow_ray_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    auto world = rt::load_obj("model/teapot.obj", mat);
+    rt::transform_mesh(*world, 80.0f, rt::vec3f(0, 0, 0));
+    for (int i = 0; i < 2000; i++)
+        world->add(make_shared<rt::sphere>(rt::point3f::random(-150.0f, 150.0f) + rt::vec3f(0, 150.0f, 0),
+                                           random_float(1.0f, 6.0f), mat));
+    world->add(make_shared<rt::quad>(rt::point3f(-400, -1, -400), rt::vec3f(800, 0, 0), rt::vec3f(0, 0, 800), mat));
+
+    rt::linear_bvh scene(*world);
+    auto rays = rt::benchmark::primary_rays(rt::point3f(0, 120, -300), rt::point3f(0, 20, 0),
+                                            rt::vec3f(0, 1, 0), 50, 512, 512);
+    auto shadow = rt::benchmark::shadow_rays(scene, rays, rt::point3f(100, 500, -100));
+    auto segment = rt::interval(0.001f, 0.999f);
+    std::cout << shadow.size() << " shadow rays" << std::endl;
+
+    auto compare = [&](const std::string& name, const rt::hittable& bvh) {
+        rt::benchmark::print_trace_result(name + " hit", rt::benchmark::trace_rays(bvh, shadow, 4, segment));
+        rt::benchmark::print_trace_result(name + " occluded", rt::benchmark::trace_occlusion(bvh, shadow, 4, segment));
+    };
+    compare("bvh_node", rt::bvh_node(*world));
+    compare("linear_bvh", scene);
+    compare("bvh4", rt::bvh4(*world));
+    compare("qbvh4", rt::qbvh4(*world));
+}
+
+// Startup cost of every model: parsing the OBJ and building the BVH, against
+// mapping the prebuilt BVH from the on-disk cache
+void bvh_cache_benchmark() {
+    struct model { std::string name; const char* file; rt::affine3f to_world; rt::bvh_split split; };
+    const model models[] = {
+        {"teapot",  "model/teapot.obj",  rt::affine3f::scaling(80.0f), rt::bvh_split::spatial},
+        {"suzanne", "model/suzanne.obj", rt::affine3f::scaling(80.0f), rt::bvh_split::sah},
+        {"spot",    "model/spot.obj",    rt::affine3f::scaling(90.0f), rt::bvh_split::sah},
+    };
+    const std::string cache_dir = "cache/benchmark";
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    rt::benchmark::Benchmark bench("BVH cache");
+
+    std::error_code ec;
+    std::filesystem::remove_all(cache_dir, ec);
+
+    for (const auto& m : models) {
+        rt::bvh_build_options options;
+        options.split = m.split;
+
+        bench.run(m.name + " parse + build", [&] {
+            auto mesh = rt::load_obj(m.file, mat);
+            for (auto& obj : mesh->objects) {
+                auto tri = std::static_pointer_cast<rt::mesh_triangle>(obj);
+                tri->v0 = m.to_world.transform_point(tri->v0);
+                tri->v1 = m.to_world.transform_point(tri->v1);
+                tri->v2 = m.to_world.transform_point(tri->v2);
+            }
+            rt::linear_bvh bvh(mesh->objects, options);
+        }, 5);
+        bench.timeFunction(m.name + " cold cache", [&] { rt::load_obj_cached(m.file, mat, m.to_world, options, cache_dir); });
+        bench.run(m.name + " cached", [&] { rt::load_obj_cached(m.file, mat, m.to_world, options, cache_dir); }, 20);
+        bench.compare(m.name + " parse + build", m.name + " cached");
+
+        // the mapped mesh must trace exactly like the one built from the OBJ
+        auto cached = rt::load_obj_cached(m.file, mat, m.to_world, options, cache_dir);
+        auto mesh = rt::load_obj(m.file, mat);
+        rt::transform_mesh(*mesh, m.to_world.m[0][0], rt::vec3f(0, 0, 0));
+        rt::linear_bvh built(mesh->objects, options);
+
+        auto rays = rt::benchmark::framing_rays(cached->bounding_box());
+        std::cout << (cached->is_mapped() ? "mapped, " : "in memory, ") << cached->node_count() << " nodes, "
+                  << cached->triangle_count() << " triangles" << std::endl;
+        rt::benchmark::print_trace_result(m.name + " linear_bvh", rt::benchmark::trace_rays(built, rays, 4));
+        rt::benchmark::print_trace_result(m.name + " cached_mesh", rt::benchmark::trace_rays(*cached, rays, 4));
+        std::cout << std::endl;
+    }
+}
+
+// Depth-first vs. treelet node order on the BVHs of final_scene() and the
+// mesh scenes: modelled cache and TLB misses per ray, and trace throughput
+void bvh_layout_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+
+    // final_scene(): the ground boxes and the sphere cluster, without the instance
+    auto final_objects = make_shared<rt::hittable_list>();
+    for (int i = 0; i < 20; i++) {
+        for (int j = 0; j < 20; j++) {
+            auto x0 = -1000.0f + i * 100.0f, z0 = -1000.0f + j * 100.0f;
+            final_objects->add(rt::box(rt::point3f(x0, 0, z0),
+                                       rt::point3f(x0 + 100.0f, random_float(1.0f, 101.0f), z0 + 100.0f), mat));
+        }
+    }
+    for (int j = 0; j < 1000; j++)
+        final_objects->add(make_shared<rt::sphere>(rt::point3f::random(0, 165) + rt::vec3f(-100, 270, 395), 10.0f, mat));
+
+    struct scene { std::string name; shared_ptr<rt::hittable_list> objects; std::vector<rt::ray> rays; };
+    std::vector<scene> scenes;
+    scenes.push_back({"final_scene", final_objects,
+                      rt::benchmark::primary_rays(rt::point3f(478, 278, -600), rt::point3f(278, 278, 0),
+                                                  rt::vec3f(0, 1, 0), 40, 512, 512)});
+
+    auto soup = triangle_soup(1'000'000, mat);
+    std::vector<std::pair<std::string, shared_ptr<rt::hittable_list>>> meshes = {
+        {"teapot", rt::load_obj("model/teapot.obj", mat)},
+        {"spot",   rt::load_obj("model/spot.obj", mat)},
+        {"1M triangle soup", soup},
+    };
+    for (auto& [name, mesh] : meshes) {
+        if (mesh != soup) rt::transform_mesh(*mesh, 80.0f, rt::vec3f(0, 0, 0));
+        scenes.push_back({name, mesh, rt::benchmark::framing_rays(rt::linear_bvh(mesh->objects).bounding_box())});
+    }
+
+    for (const auto& s : scenes) {
+        std::cout << s.name << " (" << s.objects->objects.size() << " objects)" << std::endl;
+        rt::linear_bvh depth_first(*s.objects);
+        rt::treelet_bvh treelets(*s.objects);
+        std::cout << depth_first.node_count() * sizeof(rt::bvh_flat_node) / 1024 << " KiB of nodes" << std::endl;
+
+        rt::benchmark::print_footprint_result("depth-first", rt::benchmark::trace_footprint(depth_first, s.rays));
+        rt::benchmark::print_footprint_result("treelets", rt::benchmark::trace_footprint(treelets, s.rays));
+        rt::benchmark::print_trace_result("depth-first", rt::benchmark::trace_rays(depth_first, s.rays, 4));
+        rt::benchmark::print_trace_result("treelets", rt::benchmark::trace_rays(treelets, s.rays, 4));
+        std::cout << std::endl;
+    }
+}
+
+// One mesh_triangle object per face under a linear_bvh vs. one indexed
+// triangle_mesh: load + build time, memory per triangle and throughput
+void triangle_mesh_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    rt::benchmark::Benchmark bench("Triangle mesh");
+
+    // A 1000 x 500 cell height field (a million triangles) where every
+    // vertex is shared by six faces
+    const int cols = 1000, rows = 500;
+    std::vector<rt::point3f> grid_vertices;
+    for (int j = 0; j <= rows; j++)
+        for (int i = 0; i <= cols; i++)
+            grid_vertices.emplace_back(i * 0.2f, 4.0f * std::sin(i * 0.05f) * std::cos(j * 0.07f), j * 0.2f);
+    std::vector<uint32_t> grid_indices;
+    for (int j = 0; j < rows; j++) {
+        for (int i = 0; i < cols; i++) {
+            uint32_t v = j * (cols + 1) + i;
+            grid_indices.insert(grid_indices.end(), {v, v + 1, v + cols + 2, v, v + cols + 2, v + cols + 1});
+        }
+    }
+
+    struct model { std::string name; std::string file; };
+    const model models[] = {{"teapot", "model/teapot.obj"}, {"suzanne", "model/suzanne.obj"},
+                            {"spot", "model/spot.obj"}, {"1M triangle grid", ""}};
+
+    for (const auto& m : models) {
+        auto load_objects = [&] {
+            if (!m.file.empty()) return rt::load_obj(m.file, mat);
+            auto list = make_shared<rt::hittable_list>();
+            for (size_t t = 0; t < grid_indices.size(); t += 3)
+                list->add(make_shared<rt::mesh_triangle>(grid_vertices[grid_indices[t]], grid_vertices[grid_indices[t + 1]],
+                                                         grid_vertices[grid_indices[t + 2]], mat));
+            return list;
+        };
+        auto load_mesh = [&] {
+            if (!m.file.empty()) return rt::load_obj_mesh(m.file, mat);
+            return make_shared<rt::triangle_mesh>(grid_vertices, grid_indices,
+                                                  std::vector<shared_ptr<rt::material>>{mat});
+        };
+
+        int iterations = m.file.empty() ? 2 : 10;
+        bench.run(m.name + " objects", [&] { rt::linear_bvh bvh(load_objects()->objects); }, iterations);
+        bench.run(m.name + " triangle_mesh", [&] { load_mesh(); }, iterations);
+        bench.compare(m.name + " objects", m.name + " triangle_mesh");
+
+        auto objects = load_objects();
+        rt::linear_bvh bvh(objects->objects);
+        auto mesh = load_mesh();
+        if (!m.file.empty()) {
+            rt::transform_mesh(*objects, 80.0f, rt::vec3f(0, 0, 0));
+            bvh.refit();
+            rt::transform_mesh(*mesh, 80.0f, rt::vec3f(0, 0, 0));
+        }
+
+        // Each mesh_triangle is its own make_shared allocation (object plus
+        // control block) referenced from the list and from the BVH
+        size_t n = objects->objects.size();
+        size_t object_bytes = n * (sizeof(rt::mesh_triangle) + 16 + sizeof(shared_ptr<rt::hittable>))
+                            + bvh.memory_bytes();
+        std::cout << std::fixed << std::setprecision(1)
+                  << "objects: " << object_bytes / double(n) << " bytes/triangle, triangle_mesh: "
+                  << mesh->memory_bytes() / double(n) << " bytes/triangle ("
+                  << mesh->vertex_count() << " vertices)" << std::endl;
+
+        auto rays = rt::benchmark::framing_rays(mesh->bounding_box(), 512, 512, 0.5f);
+        rt::benchmark::print_trace_result(m.name + " objects", rt::benchmark::trace_rays(bvh, rays, 4));
+        rt::benchmark::print_trace_result(m.name + " triangle_mesh", rt::benchmark::trace_rays(*mesh, rays, 4));
+        std::cout << std::endl;
+    }
+}
+
+// triangle_mesh with scalar leaves vs. leaves packed into SIMD packets of
+// four (SSE) and eight (AVX) triangles, under the default (watertight)
+// triangle test
+void triangle_packet_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+
+    std::vector<rt::point3f> soup_vertices;
+    std::vector<uint32_t> soup_indices;
+    for (uint32_t i = 0; i < 1'000'000; i++) {
+        auto p = rt::point3f::random(-100.0f, 100.0f);
+        soup_vertices.insert(soup_vertices.end(), {p, p + rt::vec3f::random(0.0f, 1.0f), p + rt::vec3f::random(0.0f, 1.0f)});
+        soup_indices.insert(soup_indices.end(), {3 * i, 3 * i + 1, 3 * i + 2});
+    }
+
+    struct model { std::string name; std::string file; };
+    const model models[] = {{"teapot", "model/teapot.obj"}, {"suzanne", "model/suzanne.obj"},
+                            {"spot", "model/spot.obj"}, {"1M triangle soup", ""}};
+    struct variant { std::string name; int leaf_size; int packet; };
+    const variant variants[] = {{"scalar, 2 per leaf", 2, 0}, {"scalar, 4 per leaf", 4, 0},
+                                {"packet4", 4, 4}, {"packet8", 8, 8}};
+
+    for (const auto& m : models) {
+        std::cout << m.name << std::endl;
+        std::vector<rt::ray> rays;
+        for (const auto& v : variants) {
+            rt::bvh_build_options options;
+            options.max_leaf_size = v.leaf_size;
+            options.leaf_packet = v.packet;
+            auto mesh = m.file.empty()
+                ? make_shared<rt::triangle_mesh>(soup_vertices, soup_indices,
+                                                 std::vector<shared_ptr<rt::material>>{mat}, std::vector<uint16_t>{}, options)
+                : rt::load_obj_mesh(m.file, mat, options);
+            if (rays.empty())
+                rays = rt::benchmark::framing_rays(mesh->bounding_box());
+            rt::benchmark::print_trace_result(v.name, rt::benchmark::trace_rays(*mesh, rays, 4));
+            std::cout << "  " << mesh->node_count() << " nodes, " << mesh->memory_bytes() / 1024 << " KiB" << std::endl;
+        }
+        std::cout << std::endl;
+    }
+}
+
+// Möller–Trumbore vs. the watertight triangle test. Rays cast from inside a
+// closed sphere and a closed cube through their vertices and edges must all
+// hit something; every one that gets out is a leak, counted for closest-hit
+// and any-hit queries through every acceleration structure, since a box test
+// that rounds a grazing ray out leaks as surely as the triangle test. Speed
+// is measured on the sphere and on the spot model.
+void watertight_triangle_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    struct model { std::string name; std::vector<rt::point3f> vertices; std::vector<uint32_t> indices; };
+
+    // Closed UV sphere with shared vertices, slightly off the origin so the
+    // vertices are not nicely rounded floats
+    const int slices = 256, stacks = 128;
+    const rt::point3f center(0.3f, -0.2f, 0.7f);
+    model sphere{"sphere", {center + rt::vec3f(0, 10, 0), center + rt::vec3f(0, -10, 0)}, {}};
+    for (int j = 1; j < stacks; j++) {
+        float theta = PI * j / stacks;
+        for (int i = 0; i < slices; i++) {
+            float phi = 2.0f * PI * i / slices;
+            sphere.vertices.push_back(center + 10.0f * rt::vec3f(std::sin(theta) * std::cos(phi), std::cos(theta),
+                                                                 std::sin(theta) * std::sin(phi)));
+        }
+    }
+    auto ring = [&](int j, int i) { return uint32_t(2 + (j - 1) * slices + (i % slices)); };
+    for (int i = 0; i < slices; i++) {
+        sphere.indices.insert(sphere.indices.end(), {0, ring(1, i + 1), ring(1, i)});
+        sphere.indices.insert(sphere.indices.end(), {1, ring(stacks - 1, i), ring(stacks - 1, i + 1)});
+        for (int j = 1; j < stacks - 1; j++) {
+            sphere.indices.insert(sphere.indices.end(), {ring(j, i), ring(j, i + 1), ring(j + 1, i + 1)});
+            sphere.indices.insert(sphere.indices.end(), {ring(j, i), ring(j + 1, i + 1), ring(j + 1, i)});
+        }
+    }
+
+    // Closed cube around the same center, every face split into cells x cells
+    // squares. Its faces are axis-aligned, so the BVH boxes are flat there.
+    const int cells = 64;
+    model cube{"cube", {}, {}};
+    {
+        std::map<std::array<int, 3>, uint32_t> lattice;
+        auto vertex = [&](const std::array<int, 3>& p) {
+            auto [it, added] = lattice.try_emplace(p, static_cast<uint32_t>(cube.vertices.size()));
+            if (added)
+                cube.vertices.push_back(center + (20.0f / cells) * rt::vec3f(p[0], p[1], p[2]) - rt::vec3f(10, 10, 10));
+            return it->second;
+        };
+        for (int axis = 0; axis < 3; axis++) {
+            for (int side : {0, cells}) {
+                for (int i = 0; i < cells; i++) {
+                    for (int j = 0; j < cells; j++) {
+                        auto corner = [&](int di, int dj) {
+                            std::array<int, 3> p;
+                            p[axis] = side;
+                            p[(axis + 1) % 3] = i + di;
+                            p[(axis + 2) % 3] = j + dj;
+                            return vertex(p);
+                        };
+                        uint32_t a = corner(0, 0), b = corner(1, 0), c = corner(1, 1), d = corner(0, 1);
+                        cube.indices.insert(cube.indices.end(), {a, b, c, a, c, d});
+                    }
+                }
+            }
+        }
+    }
+
+    // From a few points inside, one ray through every vertex and through a
+    // random point on every edge
+    auto edge_rays = [&](const model& m) {
+        std::vector<rt::ray> rays;
+        for (auto origin : {center, center + rt::vec3f(1.7f, 2.3f, -0.9f), center + rt::vec3f(-4.1f, 0.6f, 3.3f)}) {
+            for (const auto& v : m.vertices)
+                rays.emplace_back(origin, v - origin, 0.0f);
+            for (size_t t = 0; t < m.indices.size(); t += 3) {
+                for (int e = 0; e < 3; e++) {
+                    auto a = m.vertices[m.indices[t + e]], b = m.vertices[m.indices[t + (e + 1) % 3]];
+                    rays.emplace_back(origin, a + random_float() * (b - a) - origin, 0.0f);
+                }
+            }
+        }
+        return rays;
+    };
+
+    model spot{"spot", {}, {}};
+    auto spot_mesh = rt::load_obj("model/spot.obj", mat);
+    for (const auto& obj : spot_mesh->objects) {
+        const auto& tri = static_cast<const rt::mesh_triangle&>(*obj);
+        for (const auto& v : {tri.v0, tri.v1, tri.v2}) {
+            spot.indices.push_back(static_cast<uint32_t>(spot.vertices.size()));
+            spot.vertices.push_back(v);
+        }
+    }
+
+    const std::pair<std::string, rt::triangle_test> modes[] = {
+        {"Moller-Trumbore", rt::triangle_test::moller_trumbore}, {"watertight", rt::triangle_test::watertight}};
+    const rt::triangle_test saved_mode = rt::triangle_test_mode;
+
+    for (const model* m : {&sphere, &cube, &spot}) {
+        rt::hittable_list triangles, mesh_triangles;
+        for (size_t t = 0; t < m->indices.size(); t += 3) {
+            auto a = m->vertices[m->indices[t]], b = m->vertices[m->indices[t + 1]], c = m->vertices[m->indices[t + 2]];
+            triangles.add(make_shared<rt::triangle>(a, b, c, mat));
+            mesh_triangles.add(make_shared<rt::mesh_triangle>(a, b, c, mat));
+        }
+        rt::linear_bvh triangle_bvh(triangles), mesh_triangle_bvh(mesh_triangles);
+        rt::triangle_mesh mesh(m->vertices, m->indices, {mat});
+        std::cout << m->name << " (" << m->indices.size() / 3 << " triangles)" << std::endl;
+
+        if (m != &cube) {
+            const std::pair<std::string, const rt::hittable*> worlds[] = {
+                {"triangle", &triangle_bvh}, {"mesh_triangle", &mesh_triangle_bvh}, {"triangle_mesh", &mesh}};
+            auto rays = rt::benchmark::framing_rays(mesh.bounding_box());
+            for (const auto& [world_name, world] : worlds) {
+                for (const auto& [mode_name, mode] : modes) {
+                    rt::triangle_test_mode = mode;
+                    rt::benchmark::print_trace_result(world_name + ", " + mode_name,
+                                                      rt::benchmark::trace_rays(*world, rays, 4));
+                }
+            }
+        }
+        if (m == &spot) {
+            std::cout << std::endl;
+            continue;
+        }
+
+        rt::bvh_build_options packet4, packet8;
+        packet4.leaf_packet = 4;
+        packet8.leaf_packet = 8;
+        rt::triangle_mesh mesh4(m->vertices, m->indices, {mat}, {}, packet4);
+        rt::triangle_mesh mesh8(m->vertices, m->indices, {mat}, {}, packet8);
+        rt::bvh_node node_bvh(mesh_triangles);
+        rt::treelet_bvh treelet(mesh_triangles);
+        rt::motion_bvh motion(mesh_triangles);
+        rt::bvh4 wide4(mesh_triangles);
+        rt::bvh8 wide8(mesh_triangles);
+        rt::qbvh4 quantized4(mesh_triangles);
+        rt::qbvh8 quantized8(mesh_triangles);
+        const std::pair<std::string, const rt::hittable*> structures[] = {
+            {"bvh_node", &node_bvh}, {"linear_bvh (triangle)", &triangle_bvh}, {"linear_bvh", &mesh_triangle_bvh},
+            {"treelet_bvh", &treelet}, {"motion_bvh", &motion}, {"bvh4", &wide4}, {"bvh8", &wide8},
+            {"qbvh4", &quantized4}, {"qbvh8", &quantized8}, {"triangle_mesh", &mesh},
+            {"triangle_mesh, packet 4", &mesh4}, {"triangle_mesh, packet 8", &mesh8}};
+
+        auto inside = edge_rays(*m);
+        std::cout << "leaks of " << inside.size() << " vertex/edge rays (hit / occluded):" << std::endl;
+        for (const auto& [mode_name, mode] : modes) {
+            rt::triangle_test_mode = mode;
+            for (const auto& [structure_name, structure] : structures) {
+                auto hit = rt::benchmark::trace_rays(*structure, inside);
+                auto occluded = rt::benchmark::trace_occlusion(*structure, inside);
+                std::cout << "  " << std::left << std::setw(44) << structure_name + ", " + mode_name << std::right
+                          << std::setw(8) << hit.rays - hit.hits << " / " << occluded.rays - occluded.hits << std::endl;
+            }
+        }
+        std::cout << std::endl;
+    }
+    rt::triangle_test_mode = saved_mode;
+}
+
+// Writes an n x n cell height field (2 n^2 triangles) to the temp directory,
+// with quads, "v//vn" corners and plain triangles mixed. Returns its path.
+std::string write_grid_obj(const std::string& name, int n) {
+    const std::string path = (std::filesystem::temp_directory_path() / name).string();
+    std::ofstream out(path);
+    for (int j = 0; j <= n; j++)
+        for (int i = 0; i <= n; i++)
+            out << "v " << i * 0.1f << " " << std::sin(i * 0.05f) * std::cos(j * 0.07f) << " " << j * 0.1f << "\n";
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            int v = j * (n + 1) + i + 1;
+            if (i % 2 == 0)
+                out << "f " << v << " " << v + 1 << " " << v + n + 2 << " " << v + n + 1 << "\n";
+            else
+                out << "f " << v << "//1 " << v + 1 << "//1 " << v + n + 2 << "//1\n"
+                    << "f " << v << " " << v + n + 2 << " " << v + n + 1 << "\n";
+        }
+    }
+    return path;
+}
+
+// tinyobj (load_obj_mesh) vs. the mapped, chunked parallel parser on the
+// model files and on a generated OBJ of about two million triangles
+void obj_loader_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    rt::benchmark::Benchmark bench("OBJ loader");
+
+    const std::string big = write_grid_obj("rt_obj_loader_benchmark.obj", 1000);
+
+    struct model { std::string name; std::string file; };
+    const model models[] = {{"teapot", "model/teapot.obj"}, {"suzanne", "model/suzanne.obj"},
+                            {"spot", "model/spot.obj"}, {"2M triangle grid", big}};
+
+    for (const auto& m : models) {
+        int iterations = m.file == big ? 2 : 10;
+        rt::obj_load_stats stats;
+        bench.run(m.name + " tinyobj", [&] { rt::load_obj_mesh(m.file, mat); }, iterations);
+        bench.run(m.name + " parallel", [&] { rt::load_obj_parallel(m.file, mat, {}, &stats); }, iterations);
+        bench.compare(m.name + " tinyobj", m.name + " parallel");
+
+        // tinyobj's parse alone, for the same MB/s figure
+        auto start = std::chrono::steady_clock::now();
+        {
+            tinyobj::attrib_t attrib;
+            std::vector<tinyobj::shape_t> shapes;
+            std::vector<tinyobj::material_t> materials;
+            std::string warn, err;
+            tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, m.file.c_str());
+        }
+        double tinyobj_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << std::fixed << std::setprecision(1) << stats.bytes / 1e6 << " MB, " << stats.vertices
+                  << " vertices, " << stats.triangles << " triangles, " << stats.chunks << " chunks on "
+                  << omp_get_max_threads() << " threads" << std::endl
+                  << "parse: tinyobj " << stats.bytes / tinyobj_seconds * 1e-6 << " MB/s, parallel "
+                  << stats.parse_mb_per_sec() << " MB/s (BVH build " << stats.build_seconds * 1e3 << " ms)" << std::endl;
+
+        // Both loaders must give the same mesh
+        auto reference = rt::load_obj_mesh(m.file, mat);
+        auto mesh = rt::load_obj_parallel(m.file, mat);
+        auto rays = rt::benchmark::framing_rays(reference->bounding_box(), 256, 256, 0.5f);
+        rt::benchmark::print_trace_result(m.name + " tinyobj", rt::benchmark::trace_rays(*reference, rays));
+        rt::benchmark::print_trace_result(m.name + " parallel", rt::benchmark::trace_rays(*mesh, rays));
+        std::cout << std::endl;
+    }
+
+    std::error_code ec;
+    std::filesystem::remove(big, ec);
+}
+
+// A paged mesh under shrinking page cache budgets: trace throughput, page
+// faults and evictions, and the peak resident size, for coherent primary
+// rays and for the same rays shuffled
+void paged_mesh_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    const std::string obj = write_grid_obj("rt_paged_mesh_benchmark.obj", 700);
+    const std::string cache_dir = "cache/benchmark";
+    const auto to_world = rt::affine3f::scaling(10.0f);
+
+    auto cache = make_shared<rt::page_cache>(SIZE_MAX);
+    shared_ptr<rt::paged_mesh> mesh;
+    {
+        rt::benchmark::Timer timer("Paged mesh parse, build and write");
+        timer.showMilli();
+        mesh = rt::load_obj_paged(obj, mat, cache, to_world, {}, cache_dir);
+    }
+    auto reference = rt::load_obj_cached(obj, mat, to_world, {}, cache_dir);
+    std::cout << mesh->triangle_count() << " triangles in " << mesh->page_count() << " pages of "
+              << mesh->paged_bytes() / mesh->page_count() / 1024 << " KiB, " << mesh->paged_bytes() / (1 << 20)
+              << " MiB paged, " << mesh->memory_bytes() / 1024 << " KiB always resident" << std::endl;
+
+    auto bbox = mesh->bounding_box();
+    auto extent = std::fmax(bbox.x.size(), bbox.z.size());
+    auto center = bbox.centroid();
+    auto rays = rt::benchmark::primary_rays(center + rt::vec3f(0.3f * extent, 0.4f * extent, -0.6f * extent),
+                                            center, rt::vec3f(0, 1, 0), 60, 512, 512);
+    auto shuffled = rays;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(7));
+    rt::benchmark::print_trace_result("in memory", rt::benchmark::trace_rays(*reference, rays));
+
+    for (double fraction : {1.0, 0.25, 0.05, 0.01}) {
+        size_t budget = static_cast<size_t>(fraction * mesh->paged_bytes());
+        for (const auto& [order, batch] : {std::pair<const char*, const std::vector<rt::ray>*>{"coherent", &rays},
+                                          {"shuffled", &shuffled}}) {
+            cache = make_shared<rt::page_cache>(budget);
+            auto paged = rt::load_obj_paged(obj, mat, cache, to_world, {}, cache_dir);
+            std::ostringstream name;
+            name << std::fixed << std::setprecision(0) << fraction * 100 << "% budget, " << order;
+            rt::benchmark::print_trace_result(name.str(), rt::benchmark::trace_rays(*paged, *batch));
+
+            auto stats = cache->stats();
+            std::cout << std::fixed << std::setprecision(2) << "  " << stats.faults << " faults, "
+                      << stats.evictions << " evictions, hit rate " << stats.hit_rate() * 100 << "%, read "
+                      << stats.bytes_read / double(1 << 20) << " MiB, peak resident "
+                      << stats.peak_resident_bytes / double(1 << 20) << " of " << budget / double(1 << 20)
+                      << " MiB" << std::endl;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::remove(obj, ec);
+}
+
+// triangle_mesh with float vs. 16-bit quantized vertex positions: memory,
+// decoding error and trace throughput
+void quantized_vertices_benchmark() {
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+
+    const int cols = 1000, rows = 500;
+    std::vector<rt::point3f> grid_vertices;
+    for (int j = 0; j <= rows; j++)
+        for (int i = 0; i <= cols; i++)
+            grid_vertices.emplace_back(i * 0.2f, 4.0f * std::sin(i * 0.05f) * std::cos(j * 0.07f), j * 0.2f);
+    std::vector<uint32_t> grid_indices;
+    for (int j = 0; j < rows; j++) {
+        for (int i = 0; i < cols; i++) {
+            uint32_t v = j * (cols + 1) + i;
+            grid_indices.insert(grid_indices.end(), {v, v + 1, v + cols + 2, v, v + cols + 2, v + cols + 1});
+        }
+    }
+
+    struct model { std::string name; std::string file; };
+    const model models[] = {{"teapot", "model/teapot.obj"}, {"suzanne", "model/suzanne.obj"},
+                            {"spot", "model/spot.obj"}, {"1M triangle grid", ""}};
+
+    for (const auto& m : models) {
+        auto load = [&](bool quantize) {
+            rt::bvh_build_options options;
+            options.quantize_vertices = quantize;
+            if (!m.file.empty()) return rt::load_obj_mesh(m.file, mat, options);
+            return make_shared<rt::triangle_mesh>(grid_vertices, grid_indices,
+                                                  std::vector<shared_ptr<rt::material>>{mat},
+                                                  std::vector<uint16_t>{}, options);
+        };
+        auto full = load(false);
+        auto quantized = load(true);
+
+        float max_error = 0.0f;
+        for (uint32_t i = 0; i < full->vertex_count(); i++) {
+            auto d = quantized->vertex(i) - full->vertex(i);
+            max_error = std::fmax(max_error, std::fmax(std::fabs(d.x()), std::fmax(std::fabs(d.y()), std::fabs(d.z()))));
+        }
+        auto bbox = full->bounding_box();
+        auto extent = std::fmax(bbox.x.size(), std::fmax(bbox.y.size(), bbox.z.size()));
+
+        std::cout << m.name << ": " << full->vertex_count() << " vertices, " << full->triangle_count()
+                  << " triangles" << std::endl << std::fixed << std::setprecision(1)
+                  << "  memory: float " << full->memory_bytes() / 1024.0 << " KiB, quantized "
+                  << quantized->memory_bytes() / 1024.0 << " KiB ("
+                  << (full->memory_bytes() - quantized->memory_bytes()) / 1024.0 << " KiB saved, "
+                  << 100.0 * (full->memory_bytes() - quantized->memory_bytes()) / full->memory_bytes() << "%)"
+                  << std::endl << "  vertex positions: mesh_triangle "
+                  << full->triangle_count() * 3 * sizeof(rt::point3f) / 1024.0 << " KiB, float "
+                  << full->vertex_count() * 3 * sizeof(float) / 1024.0 << " KiB, quantized "
+                  << full->vertex_count() * 3 * sizeof(uint16_t) / 1024.0 << " KiB"
+                  << std::endl << std::scientific << std::setprecision(2)
+                  << "  max vertex error " << max_error << " (" << max_error / extent << " of the extent)"
+                  << std::defaultfloat << std::endl;
+
+        auto rays = rt::benchmark::framing_rays(bbox, 512, 512, 0.5f);
+        rt::benchmark::print_trace_result("  float", rt::benchmark::trace_rays(*full, rays, 4));
+        rt::benchmark::print_trace_result("  quantized", rt::benchmark::trace_rays(*quantized, rays, 4));
+        std::cout << std::endl;
+    }
+}
+
+// The teapot, suzanne and spot side by side on a ground quad, each a
+// triangle_mesh built with options[k] below the caller's top-level BVH
+rt::hittable_list mesh_row_scene(shared_ptr<rt::material> mat, const std::array<rt::bvh_build_options, 3>& options = {}) {
+    const char* files[] = {"model/teapot.obj", "model/suzanne.obj", "model/spot.obj"};
+    rt::hittable_list meshes;
+    for (int k = 0; k < 3; k++) {
+        auto mesh = rt::load_obj_mesh(files[k], mat, options[k]);
+        rt::transform_mesh(*mesh, 80.0f, rt::vec3f(-150.0f + 150.0f * k, 40.0f, 0));
+        meshes.add(mesh);
+    }
+    meshes.add(make_shared<rt::quad>(rt::point3f(-400, -1, -400), rt::vec3f(800, 0, 0), rt::vec3f(0, 0, 800), mat));
+    return meshes;
+}
+
+// The camera looking at mesh_row_scene()
+std::vector<rt::ray> mesh_row_rays(int width, int height) {
+    return rt::benchmark::primary_rays(rt::point3f(0, 120, -400), rt::point3f(0, 40, 0),
+                                       rt::vec3f(0, 1, 0), 50, width, height);
+}
+
+// Primary rays traced one by one vs. as packets of 4, 8 and 16 rays from
+// 2x2, 4x2 and 4x4 pixel blocks, on the Cornell box and on a mesh scene.
+// Packets must find exactly the hits single rays do. Then the same scenes
+// rendered with render_tiles() and with render_packets() at each packet size.
+void ray_packet_benchmark() {
+    const int width = 512, height = 512;
+    struct block { int packet, w, h; };
+    const block blocks[] = {{4, 2, 2}, {8, 4, 2}, {16, 4, 4}};
+    rt::benchmark::Benchmark bench("Ray packets");
+
+    auto compare = [&](const std::string& name, const rt::hittable& world, const std::vector<rt::ray>& rays) {
+        std::cout << name << std::endl;
+        auto single = rt::benchmark::trace_rays(world, rays, 4);
+        rt::benchmark::print_trace_result("  single rays", single);
+        for (const auto& b : blocks) {
+            auto packed = rt::benchmark::block_ordered(rays, width, height, b.w, b.h);
+            auto result = rt::benchmark::trace_packets(world, packed, b.packet, 4);
+            rt::benchmark::print_trace_result("  packet" + std::to_string(b.packet), result);
+            if (result.hits != single.hits)
+                std::cout << "  hit count differs from single rays!" << std::endl;
+        }
+        std::cout << std::endl;
+    };
+
+    auto render = [&](const std::string& name, const rt::hittable& world, rt::Camera cam) {
+        cam.aspect_ratio = 1.0f;
+        cam.image_width = 300;
+        cam.samples_per_pixel = 32;
+        cam.max_depth = 50;
+        cam.defocus_angle = 0;
+        cam.output_filename = name + "_tiles.png";
+        bench.run(name + " render_tiles", [&] { cam.render_tiles(world); }, 1);
+        for (const auto& b : blocks) {
+            std::string packets = name + " render_packets " + std::to_string(b.packet);
+            cam.output_filename = name + "_packets" + std::to_string(b.packet) + ".png";
+            bench.run(packets, [&] { cam.render_packets(world, b.packet); }, 1);
+            bench.compare(name + " render_tiles", packets);
+        }
+    };
+
+    rt::hittable_list cornell = cornell_box_world();
+    rt::linear_bvh cornell_bvh(cornell);
+    compare("Cornell box", cornell_bvh,
+            rt::benchmark::primary_rays(rt::point3f(278, 278, -800), rt::point3f(278, 278, 0),
+                                        rt::vec3f(0, 1, 0), 40, width, height));
+
+    // Three meshes on a ground quad, each a triangle_mesh below the top-level BVH
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    rt::linear_bvh mesh_bvh(mesh_row_scene(mat));
+    compare("Meshes", mesh_bvh, mesh_row_rays(width, height));
+
+    rt::Camera cam;
+    cam.background = rt::color(0, 0, 0);
+    cam.vfov       = 40;
+    cam.lookfrom   = rt::point3f(278, 278, -800);
+    cam.lookat     = rt::point3f(278, 278, 0);
+    cam.vup        = rt::vec3f(0, 1, 0);
+    render("cornell", cornell_bvh, cam);
+
+    // Same camera as mesh_row_rays()
+    cam.background = rt::color(0.70f, 0.80f, 1.00f);
+    cam.vfov       = 50;
+    cam.lookfrom   = rt::point3f(0, 120, -400);
+    cam.lookat     = rt::point3f(0, 40, 0);
+    render("meshes", mesh_bvh, cam);
+}
+
+// Recursive render_tiles() vs. the wavefront integrator, on the Cornell box
+// (five materials) and on spheres with a few hundred lambertian, metal and
+// glass materials
+void wavefront_benchmark() {
+    rt::benchmark::Benchmark bench("Wavefront");
+
+    rt::hittable_list spheres;
+    auto ground = make_shared<rt::lambertian>(rt::color(0.5f, 0.5f, 0.5f));
+    spheres.add(make_shared<rt::sphere>(rt::point3f(0.0f, -1000.0f, 0.0f), 1000.0f, ground));
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            rt::point3f center(a + 0.9f * random_float(), 0.2f, b + 0.9f * random_float());
+            float choose_mat = random_float();
+            shared_ptr<rt::material> mat;
+            if (choose_mat < 0.8f)       mat = make_shared<rt::lambertian>(rt::color::random() * rt::color::random());
+            else if (choose_mat < 0.95f) mat = make_shared<rt::metal>(rt::color::random(0.5f, 1.0f), random_float(0.0f, 0.5f));
+            else                         mat = make_shared<rt::dielectrics>(1.5f);
+            spheres.add(make_shared<rt::sphere>(center, 0.2f, mat));
+        }
+    }
+    spheres.add(make_shared<rt::sphere>(rt::point3f(0, 1, 0), 1.0f, make_shared<rt::dielectrics>(1.5f)));
+    spheres.add(make_shared<rt::sphere>(rt::point3f(4, 1, 0), 1.0f, make_shared<rt::metal>(rt::color(0.7f, 0.6f, 0.5f), 0.0f)));
+    rt::linear_bvh spheres_bvh(spheres);
+
+    rt::hittable_list cornell = cornell_box_world();
+    rt::linear_bvh cornell_bvh(cornell);
+
+    auto run = [&](const std::string& name, const rt::hittable& world, rt::Camera cam) {
+        cam.image_width = 300;
+        cam.samples_per_pixel = 32;
+        cam.max_depth = 50;
+        cam.defocus_angle = 0;
+        cam.output_filename = name + "_tiles.png";
+        bench.run(name + " render_tiles", [&] { cam.render_tiles(world); }, 1);
+        cam.output_filename = name + "_wavefront.png";
+        bench.run(name + " render_wavefront", [&] { cam.render_wavefront(world); }, 1);
+        bench.compare(name + " render_tiles", name + " render_wavefront");
+    };
+
+    rt::Camera cam;
+    cam.aspect_ratio = 1.0f;
+    cam.background   = rt::color(0, 0, 0);
+    cam.vfov         = 40;
+    cam.lookfrom     = rt::point3f(278, 278, -800);
+    cam.lookat       = rt::point3f(278, 278, 0);
+    cam.vup          = rt::vec3f(0, 1, 0);
+    run("cornell", cornell_bvh, cam);
+
+    cam.aspect_ratio = 16.0f / 9.0f;
+    cam.background   = rt::color(0.70f, 0.80f, 1.00f);
+    cam.vfov         = 20;
+    cam.lookfrom     = rt::point3f(13, 2, 3);
+    cam.lookat       = rt::point3f(0, 0, 0);
+    run("spheres", spheres_bvh, cam);
+}
+
+// First-bounce rays of a teapot among 100k diffuse and metal spheres, traced in
+// the order the path tracer produces them and after sorting by direction
+// octant and origin Morton code in batches of various sizes. The cache
+// model counts node misses; the scene is one linear_bvh so every node fetch
+// is seen.
+void ray_sort_benchmark() {
+    shared_ptr<rt::material> diffuse = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    shared_ptr<rt::material> shiny = make_shared<rt::metal>(rt::color(0.8, 0.8, 0.8), 0.2f);
+    auto world = rt::load_obj("model/teapot.obj", diffuse);
+    rt::transform_mesh(*world, 80.0f, rt::vec3f(0, 0, 0));
+    for (int i = 0; i < 100000; i++)
+        world->add(make_shared<rt::sphere>(rt::point3f::random(-300.0f, 300.0f) + rt::vec3f(0, 300.0f, 0),
+                                           random_float(0.5f, 2.0f), i % 2 ? diffuse : shiny));
+    world->add(make_shared<rt::quad>(rt::point3f(-400, -1, -400), rt::vec3f(800, 0, 0), rt::vec3f(0, 0, 800), diffuse));
+    rt::linear_bvh scene(*world);
+    std::cout << scene.memory_bytes() / 1024 << " KiB of nodes" << std::endl;
+
+    auto primary = rt::benchmark::primary_rays(rt::point3f(0, 120, -300), rt::point3f(0, 20, 0),
+                                               rt::vec3f(0, 1, 0), 50, 512, 512);
+    auto secondary = rt::benchmark::scattered_rays(scene, primary);
+    std::cout << secondary.size() << " secondary rays" << std::endl;
+
+    auto unsorted = rt::benchmark::trace_footprint(scene, secondary);
+    rt::benchmark::print_footprint_result("unsorted", unsorted);
+    rt::benchmark::print_trace_result("unsorted", rt::benchmark::trace_rays(scene, secondary, 4));
+
+    const size_t batches[] = {256, 1024, 4096, 16384, 65536, 0};
+    for (size_t batch : batches) {
+        auto rays = secondary;
+        auto start = std::chrono::steady_clock::now();
+        rt::sort_rays(rays, scene.bounding_box(), batch);
+        double sort_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::string name = batch ? "batch " + std::to_string(batch) : "whole set";
+        auto sorted = rt::benchmark::trace_footprint(scene, rays);
+        rt::benchmark::print_footprint_result(name, sorted);
+        rt::benchmark::print_trace_result(name, rt::benchmark::trace_rays(scene, rays, 4));
+        std::cout << std::fixed << std::setprecision(1) << "  sort " << sort_ms << " ms, misses vs. unsorted: L1 "
+                  << 100.0 * (double(sorted.l1_misses) / unsorted.l1_misses - 1.0) << "%, L2 "
+                  << 100.0 * (double(sorted.l2_misses) / unsorted.l2_misses - 1.0) << "%, TLB "
+                  << 100.0 * (double(sorted.tlb_misses) / unsorted.tlb_misses - 1.0) << "%" << std::endl;
+    }
+}
+
+// The VecN<float, 3> specialization vec3_SIMD.hpp had before vec3_m128: a
+// std::array that every operator loads into an __m128 and stores back.
+struct alignas(16) legacy_vec3 {
+    std::array<float, 3> e;
+
+    legacy_vec3() : e{0.0f, 0.0f, 0.0f} {}
+    legacy_vec3(float x, float y, float z) : e{x, y, z} {}
+
+    static __m128 load(const legacy_vec3& v) { return _mm_set_ps(0.0f, v.e[2], v.e[1], v.e[0]); }
+    static legacy_vec3 store(__m128 m) {
+        float out[4];
+        _mm_storeu_ps(out, m);
+        return legacy_vec3(out[0], out[1], out[2]);
+    }
+    static float sum(__m128 m) {
+#ifdef __SSE3__
+        m = _mm_hadd_ps(m, m);
+        return _mm_cvtss_f32(_mm_hadd_ps(m, m));
+#else
+        __m128 shuf = _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1));
+        __m128 sums = _mm_add_ps(m, shuf);
+        return _mm_cvtss_f32(_mm_add_ss(sums, _mm_movehl_ps(shuf, sums)));
+#endif
+    }
+
+    float operator[](size_t i) const { return e[i]; }
+    float length() const { return std::sqrt(sum(_mm_mul_ps(load(*this), load(*this)))); }
+    legacy_vec3& operator+=(const legacy_vec3& o) { return *this = store(_mm_add_ps(load(*this), load(o))); }
+};
+
+inline legacy_vec3 operator+(const legacy_vec3& a, const legacy_vec3& b) { return legacy_vec3::store(_mm_add_ps(legacy_vec3::load(a), legacy_vec3::load(b))); }
+inline legacy_vec3 operator-(const legacy_vec3& a, const legacy_vec3& b) { return legacy_vec3::store(_mm_sub_ps(legacy_vec3::load(a), legacy_vec3::load(b))); }
+inline legacy_vec3 operator*(float t, const legacy_vec3& a) { return legacy_vec3::store(_mm_mul_ps(_mm_set1_ps(t), legacy_vec3::load(a))); }
+inline legacy_vec3 operator/(const legacy_vec3& a, float t) {
+    if (nearlyEqual(t, 0.0f)) throw std::invalid_argument("Division by zero");
+    return legacy_vec3::store(_mm_mul_ps(legacy_vec3::load(a), _mm_set1_ps(1.0f / t)));
+}
+inline float dot(const legacy_vec3& a, const legacy_vec3& b) { return legacy_vec3::sum(_mm_mul_ps(legacy_vec3::load(a), legacy_vec3::load(b))); }
+inline legacy_vec3 cross(const legacy_vec3& a, const legacy_vec3& b) {
+    __m128 va = legacy_vec3::load(a), vb = legacy_vec3::load(b);
+    __m128 a_yzx = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1)), b_zxy = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 a_zxy = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 1, 0, 2)), b_yzx = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
+    return legacy_vec3::store(_mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx)));
+}
+inline legacy_vec3 unit_vector(const legacy_vec3& a) { return a / a.length(); }
+
+// Shading-style vector chains (cross, normalize, reflect, divide) over 64k
+// vectors with the generic VecN<float, 3>, the old load/store SSE
+// specialization and vec3_m128. Build with _USE_SIMD_ to make rt::vec3f the
+// vec3_m128-backed specialization instead of the generic one.
+void vec3_benchmark() {
+    rt::benchmark::Benchmark bench("vec3");
+    const size_t count = 1 << 16;
+    std::vector<float> input(count * 9);
+    for (auto& f : input) f = random_float(-1.0f, 1.0f);
+
+    auto run = [&](const std::string& name, auto zero) {
+        using vec = decltype(zero);
+        std::vector<vec> a, b, n;
+        for (size_t i = 0; i < count; i++) {
+            const float* f = &input[i * 9];
+            a.push_back(vec(f[0], f[1], f[2]));
+            b.push_back(vec(f[3], f[4], f[5]));
+            n.push_back(unit_vector(vec(f[6], f[7], f[8])));
+        }
+        vec acc = zero;
+        bench.run(name, [&] {
+            acc = zero;
+            for (size_t i = 0; i < count; i++) {
+                vec t = unit_vector(cross(a[i], b[i]) + 0.5f * a[i]);
+                vec r = t - 2.0f * dot(t, n[i]) * n[i];
+                acc += (r - b[i]) / (dot(a[i], a[i]) + 1.0f);
+            }
+        }, 50);
+        std::cout << std::fixed << std::setprecision(4) << "  sum (" << acc[0] << ", " << acc[1] << ", "
+                  << acc[2] << ")" << std::defaultfloat << std::endl;
+    };
+
+#ifdef _USE_SIMD_
+    const std::string vecn = "VecN<float, 3> (vec3_m128)";
+#else
+    const std::string vecn = "VecN<float, 3> (generic)";
+#endif
+    run(vecn, rt::vec3f());
+    run("legacy SSE", legacy_vec3());
+    run("vec3_m128", rt::vec3_m128());
+    bench.compare(vecn, "legacy SSE");
+    bench.compare(vecn, "vec3_m128");
+    bench.compare("legacy SSE", "vec3_m128");
+}
+
+// The dispatched kernels (mesh and top-level BVH traversal with triangle
+// tests, packet traversal, tonemapping) with dispatch capped at each ISA level
+// the CPU has, from the build's own level up. Every level must find the same
+// hits and bytes. Build with RT_PORTABLE (-march=x86-64) to see what runtime
+// dispatch buys a baseline binary; a -march=native build only adds levels
+// above the build machine's.
+void cpu_dispatch_benchmark() {
+    const int width = 512, height = 512;
+    auto mat = make_shared<rt::lambertian>(rt::color(0.8, 0.8, 0.8));
+    std::array<rt::bvh_build_options, 3> options;
+    options[2].leaf_packet = 8;  // spot in 8-wide packets, the others with scalar leaves
+    rt::linear_bvh scene(mesh_row_scene(mat, options));
+    auto rays = mesh_row_rays(width, height);
+    auto packed = rt::benchmark::block_ordered(rays, width, height, 4, 2);
+
+    std::vector<rt::color> framebuffer(3840 * 2160);
+    for (auto& c : framebuffer) c = rt::color::random(0.0f, 1.2f);
+    std::vector<unsigned char> bytes(framebuffer.size() * 3), reference;
+
+    const rt::isa_level detected = rt::limit_isa(rt::isa_level::avx512);
+    rt::log_isa();
+    size_t reference_hits = 0;
+    const int lowest = static_cast<int>(rt::compiled_isa);
+    for (int l = lowest; l <= static_cast<int>(detected); l++) {
+        auto level = rt::limit_isa(static_cast<rt::isa_level>(l));
+        std::cout << rt::isa_name(level) << std::endl;
+        auto single = rt::benchmark::trace_rays(scene, rays, 4);
+        auto packet = rt::benchmark::trace_packets(scene, packed, 8, 4);
+        rt::benchmark::print_trace_result("  single rays", single);
+        rt::benchmark::print_trace_result("  packet8", packet);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 10; i++)
+            rt::tonemap_to_bytes(framebuffer.data(), framebuffer.size(), bytes.data());
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / 10;
+        std::cout << std::fixed << std::setprecision(2) << "  tonemap 3840x2160     " << ms << " ms"
+                  << std::defaultfloat << std::endl;
+
+        if (l == lowest) {
+            reference_hits = single.hits;
+            reference = bytes;
+        }
+        if (single.hits != reference_hits || packet.hits != reference_hits)
+            std::cout << "  hit count differs from the lowest level!" << std::endl;
+        if (bytes != reference)
+            std::cout << "  tonemapped bytes differ from the lowest level!" << std::endl;
+    }
+    rt::limit_isa(detected);
+}
+
+// rt::fast against libm, per function over 1M inputs from the domain the
+// renderer uses: ns per value for libm, the scalar approximation and the
+// float_lanes<4> / <8> versions, and the largest error against double libm.
+// Then earth() and final_scene(400, 250, 4) end to end; build once with and
+// once without RT_FAST_MATH to compare those.
+void fast_math_benchmark() {
+    rt::benchmark::Benchmark bench("fast math");
+    const size_t count = 1 << 20;
+    std::vector<float> x(count), y(count), out(count);
+
+    auto run = [&](const std::string& fn, auto ref, auto std_fn, auto scalar, auto lanes4, auto lanes8) {
+        auto check = [&](const std::string& name) {
+            double err = 0.0;
+            for (size_t i = 0; i < count; i++)
+                err = std::max(err, std::abs(static_cast<double>(out[i]) - ref(x[i], y[i])));
+            std::cout << "  " << name << " max abs error " << std::scientific << std::setprecision(2) << err
+                      << std::defaultfloat << std::endl;
+        };
+        auto time = [&](const std::string& name, auto&& body) {
+            auto result = bench.run(name, body, 20);
+            std::cout << "  " << result.mean() / count << " ns/value" << std::endl;
+            check(name);
+            return result.mean();
+        };
+        double libm = time(fn + " libm", [&] {
+            for (size_t i = 0; i < count; i++) out[i] = std_fn(x[i], y[i]);
+        });
+        double fast = time(fn + " fast", [&] {
+            for (size_t i = 0; i < count; i++) out[i] = scalar(x[i], y[i]);
+        });
+        double x4 = time(fn + " fast x4", [&] {
+            for (size_t i = 0; i < count; i += 4)
+                lanes4(rt::float_lanes<4>::loadu(&x[i]), rt::float_lanes<4>::loadu(&y[i])).storeu(&out[i]);
+        });
+        double x8 = time(fn + " fast x8", [&] {
+            for (size_t i = 0; i < count; i += 8)
+                lanes8(rt::float_lanes<8>::loadu(&x[i]), rt::float_lanes<8>::loadu(&y[i])).storeu(&out[i]);
+        });
+        std::cout << std::fixed << std::setprecision(1) << fn << " speedup over libm: scalar " << libm / fast
+                  << "x, x4 " << libm / x4 << "x, x8 " << libm / x8 << "x" << std::defaultfloat << std::endl;
+    };
+    auto fill = [&](float lo, float hi) {
+        for (size_t i = 0; i < count; i++) {
+            x[i] = random_float(lo, hi);
+            y[i] = random_float(lo, hi);
+        }
+    };
+
+    // random_float() is in [0, 1); the fog samples log of it
+    fill(1e-7f, 1.0f);
+    run("log", [](float a, float) { return std::log(static_cast<double>(a)); },
+        [](float a, float) { return std::log(a); },
+        [](float a, float) { return rt::fast::log(a); },
+        [](auto a, auto) { return rt::fast::log(a); },
+        [](auto a, auto) { return rt::fast::log(a); });
+
+    // The noise texture's argument: scale * z plus up to 10 * turbulence
+    fill(-100.0f, 100.0f);
+    run("sin", [](float a, float) { return std::sin(static_cast<double>(a)); },
+        [](float a, float) { return std::sin(a); },
+        [](float a, float) { return rt::fast::sin(a); },
+        [](auto a, auto) { return rt::fast::sin(a); },
+        [](auto a, auto) { return rt::fast::sin(a); });
+
+    // Sphere uv: acos(-y) and atan2(-z, x) of a unit normal
+    fill(-1.0f, 1.0f);
+    run("acos", [](float a, float) { return std::acos(static_cast<double>(a)); },
+        [](float a, float) { return std::acos(a); },
+        [](float a, float) { return rt::fast::acos(a); },
+        [](auto a, auto) { return rt::fast::acos(a); },
+        [](auto a, auto) { return rt::fast::acos(a); });
+    run("atan2", [](float a, float b) { return std::atan2(static_cast<double>(a), static_cast<double>(b)); },
+        [](float a, float b) { return std::atan2(a, b); },
+        [](float a, float b) { return rt::fast::atan2(a, b); },
+        [](auto a, auto b) { return rt::fast::atan2(a, b); },
+        [](auto a, auto b) { return rt::fast::atan2(a, b); });
+
+    // Schlick's (1 - cos)^5 with cos in [0, 1]
+    fill(0.0f, 1.0f);
+    run("pow5", [](float a, float) { return std::pow(static_cast<double>(a), 5); },
+        [](float a, float) { return static_cast<float>(std::pow(a, 5)); },
+        [](float a, float) { return rt::fast::pow5(a); },
+        [](auto a, auto) { return rt::fast::pow5(a); },
+        [](auto a, auto) { return rt::fast::pow5(a); });
+
+#ifdef RT_FAST_MATH
+    std::cout << "End to end, RT_FAST_MATH on" << std::endl;
+#else
+    std::cout << "End to end, RT_FAST_MATH off (libm)" << std::endl;
+#endif
+    bench.timeFunction("earth()", [] { earth(); });
+    bench.timeFunction("final_scene(400, 250, 4)", [] { final_scene(400, 250, 4); });
+}
+
 int main() {
     rt::benchmark::Timer timer("Rendering process");
     timer.showMilli().showSeconds().showMinutes();
@@ -503,6 +1880,27 @@ int main() {
         case 8:  final_scene(1000, 2000, 40);   break;
         case 9: three_D_model();                break;
         case 10: multiple_models();             break;
+        case 11: bvh_builders_benchmark();      break;
+        case 12: bvh_parallel_build_benchmark(); break;
+        case 13: bvh_animation_benchmark();     break;
+        case 14: bvh_spatial_split_benchmark(); break;
+        case 15: bvh_memory_benchmark();        break;
+        case 16: motion_blur_benchmark();       break;
+        case 17: shadow_ray_benchmark();        break;
+        case 18: bvh_cache_benchmark();         break;
+        case 19: bvh_layout_benchmark();        break;
+        case 20: triangle_mesh_benchmark();     break;
+        case 21: triangle_packet_benchmark();   break;
+        case 22: watertight_triangle_benchmark(); break;
+        case 23: obj_loader_benchmark();        break;
+        case 24: paged_mesh_benchmark();        break;
+        case 25: quantized_vertices_benchmark(); break;
+        case 26: ray_packet_benchmark();        break;
+        case 27: wavefront_benchmark();         break;
+        case 28: ray_sort_benchmark();          break;
+        case 29: vec3_benchmark();              break;
+        case 30: cpu_dispatch_benchmark();      break;
+        case 31: fast_math_benchmark();         break;
         default: final_scene(400,   250,  4);   break;
     }
     return 0;
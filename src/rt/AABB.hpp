@@ -1,10 +1,19 @@
 #pragma once
 
+#include <utility>
+
 #include "rtm/interval.hpp"
 #include "rtm/vector.hpp"
 #include "rtm/ray.hpp"
 
 namespace rt {
+
+// Rounding in the slab test can make a ray that grazes a box miss it, which
+// leaks rays through edges the watertight triangle test would catch. Every
+// box test pushes the far distance out by 1 + 2 * gamma(3) (PBRT, section
+// 6.8.2), the error bound of the three operations behind it.
+constexpr float bvh_slab_margin = 1.0f + 2.0f * (3.0f * 0x1p-24f) / (1.0f - 3.0f * 0x1p-24f);
+
 class AABB {
 public:
     interval x, y, z;
@@ -52,20 +61,29 @@ public:
             auto t0 = (ax.min - ray_orig[axis]) * adinv;
             auto t1 = (ax.max - ray_orig[axis]) * adinv;
 
-            if (t0 < t1) {
-                if (t0 > ray_t.min) ray_t.min = t0;
-                if (t1 < ray_t.max) ray_t.max = t1;
-            } else {
-                if (t1 > ray_t.min) ray_t.min = t1;
-                if (t0 < ray_t.max) ray_t.max = t0;
-            }
+            // Entry and exit by the sign of the direction, not by comparing
+            // t0 and t1: a ray in a bounds plane gives 0 * inf = nan, which
+            // then fails both tests below and leaves the slab open.
+            if (adinv < 0.0f) std::swap(t0, t1);
+            if (t0 > ray_t.min) ray_t.min = t0;
+            if (t1 * bvh_slab_margin < ray_t.max) ray_t.max = t1 * bvh_slab_margin;
 
-            if (ray_t.max <= ray_t.min)
+            if (ray_t.max < ray_t.min)
                 return false;
         }
         return true;
     }
 
+    point3f centroid() const {
+        return point3f(0.5f * (x.min + x.max), 0.5f * (y.min + y.max), 0.5f * (z.min + z.max));
+    }
+
+    // Half of the surface area; the SAH only ever compares ratios, so the factor 2 is dropped.
+    float half_area() const {
+        auto dx = x.size(), dy = y.size(), dz = z.size();
+        return dx * dy + dy * dz + dz * dx;
+    }
+
     int longest_axis() const {
         // Returns the index of the longest axis of the bounding box.
 
@@ -90,6 +108,55 @@ private:
 const AABB AABB::empty    = AABB(interval::empty,    interval::empty,    interval::empty);
 const AABB AABB::universe = AABB(interval::universe, interval::universe, interval::universe);
 
+// Intersection of two boxes; empty when they do not overlap.
+inline AABB overlap(const AABB& a, const AABB& b) {
+    interval ax[3];
+    for (int i = 0; i < 3; i++) {
+        const interval& ia = a.axis_interval(i);
+        const interval& ib = b.axis_interval(i);
+        ax[i] = interval(std::fmax(ia.min, ib.min), std::fmin(ia.max, ib.max));
+        if (ax[i].min > ax[i].max) return AABB::empty;
+    }
+    return AABB(ax[0], ax[1], ax[2]);
+}
+
+// Part of a box inside the slab lo <= p[axis] <= hi.
+inline AABB clip_box(const AABB& box, int axis, float lo, float hi) {
+    interval slab[3] = {interval::universe, interval::universe, interval::universe};
+    slab[axis] = interval(lo, hi);
+    return overlap(box, AABB(slab[0], slab[1], slab[2]));
+}
+
+// Bounds of the part of triangle abc inside the slab lo <= p[axis] <= hi: the
+// vertices inside the slab plus every point where an edge crosses a slab plane.
+inline AABB clip_triangle(const point3f& a, const point3f& b, const point3f& c, int axis, float lo, float hi) {
+    const point3f v[3] = {a, b, c};
+    point3f min( INF,  INF,  INF);
+    point3f max(-INF, -INF, -INF);
+    auto grow = [&](const point3f& p) {
+        for (int i = 0; i < 3; i++) {
+            min[i] = std::fmin(min[i], p[i]);
+            max[i] = std::fmax(max[i], p[i]);
+        }
+    };
+
+    for (int i = 0; i < 3; i++) {
+        const point3f& p = v[i];
+        const point3f& q = v[(i + 1) % 3];
+        if (lo <= p[axis] && p[axis] <= hi)
+            grow(p);
+        for (float plane : {lo, hi}) {
+            if ((p[axis] < plane) != (q[axis] < plane)) {
+                point3f x = p + ((plane - p[axis]) / (q[axis] - p[axis])) * (q - p);
+                x[axis] = plane;
+                grow(x);
+            }
+        }
+    }
+    if (min[0] > max[0]) return AABB::empty;
+    return AABB(min, max);
+}
+
 AABB operator+(const AABB& bbox, const vec3f& offset) {
     return AABB(bbox.x + offset.x(), bbox.y + offset.y(), bbox.z + offset.z());
 }
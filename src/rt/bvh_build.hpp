@@ -0,0 +1,288 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include <omp.h>
+
+#include "AABB.hpp"
+#include "hittable.hpp"
+
+// OpenMP 3.0 tasks drive the parallel build; MSVC's default OpenMP 2.0 has no
+// tasks, so it falls back to the serial build.
+#if defined(_OPENMP) && _OPENMP >= 200805
+    #define RT_OMP_TASKS 1
+#else
+    #define RT_OMP_TASKS 0
+#endif
+
+namespace rt {
+
+// Strategy used to split a span of primitives into two children.
+enum class bvh_split {
+    median,     // split at the median object along the longest axis
+    sah,        // binned surface area heuristic
+    spatial     // SAH plus spatial splits that clip references (SBVH)
+};
+
+// Settings shared by the builders that produce leaves with several primitives.
+struct bvh_build_options {
+    bvh_split split = bvh_split::sah;
+    int max_leaf_size = 2;              // spans this small always become a leaf
+    bool parallel = true;               // build subtrees as OpenMP tasks
+    size_t parallel_threshold = 4096;   // spans smaller than this are built serially
+
+    // bvh_split::spatial only
+    float spatial_budget = 0.3f;        // duplicate references allowed, relative to the primitive count
+    float spatial_overlap = 1e-5f;      // try spatial splits when object split children overlap
+                                        // by more than this fraction of the root area
+
+    // triangle_mesh only
+    int leaf_packet = 0;                // 4 or 8: every leaf becomes one SIMD packet of up to
+                                        // that many triangles, 0 keeps scalar leaves
+    bool quantize_vertices = false;     // store positions as 16-bit offsets in the mesh bounds;
+                                        // not with leaf_packet, whose packets hold floats
+};
+
+// A BVH node in a flat, depth-first array. The first child of an interior node
+// always directly follows it, so only the second child needs an index.
+struct alignas(32) bvh_flat_node {
+    float bmin[3];
+    uint32_t offset;    // leaf: first primitive slot, interior: index of the second child
+    float bmax[3];
+    uint16_t count;     // primitives in the leaf, 0 for interior nodes
+    uint16_t axis;      // split axis of an interior node
+
+    bool is_leaf() const { return count > 0; }
+
+    AABB bounds() const {
+        return AABB(interval(bmin[0], bmax[0]), interval(bmin[1], bmax[1]), interval(bmin[2], bmax[2]));
+    }
+
+    void set_bounds(const AABB& box) {
+        for (int a = 0; a < 3; a++) {
+            bmin[a] = box.axis_interval(a).min;
+            bmax[a] = box.axis_interval(a).max;
+        }
+    }
+};
+static_assert(sizeof(bvh_flat_node) == 32, "bvh_flat_node should fill half a cache line");
+
+// Traversals keep their pending nodes on a fixed stack and push at most one
+// entry per level, so no builder may make a tree deeper than bvh_max_depth.
+constexpr int bvh_stack_size = 64;
+constexpr int bvh_max_depth = bvh_stack_size - 1;
+
+// Median splits halve a span, and 32 of them take any 32-bit primitive count
+// down to a leaf. Below this depth the builders split at the median only, so
+// degenerate input such as many coincident centroids still fits the stack.
+constexpr int bvh_median_depth = bvh_max_depth - 32;
+
+// Node array plus the primitive order its leaves refer to.
+struct flat_bvh {
+    std::vector<bvh_flat_node> nodes;
+    std::vector<uint32_t> indices;  // source primitive index for every leaf slot
+
+    size_t memory_bytes() const {
+        return nodes.size() * sizeof(bvh_flat_node) + indices.size() * sizeof(uint32_t);
+    }
+};
+
+// Spans at least this large are binned by several tasks at once.
+constexpr size_t bvh_parallel_binning_span = 1 << 16;
+
+// Bounds and centroid of a primitive, computed once before the build so the
+// builder never has to call the virtual bounding_box() again.
+struct bvh_primitive {
+    AABB bbox;
+    point3f centroid;
+    size_t index;   // index into the source object array
+};
+
+inline std::vector<bvh_primitive> make_bvh_primitives(
+    const std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end)
+{
+    std::vector<bvh_primitive> prims(end - start);
+    #pragma omp parallel for if(end - start > 4096)
+    for (long long i = 0; i < static_cast<long long>(end - start); i++) {
+        AABB box = objects[start + i]->bounding_box();
+        prims[i] = {box, box.centroid(), static_cast<size_t>(start + i)};
+    }
+    return prims;
+}
+
+inline AABB bounds_of(const std::vector<bvh_primitive>& prims, size_t start, size_t end) {
+    AABB box = AABB::empty;
+    for (size_t i = start; i < end; i++)
+        box = AABB(box, prims[i].bbox);
+    return box;
+}
+
+inline AABB centroid_bounds_of(const std::vector<bvh_primitive>& prims, size_t start, size_t end) {
+    AABB box = AABB::empty;
+    for (size_t i = start; i < end; i++) {
+        const point3f& c = prims[i].centroid;
+        box.x = interval(box.x, interval(c.x(), c.x()));
+        box.y = interval(box.y, interval(c.y(), c.y()));
+        box.z = interval(box.z, interval(c.z(), c.z()));
+    }
+    return box;
+}
+
+// Where a span was split: [start, mid) goes left, [mid, end) goes right.
+struct bvh_partition {
+    size_t mid;
+    int axis;
+};
+
+// Sort-free median split: partitions [start, end) around the middle element by
+// the minimum of each box along the longest axis of the span bounds.
+inline bvh_partition partition_median(std::vector<bvh_primitive>& prims, size_t start, size_t end, const AABB& bbox) {
+    int axis = bbox.longest_axis();
+    size_t mid = start + (end - start) / 2;
+    std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+        [axis](const bvh_primitive& a, const bvh_primitive& b) {
+            return a.bbox.axis_interval(axis).min < b.bbox.axis_interval(axis).min;
+        });
+    return {mid, axis};
+}
+
+// Result of a binned SAH sweep over a span of primitives.
+struct sah_split {
+    int axis = -1;      // -1 when no valid split plane was found
+    int bin = 0;        // primitives in bins [0, bin] go to the left child
+    float cost = INF;   // count-weighted half areas of both children
+};
+
+template <int Bins = 16>
+struct sah_binner {
+    static constexpr int bin_count = Bins;
+
+    static int bin_of(const point3f& c, const AABB& cbounds, int axis) {
+        const interval& ax = cbounds.axis_interval(axis);
+        int b = static_cast<int>(Bins * ((c[axis] - ax.min) / ax.size()));
+        return std::clamp(b, 0, Bins - 1);
+    }
+
+    // Per-axis bin boxes and counts for one span of primitives.
+    struct bins {
+        AABB box[3][Bins];
+        size_t count[3][Bins] = {};
+
+        bins() {
+            for (int a = 0; a < 3; a++)
+                for (int b = 0; b < Bins; b++)
+                    box[a][b] = AABB::empty;
+        }
+
+        void add(const std::vector<bvh_primitive>& prims, size_t start, size_t end, const AABB& cbounds) {
+            for (size_t i = start; i < end; i++) {
+                for (int a = 0; a < 3; a++) {
+                    if (cbounds.axis_interval(a).size() <= 0.0f) continue;
+                    int b = bin_of(prims[i].centroid, cbounds, a);
+                    box[a][b] = AABB(box[a][b], prims[i].bbox);
+                    count[a][b]++;
+                }
+            }
+        }
+
+        void merge(const bins& other) {
+            for (int a = 0; a < 3; a++) {
+                for (int b = 0; b < Bins; b++) {
+                    box[a][b] = AABB(box[a][b], other.box[a][b]);
+                    count[a][b] += other.count[a][b];
+                }
+            }
+        }
+    };
+
+    static bins fill(const std::vector<bvh_primitive>& prims, size_t start, size_t end, const AABB& cbounds) {
+        bins result;
+#if RT_OMP_TASKS
+        // Large spans near the root would otherwise be binned by one thread
+        // while the rest wait for the subtree tasks to fan out.
+        if (end - start >= bvh_parallel_binning_span && omp_in_parallel()) {
+            constexpr size_t chunk = bvh_parallel_binning_span / 4;
+            size_t chunks = (end - start + chunk - 1) / chunk;
+            std::vector<bins> partial(chunks);
+            for (size_t c = 0; c < chunks; c++) {
+                #pragma omp task default(shared) firstprivate(c)
+                partial[c].add(prims, start + c * chunk, std::min(end, start + (c + 1) * chunk), cbounds);
+            }
+            #pragma omp taskwait
+            for (const auto& p : partial)
+                result.merge(p);
+            return result;
+        }
+#endif
+        result.add(prims, start, end, cbounds);
+        return result;
+    }
+
+    // Evaluates every bin boundary on every axis and returns the cheapest one.
+    static sah_split find(const std::vector<bvh_primitive>& prims, size_t start, size_t end, const AABB& cbounds) {
+        sah_split best;
+        bins binned = fill(prims, start, end, cbounds);
+
+        for (int axis = 0; axis < 3; axis++) {
+            if (cbounds.axis_interval(axis).size() <= 0.0f)
+                continue;
+
+            const AABB* bin_box = binned.box[axis];
+            const size_t* bin_count = binned.count[axis];
+
+            // Sweep from the right to get the cost of every right-hand side.
+            float right_cost[Bins];
+            AABB acc = AABB::empty;
+            size_t count = 0;
+            for (int b = Bins - 1; b > 0; b--) {
+                acc = AABB(acc, bin_box[b]);
+                count += bin_count[b];
+                right_cost[b - 1] = count ? count * acc.half_area() : 0.0f;
+            }
+
+            acc = AABB::empty;
+            count = 0;
+            for (int b = 0; b < Bins - 1; b++) {
+                acc = AABB(acc, bin_box[b]);
+                count += bin_count[b];
+                if (count == 0 || count == end - start) continue;
+                float cost = count * acc.half_area() + right_cost[b];
+                if (cost < best.cost) {
+                    best.axis = axis;
+                    best.bin = b;
+                    best.cost = cost;
+                }
+            }
+        }
+        return best;
+    }
+};
+
+// Binned SAH split of [start, end); falls back to the median split when every
+// centroid lands in the same bin.
+inline bvh_partition partition_sah(std::vector<bvh_primitive>& prims, size_t start, size_t end, const AABB& bbox) {
+    using binner = sah_binner<>;
+    AABB cbounds = centroid_bounds_of(prims, start, end);
+    sah_split split = binner::find(prims, start, end, cbounds);
+    if (split.axis < 0)
+        return partition_median(prims, start, end, bbox);
+
+    auto mid = std::partition(prims.begin() + start, prims.begin() + end,
+        [&](const bvh_primitive& p) {
+            return binner::bin_of(p.centroid, cbounds, split.axis) <= split.bin;
+        });
+    return {static_cast<size_t>(mid - prims.begin()), split.axis};
+}
+
+inline bvh_partition partition_primitives(bvh_split method, std::vector<bvh_primitive>& prims,
+                                          size_t start, size_t end, const AABB& bbox, int depth = 0)
+{
+    // Builders without spatial splits treat bvh_split::spatial as plain SAH.
+    return method == bvh_split::median || depth >= bvh_median_depth
+        ? partition_median(prims, start, end, bbox)
+        : partition_sah(prims, start, end, bbox);
+}
+
+} // namespace rt
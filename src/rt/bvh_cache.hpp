@@ -0,0 +1,344 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <filesystem>
+#include <type_traits>
+
+#include "def.hpp"
+#include "linear_bvh.hpp"
+#include "mesh.hpp"
+#include "mapped_file.hpp"
+#include "rtm/affine.hpp"
+
+namespace rt {
+
+// 64-bit FNV-1a, used to key cache files by everything that went into them.
+struct fnv1a_hash {
+    uint64_t value = 0xcbf29ce484222325ull;
+
+    fnv1a_hash& add(const void* data, size_t size) {
+        auto bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            value ^= bytes[i];
+            value *= 0x100000001b3ull;
+        }
+        return *this;
+    }
+
+    template <typename T>
+    fnv1a_hash& add(const T& v) {
+        static_assert(std::is_trivially_copyable_v<T>, "hash the bytes of plain values only");
+        return add(&v, sizeof(T));
+    }
+};
+
+// A triangle as stored in the cache, in world space.
+struct cached_triangle {
+    float v[3][3];
+
+    point3f vertex(int i) const { return point3f(v[i][0], v[i][1], v[i][2]); }
+};
+
+// Cache file layout: this header, node_count bvh_flat_nodes, then one
+// cached_triangle per leaf slot, in leaf order. The header is 64 bytes so the
+// nodes start cache-line aligned in the mapping.
+struct bvh_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_count;
+    uint64_t key;
+    uint32_t triangle_count;
+    uint32_t node_size;
+    uint32_t triangle_size;
+    uint32_t pad[7];
+
+    static constexpr char expected_magic[8] = {'R', 'T', 'B', 'V', 'H', 'C', 0, 0};
+    static constexpr uint32_t current_version = 1;
+
+    size_t file_size() const {
+        return sizeof(bvh_cache_header) + size_t(node_count) * node_size + size_t(triangle_count) * triangle_size;
+    }
+};
+static_assert(sizeof(bvh_cache_header) == 64, "bvh_cache_header should be one cache line");
+
+// A triangle mesh with a prebuilt flat BVH, served straight from a mapped
+// cache file, or from memory when the cache could not be written.
+class cached_mesh : public hittable {
+public:
+    cached_mesh(mapped_file file, shared_ptr<material> mat) : file(std::move(file)), mat(std::move(mat)) {
+        auto header = reinterpret_cast<const bvh_cache_header*>(this->file.data());
+        auto base = this->file.data() + sizeof(bvh_cache_header);
+        set_arrays(reinterpret_cast<const bvh_flat_node*>(base), header->node_count,
+                   reinterpret_cast<const cached_triangle*>(base + size_t(header->node_count) * sizeof(bvh_flat_node)),
+                   header->triangle_count);
+    }
+
+    cached_mesh(std::vector<bvh_flat_node> nodes, std::vector<cached_triangle> triangles, shared_ptr<material> mat)
+        : owned_nodes(std::move(nodes)), owned_triangles(std::move(triangles)), mat(std::move(mat))
+    {
+        set_arrays(owned_nodes.data(), static_cast<uint32_t>(owned_nodes.size()),
+                   owned_triangles.data(), static_cast<uint32_t>(owned_triangles.size()));
+    }
+
+    // nodes and triangles point into this object
+    cached_mesh(const cached_mesh&) = delete;
+    cached_mesh& operator=(const cached_mesh&) = delete;
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (num_nodes == 0) return false;
+
+        triangle_ray tr(r);
+        const cached_triangle* closest = nullptr;
+        float closest_t = 0.0f;
+        bool hit_anything = traverse_flat_bvh(nodes, r, ray_t,
+            [&](uint32_t first, uint32_t count, interval& t) {
+                bool hit_leaf = false;
+                for (uint32_t i = first; i < first + count; i++) {
+                    float tri_t;
+                    if (intersect(triangles[i], tr, t, tri_t)) {
+                        hit_leaf = true;
+                        t.max = tri_t;
+                        closest = &triangles[i];
+                        closest_t = tri_t;
+                    }
+                }
+                return hit_leaf;
+            });
+        if (!hit_anything) return false;
+
+        set_hit_record(*closest, closest_t, r, rec);
+        return true;
+    }
+
+    uint32_t hit_packet(const ray* rays, int count, interval* ray_t, hit_record* recs) const override {
+        if (num_nodes == 0) return 0;
+
+        return dispatch([&](auto isa) {
+            triangle_ray tr[max_packet_size];
+            const cached_triangle* closest[max_packet_size];
+            for (int i = 0; i < count; i++) tr[i] = triangle_ray(rays[i]);
+
+            uint32_t hits = traverse_flat_bvh_packet<isa>(nodes, rays, count, ray_t,
+                [&](uint32_t first, uint32_t n, uint32_t lanes) {
+                    uint32_t hit_lanes = 0;
+                    for (; lanes; lanes &= lanes - 1) {
+                        int lane = count_trailing_zeros(lanes);
+                        for (uint32_t i = first; i < first + n; i++) {
+                            float tri_t;
+                            if (intersect(triangles[i], tr[lane], ray_t[lane], tri_t)) {
+                                ray_t[lane].max = tri_t;
+                                closest[lane] = &triangles[i];
+                                hit_lanes |= 1u << lane;
+                            }
+                        }
+                    }
+                    return hit_lanes;
+                });
+
+            for (uint32_t lanes = hits; lanes; lanes &= lanes - 1) {
+                int lane = count_trailing_zeros(lanes);
+                set_hit_record(*closest[lane], ray_t[lane].max, rays[lane], recs[lane]);
+            }
+            return hits;
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (num_nodes == 0) return false;
+
+        triangle_ray tr(r);
+        return occluded_flat_bvh(nodes, r, ray_t, [&](uint32_t first, uint32_t count) {
+            float t;
+            for (uint32_t i = first; i < first + count; i++)
+                if (intersect(triangles[i], tr, ray_t, t))
+                    return true;
+            return false;
+        });
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+    bool is_mapped() const { return file.is_open(); }
+    size_t node_count() const { return num_nodes; }
+    size_t triangle_count() const { return num_triangles; }
+
+private:
+    mapped_file file;
+    std::vector<bvh_flat_node> owned_nodes;
+    std::vector<cached_triangle> owned_triangles;
+    shared_ptr<material> mat;
+
+    const bvh_flat_node* nodes = nullptr;
+    const cached_triangle* triangles = nullptr;
+    uint32_t num_nodes = 0;
+    uint32_t num_triangles = 0;
+    AABB bbox = AABB::empty;
+
+    void set_arrays(const bvh_flat_node* n, uint32_t n_count, const cached_triangle* t, uint32_t t_count) {
+        nodes = n;
+        num_nodes = n_count;
+        triangles = t;
+        num_triangles = t_count;
+        if (num_nodes > 0) bbox = nodes[0].bounds();
+    }
+
+    static bool intersect(const cached_triangle& tri, const triangle_ray& r, interval ray_t, float& t) {
+        return intersect_triangle(r, ray_t, tri.vertex(0), tri.vertex(1), tri.vertex(2), t);
+    }
+
+    // Shading data only for the closest triangle
+    void set_hit_record(const cached_triangle& tri, float t, const ray& r, hit_record& rec) const {
+        point3f v0 = tri.vertex(0);
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.set_face_normal(r, unit_vector(cross(tri.vertex(1) - v0, tri.vertex(2) - v0)));
+        rec.mat = mat;
+    }
+};
+
+// Maps a cache file and checks that it is complete and was written for key.
+inline bool open_bvh_cache(const std::string& path, uint64_t key, mapped_file& out) {
+    mapped_file file(path);
+    if (!file.is_open() || file.size() < sizeof(bvh_cache_header)) return false;
+
+    auto header = reinterpret_cast<const bvh_cache_header*>(file.data());
+    if (std::memcmp(header->magic, bvh_cache_header::expected_magic, sizeof(header->magic)) != 0
+        || header->version != bvh_cache_header::current_version
+        || header->key != key
+        || header->node_size != sizeof(bvh_flat_node)
+        || header->triangle_size != sizeof(cached_triangle)
+        || header->file_size() != file.size())
+        return false;
+
+    out = std::move(file);
+    return true;
+}
+
+// Writes through a temporary file and renames it into place, so a reader
+// never maps a half-written cache. Returns false if anything fails.
+inline bool write_bvh_cache(const std::string& path, uint64_t key,
+                            const std::vector<bvh_flat_node>& nodes, const std::vector<cached_triangle>& triangles)
+{
+    bvh_cache_header header = {};
+    std::memcpy(header.magic, bvh_cache_header::expected_magic, sizeof(header.magic));
+    header.version = bvh_cache_header::current_version;
+    header.node_count = static_cast<uint32_t>(nodes.size());
+    header.key = key;
+    header.triangle_count = static_cast<uint32_t>(triangles.size());
+    header.node_size = sizeof(bvh_flat_node);
+    header.triangle_size = sizeof(cached_triangle);
+
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(bvh_flat_node));
+        out.write(reinterpret_cast<const char*>(triangles.data()), triangles.size() * sizeof(cached_triangle));
+        if (!out) return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) std::filesystem::remove(tmp, ec);
+    return !ec;
+}
+
+// Hashes the contents of a file in fixed-size chunks, so hashing never holds
+// more than one chunk of a large file in memory.
+inline void hash_file(fnv1a_hash& h, const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) throw std::runtime_error("cannot open " + filename);
+    std::vector<char> chunk(1 << 20);
+    while (in) {
+        in.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        h.add(chunk.data(), static_cast<size_t>(in.gcount()));
+    }
+}
+
+// Cache key for an OBJ file loaded with to_world applied and a BVH built with
+// options. Only the options that change the tree are hashed.
+inline uint64_t bvh_cache_key(const std::string& filename, const affine3f& to_world, const bvh_build_options& options) {
+    fnv1a_hash h;
+    h.add(bvh_cache_header::current_version);
+    hash_file(h, filename);
+    h.add(to_world.m);
+    h.add(options.split);
+    h.add(options.max_leaf_size);
+    if (options.split == bvh_split::spatial) {
+        h.add(options.spatial_budget);
+        h.add(options.spatial_overlap);
+    }
+    return h.value;
+}
+
+// cache_dir/<OBJ file stem>-<key in hex><extension>
+inline std::string bvh_cache_path(const std::string& cache_dir, const std::string& filename, uint64_t key,
+                                  const char* extension)
+{
+    std::ostringstream name;
+    name << std::filesystem::path(filename).stem().string() << "-"
+         << std::hex << std::setw(16) << std::setfill('0') << key << extension;
+    return (std::filesystem::path(cache_dir) / name.str()).string();
+}
+
+// load_obj() with to_world applied and a flat BVH built over the triangles;
+// triangles receives them in leaf order.
+inline flat_bvh build_obj_bvh(const std::string& filename, const affine3f& to_world, const bvh_build_options& options,
+                              std::vector<cached_triangle>& triangles)
+{
+    auto mesh = load_obj(filename, nullptr);
+    for (auto& obj : mesh->objects) {
+        auto tri = std::static_pointer_cast<mesh_triangle>(obj);
+        tri->v0 = to_world.transform_point(tri->v0);
+        tri->v1 = to_world.transform_point(tri->v1);
+        tri->v2 = to_world.transform_point(tri->v2);
+    }
+    flat_bvh bvh = build_flat_bvh(mesh->objects, options);
+
+    triangles.resize(bvh.indices.size());
+    for (size_t i = 0; i < bvh.indices.size(); i++) {
+        const auto& tri = static_cast<const mesh_triangle&>(*mesh->objects[bvh.indices[i]]);
+        const point3f* v[3] = {&tri.v0, &tri.v1, &tri.v2};
+        for (int k = 0; k < 3; k++)
+            for (int a = 0; a < 3; a++)
+                triangles[i].v[k][a] = (*v[k])[a];
+    }
+    return bvh;
+}
+
+// load_obj() + a flat BVH build, cached on disk under cache_dir. The cache
+// file is named after the OBJ file and keyed by a hash of its contents, the
+// transform and the build options; a matching file is mapped instead of
+// parsing and building again. Failing to write the cache is not an error,
+// the mesh is then kept in memory.
+inline shared_ptr<cached_mesh> load_obj_cached(
+    const std::string& filename,
+    shared_ptr<material> mat,
+    const affine3f& to_world = affine3f(),
+    const bvh_build_options& options = {},
+    const std::string& cache_dir = "cache")
+{
+    uint64_t key = bvh_cache_key(filename, to_world, options);
+    std::string path = bvh_cache_path(cache_dir, filename, key, ".bvh");
+
+    mapped_file file;
+    if (open_bvh_cache(path, key, file))
+        return make_shared<cached_mesh>(std::move(file), std::move(mat));
+
+    std::vector<cached_triangle> triangles;
+    flat_bvh bvh = build_obj_bvh(filename, to_world, options, triangles);
+
+    std::error_code ec;
+    std::filesystem::create_directories(cache_dir, ec);
+    write_bvh_cache(path, key, bvh.nodes, triangles);
+    return make_shared<cached_mesh>(std::move(bvh.nodes), std::move(triangles), std::move(mat));
+}
+
+} // namespace rt
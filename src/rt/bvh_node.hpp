@@ -1,6 +1,7 @@
 #pragma once
 
 #include "AABB.hpp"
+#include "bvh_build.hpp"
 #include "hittable.hpp"
 #include "hittable_list.hpp"
 
@@ -11,35 +12,16 @@ namespace rt {
 class bvh_node : public hittable
 {
 public:
-    bvh_node(hittable_list list) : 
-        bvh_node(list.objects, 0, list.objects.size()) {}
+    bvh_node(hittable_list list, bvh_split split = bvh_split::sah) : 
+        bvh_node(list.objects, 0, list.objects.size(), split) {}
 
-    bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
-        // Build the bounding box of the span of source objects.
-        bbox = AABB::empty;
-        for (size_t object_index=start; object_index < end; object_index++)
-            bbox = AABB(bbox, objects[object_index]->bounding_box());
-
-        int axis = bbox.longest_axis();
-
-        auto comparator = (axis == 0) ? box_x_compare
-                        : (axis == 1) ? box_y_compare
-                                      : box_z_compare;
-
-        size_t object_span = end - start;
-
-        if (object_span == 1) {
-            left = right = objects[start];
-        } else if (object_span == 2) {
-            left = objects[start];
-            right = objects[start+1];
-        } else {
-            std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
-
-            auto mid = start + object_span/2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
-        }
+    bvh_node(const std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+             bvh_split split = bvh_split::sah)
+    {
+        // Bounds and centroids are gathered once up front, so the split never
+        // goes back through the virtual bounding_box().
+        auto prims = make_bvh_primitives(objects, start, end);
+        build(objects, prims, 0, prims.size(), split);
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
@@ -52,6 +34,13 @@ public:
         return hit_left || hit_right;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (!bbox.hit(r, ray_t))
+            return false;
+
+        return left->occluded(r, ray_t) || (right != left && right->occluded(r, ray_t));
+    }
+
     AABB bounding_box() const override { return bbox; }
 
 private:
@@ -59,28 +48,30 @@ private:
     shared_ptr<hittable> right;
     AABB bbox;
 
-    static bool box_compare(const shared_ptr<hittable> a, 
-                            const shared_ptr<hittable> b, 
-                            int axis_index) 
+    bvh_node(const std::vector<shared_ptr<hittable>>& objects, std::vector<bvh_primitive>& prims,
+             size_t start, size_t end, bvh_split split)
     {
-        auto a_axis_interval = a->bounding_box().axis_interval(axis_index);
-        auto b_axis_interval = b->bounding_box().axis_interval(axis_index);
-        return a_axis_interval.min < b_axis_interval.min;
+        build(objects, prims, start, end, split);
     }
 
-    static bool box_x_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) 
+    void build(const std::vector<shared_ptr<hittable>>& objects, std::vector<bvh_primitive>& prims,
+               size_t start, size_t end, bvh_split split)
     {
-        return box_compare(a, b, 0);
-    }
+        // Build the bounding box of the span of source objects.
+        bbox = bounds_of(prims, start, end);
 
-    static bool box_y_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) 
-    {
-        return box_compare(a, b, 1);
-    }
+        size_t object_span = end - start;
 
-    static bool box_z_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) 
-    {
-        return box_compare(a, b, 2);
+        if (object_span == 1) {
+            left = right = objects[prims[start].index];
+        } else if (object_span == 2) {
+            left = objects[prims[start].index];
+            right = objects[prims[start+1].index];
+        } else {
+            auto mid = partition_primitives(split, prims, start, end, bbox).mid;
+            left = shared_ptr<bvh_node>(new bvh_node(objects, prims, start, mid, split));
+            right = shared_ptr<bvh_node>(new bvh_node(objects, prims, mid, end, split));
+        }
     }
 };
 
@@ -9,6 +9,10 @@
 #include <sstream>      // string stream
 #include <iomanip>
 #include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <typeindex>
+#include <unordered_map>
 
 // multithreading
 #include <omp.h>
@@ -21,6 +25,7 @@
 #include "color.hpp"
 #include "material.hpp"
 #include "save_file.hpp"
+#include "ray_sort.hpp"
 
 namespace rt {
 class Camera {
@@ -40,6 +45,10 @@ public:
     float focus_dist     = 10.0f;       // Distance from camera lookfrom point to plane of perfect focus
     std::string output_filename = "output.png";
 
+    // render_wavefront(): sort the queued bounce rays by direction octant and
+    // origin Morton code in runs of this many rays; 0 keeps material order
+    size_t ray_sort_batch = 0;
+
     void render_serial(const hittable& world)
     {   
         initialize();
@@ -104,16 +113,7 @@ public:
         const int TILE_SIZE = 32;
         
         // Create tiles
-        std::vector<Tile> tiles;
-        for (int y = 0; y < image_height; y += TILE_SIZE) {
-            for (int x = 0; x < image_width; x += TILE_SIZE) {
-                tiles.emplace_back(
-                    x, y,
-                    std::min(x + TILE_SIZE, image_width),
-                    std::min(y + TILE_SIZE, image_height)
-                );
-            }
-        }
+        std::vector<Tile> tiles = make_tiles(TILE_SIZE);
 
         // Progress tracking
         std::atomic<int> tiles_completed(0);
@@ -158,7 +158,226 @@ public:
         std::clog << "Image saved to " << std::filesystem::current_path() / output_filename << std::endl;
     }
 
+    // Like render_tiles(), but primary rays are traced as packets of 4, 8 or
+    // 16 through world.hit_packet(): each sample covers a 2x2, 4x2 or 4x4
+    // pixel block, so the rays of a packet are coherent. Bounces are traced
+    // one by one as before.
+    void render_packets(const hittable& world, int packet_size = 8)
+    {
+        initialize();
+        const int TILE_SIZE = 32;
+        const int block_w = packet_size <= 4 ? 2 : 4;
+        const int block_h = packet_size <= 4 ? 2 : packet_size <= 8 ? 2 : 4;
+        std::vector<Tile> tiles = make_tiles(TILE_SIZE);
+
+        // Progress tracking
+        std::atomic<int> tiles_completed(0);
+        const int total_tiles = tiles.size();
+
+        const long long tile_count = static_cast<long long>(tiles.size());
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (long long tile_idx = 0; tile_idx < tile_count; ++tile_idx) {
+            const Tile& tile = tiles[tile_idx];
+            for (int by = tile.y0; by < tile.y1; by += block_h) {
+                for (int bx = tile.x0; bx < tile.x1; bx += block_w) {
+                    // Pixels of the block inside the tile
+                    int px[max_packet_size], py[max_packet_size];
+                    int count = 0;
+                    for (int j = by; j < std::min(by + block_h, tile.y1); ++j)
+                        for (int i = bx; i < std::min(bx + block_w, tile.x1); ++i) {
+                            px[count] = i;
+                            py[count++] = j;
+                        }
+
+                    color pixel_color[max_packet_size];
+                    for (int sample = 0; sample < samples_per_pixel; ++sample) {
+                        ray rays[max_packet_size];
+                        interval ray_t[max_packet_size];
+                        hit_record recs[max_packet_size];
+                        for (int k = 0; k < count; ++k) {
+                            rays[k] = get_ray(px[k], py[k]);
+                            ray_t[k] = interval(0.001f, INF);
+                        }
+                        uint32_t hits = world.hit_packet(rays, count, ray_t, recs);
+                        for (int k = 0; k < count; ++k)
+                            pixel_color[k] += (hits >> k) & 1 ? shade(rays[k], recs[k], max_depth, world) : background;
+                    }
+                    for (int k = 0; k < count; ++k)
+                        framebuffer[py[k] * image_width + px[k]] = pixel_samples_scale * pixel_color[k];
+                }
+            }
+            int completed = ++tiles_completed;
+            #pragma omp critical
+            {
+                float progress = (completed * 100.0f) / total_tiles;
+                std::clog << "\rProgress: " << std::fixed << std::setprecision(1)
+                          << progress << "% [" << completed << "/" << total_tiles
+                          << " tiles]" << std::flush;
+            }
+        }
+        std::clog << "\rDone. \n";
+        save_framebuffer(framebuffer, image_width, image_height, output_filename);
+        std::clog << "Image saved to " << std::filesystem::current_path() / output_filename << std::endl;
+    }
+
+    // Wavefront (stream) path tracing: instead of following one path at a
+    // time down ray_color(), a batch of paths advances one bounce per pass.
+    // Each pass intersects every active ray, groups the hits by material
+    // (by type, then by instance) with a counting sort, shades each group in
+    // one run and queues the scattered rays for the next pass, still grouped,
+    // or sorted for coherence when ray_sort_batch is set. Same estimate as
+    // the other render modes. paths_per_batch bounds the path state and hit
+    // records, which are best kept in cache: by default 4096 paths per thread.
+    void render_wavefront(const hittable& world, size_t paths_per_batch = 0)
+    {
+        using clock = std::chrono::steady_clock;
+        initialize();
+        if (paths_per_batch == 0) paths_per_batch = size_t(4096) * omp_get_max_threads();
+        const size_t pixels = static_cast<size_t>(image_width) * image_height;
+        const size_t total_paths = pixels * samples_per_pixel;
+        std::vector<color> accumulated(pixels, color(0, 0, 0));
+
+        std::vector<wavefront_path> paths;
+        std::vector<hit_record> recs;
+        std::vector<uint32_t> active, next, order;
+        std::vector<uint8_t> hit, alive;
+        std::vector<uint32_t> group;
+        std::vector<const material*> materials;     // distinct materials hit in a pass
+        std::unordered_map<const material*, uint32_t> group_of;
+        std::vector<uint32_t> rank, offsets;
+        size_t rays_traced = 0;
+        double intersect_seconds = 0.0, sort_seconds = 0.0, shade_seconds = 0.0, ray_sort_seconds = 0.0;
+        const AABB world_bounds = world.bounding_box();
+
+        for (size_t batch = 0; batch < total_paths; batch += paths_per_batch) {
+            const size_t n = std::min(paths_per_batch, total_paths - batch);
+            paths.resize(n);
+            recs.resize(n);
+            active.resize(n);
+
+            #pragma omp parallel for schedule(static)
+            for (long long k = 0; k < static_cast<long long>(n); k++) {
+                uint32_t pixel = static_cast<uint32_t>((batch + k) / samples_per_pixel);
+                paths[k].r = get_ray(pixel % image_width, pixel / image_width);
+                paths[k].throughput = color(1, 1, 1);
+                paths[k].radiance = color(0, 0, 0);
+                paths[k].pixel = pixel;
+                active[k] = static_cast<uint32_t>(k);
+            }
+
+            for (int depth = 0; depth < max_depth && !active.empty(); depth++) {
+                const long long count = static_cast<long long>(active.size());
+                rays_traced += active.size();
+
+                // Intersect every active ray; misses pick up the background
+                auto start = clock::now();
+                hit.resize(active.size());
+                #pragma omp parallel for schedule(dynamic, 1024)
+                for (long long i = 0; i < count; i++) {
+                    wavefront_path& path = paths[active[i]];
+                    hit[i] = world.hit(path.r, interval(0.001f, INF), recs[active[i]]);
+                    if (!hit[i]) path.radiance += path.throughput * background;
+                }
+                auto intersected = clock::now();
+
+                // Counting sort of the hits by material; consecutive hits
+                // mostly share one, so the map is seldom consulted.
+                materials.clear();
+                group_of.clear();
+                group.resize(active.size());
+                const material* last = nullptr;
+                uint32_t last_group = 0;
+                for (long long i = 0; i < count; i++) {
+                    if (!hit[i]) continue;
+                    const material* m = recs[active[i]].mat.get();
+                    if (m != last) {
+                        auto [it, added] = group_of.try_emplace(m, static_cast<uint32_t>(materials.size()));
+                        if (added) materials.push_back(m);
+                        last_group = it->second;
+                        last = m;
+                    }
+                    group[i] = last_group;
+                }
+                std::vector<uint32_t> by_type(materials.size());
+                for (uint32_t g = 0; g < by_type.size(); g++) by_type[g] = g;
+                std::sort(by_type.begin(), by_type.end(), [&](uint32_t a, uint32_t b) {
+                    std::type_index ta(typeid(*materials[a])), tb(typeid(*materials[b]));
+                    return ta != tb ? ta < tb : materials[a] < materials[b];
+                });
+                rank.assign(materials.size(), 0);
+                for (uint32_t k = 0; k < by_type.size(); k++) rank[by_type[k]] = k;
+
+                offsets.assign(materials.size() + 1, 0);
+                for (long long i = 0; i < count; i++)
+                    if (hit[i]) offsets[rank[group[i]] + 1]++;
+                for (size_t g = 1; g < offsets.size(); g++) offsets[g] += offsets[g - 1];
+                order.resize(offsets.back());
+                for (long long i = 0; i < count; i++)
+                    if (hit[i]) order[offsets[rank[group[i]]]++] = active[i];
+                auto sorted = clock::now();
+
+                // Shade one material group after the other
+                alive.resize(order.size());
+                #pragma omp parallel for schedule(static)
+                for (long long k = 0; k < static_cast<long long>(order.size()); k++) {
+                    wavefront_path& path = paths[order[k]];
+                    const hit_record& rec = recs[order[k]];
+                    color attenuation;
+                    ray scattered;
+                    path.radiance += path.throughput * rec.mat->emitted(rec.u, rec.v, rec.p);
+                    alive[k] = rec.mat->scatter(path.r, rec, attenuation, scattered);
+                    if (alive[k]) {
+                        path.throughput = path.throughput * attenuation;
+                        path.r = scattered;
+                    }
+                }
+
+                // Queue the next bounce in material order
+                next.clear();
+                for (size_t k = 0; k < order.size(); k++)
+                    if (alive[k]) next.push_back(order[k]);
+                active.swap(next);
+                auto shaded = clock::now();
+
+                if (ray_sort_batch > 0)
+                    sort_rays([&](uint32_t p) -> const ray& { return paths[p].r; },
+                              active.data(), active.size(), world_bounds, ray_sort_batch);
+                auto ray_sorted = clock::now();
+
+                intersect_seconds += std::chrono::duration<double>(intersected - start).count();
+                sort_seconds += std::chrono::duration<double>(sorted - intersected).count();
+                shade_seconds += std::chrono::duration<double>(shaded - sorted).count();
+                ray_sort_seconds += std::chrono::duration<double>(ray_sorted - shaded).count();
+            }
+
+            for (const auto& path : paths)
+                accumulated[path.pixel] += path.radiance;
+            std::clog << "\rProgress: " << std::fixed << std::setprecision(1)
+                      << (batch + n) * 100.0f / total_paths << "%" << std::flush;
+        }
+
+        framebuffer.assign(pixels, color(0, 0, 0));
+        for (size_t i = 0; i < pixels; i++)
+            framebuffer[i] = pixel_samples_scale * accumulated[i];
+
+        std::clog << "\rDone. " << rays_traced << " rays; intersect " << std::setprecision(3)
+                  << intersect_seconds << " s, sort " << sort_seconds << " s, shade "
+                  << shade_seconds << " s";
+        if (ray_sort_batch > 0) std::clog << ", ray sort " << ray_sort_seconds << " s";
+        std::clog << "\n";
+        save_framebuffer(framebuffer, image_width, image_height, output_filename);
+        std::clog << "Image saved to " << std::filesystem::current_path() / output_filename << std::endl;
+    }
+
 private:
+    // One path of render_wavefront()
+    struct wavefront_path {
+        ray r;
+        color throughput;   // product of the attenuations so far
+        color radiance;     // light gathered so far
+        uint32_t pixel;
+    };
+
     float pixel_samples_scale;  // Color scale factor
     int image_height;           // Rendered image height
     point3f camera_center;      // Camera center
@@ -175,6 +394,7 @@ private:
         image_height = static_cast<int>(image_width / aspect_ratio);
         image_height = (image_height < 1) ? 1 : image_height;
 
+        log_isa();
         framebuffer.reserve(image_width * image_height);
 
         pixel_samples_scale = 1.0f / samples_per_pixel;
@@ -244,6 +464,12 @@ private:
 
         if(!world.hit(r, interval(0.001f, INF), rec)) return background;
 
+        return shade(r, rec, depth, world);
+    }
+
+    // Light leaving the hit point of r back along r
+    color shade(const ray& r, const hit_record& rec, int depth, const hittable& world) const
+    {
         ray scattered;
         color attenuation;
         color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
@@ -254,6 +480,21 @@ private:
         color color_from_scatter = attenuation * ray_color(scattered, depth - 1, world);
         return color_from_emission + color_from_scatter;
     }
+
+    std::vector<Tile> make_tiles(int tile_size) const
+    {
+        std::vector<Tile> tiles;
+        for (int y = 0; y < image_height; y += tile_size) {
+            for (int x = 0; x < image_width; x += tile_size) {
+                tiles.emplace_back(
+                    x, y,
+                    std::min(x + tile_size, image_width),
+                    std::min(y + tile_size, image_height)
+                );
+            }
+        }
+        return tiles;
+    }
 };
 
 }
\ No newline at end of file
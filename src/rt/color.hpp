@@ -3,6 +3,8 @@
 #include "rtm/vector.hpp"
 #include "rtm/interval.hpp"
 #include "rtm/random.hpp"
+#include "rtm/vec3_soa.hpp"
+#include "cpu_dispatch.hpp"
 
 namespace rt {
 
@@ -30,6 +32,33 @@ void write_color(std::ostream& out, const color& pixel_color)
     out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
 }
 
+// Gamma 2 and 8-bit quantization of count pixels into out (3 bytes each),
+// the same mapping as write_color(). Four pixels are twelve lanes; the kernel
+// runs on the best SIMD path of the CPU. (std::sqrt in a plain loop does not
+// vectorize: the errno check on negative inputs stays in the loop.)
+inline void tonemap_to_bytes(const color* pixels, size_t count, unsigned char* out)
+{
+    using lanes = float_lanes<4>;
+    dispatch([&] {
+        for (size_t first = 0; first < count; first += 4) {
+            const size_t n = std::min<size_t>(4, count - first);
+            alignas(32) float f[12] = {};
+            for (size_t p = 0; p < n; ++p)
+                for (int c = 0; c < 3; ++c)
+                    f[p * 3 + c] = pixels[first + p][c];
+
+            for (int k = 0; k < 12; k += 4) {
+                lanes v = lanes::load(f + k);
+                // linear_to_gamma(): 0 for zero, negative and nan
+                v = select(v > lanes(0.0f), sqrt(v), lanes(0.0f));
+                (min(v, lanes(0.999f)) * lanes(256.0f)).store(f + k);
+            }
+            for (size_t i = 0; i < n * 3; ++i)
+                out[first * 3 + i] = static_cast<unsigned char>(static_cast<int>(f[i]));
+        }
+    });
+}
+
 
 }
 
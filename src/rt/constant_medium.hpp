@@ -3,6 +3,7 @@
 #include "hittable.hpp"
 #include "material.hpp"
 #include "texture.hpp"
+#include "rtm/fast_math.hpp"
 
 namespace rt {
 class constant_medium : public hittable {
@@ -37,7 +38,7 @@ public:
 
         auto ray_length = r.direction().length();
         auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-        auto hit_distance = neg_inv_density * std::log(random_float());
+        auto hit_distance = neg_inv_density * math::log(random_float());
 
         if (hit_distance > distance_inside_boundary)
             return false;
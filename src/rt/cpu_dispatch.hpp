@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+#include "def.hpp"
+
+// Runtime SIMD dispatch. A hot kernel is written once, as a lambda passed to
+// dispatch(); on GCC and Clang for x86 the lambda is inlined into one copy per
+// ISA level, each compiled with that level's target attribute, and every call
+// runs the copy for the best level this CPU supports. A binary built for
+// baseline x86-64 (RT_PORTABLE in CMake) thus still runs AVX2 or AVX-512
+// code where it can. Levels the build already targets are not duplicated:
+// with -march=native on an AVX2 machine only the AVX-512 copy is extra.
+//
+// A kernel written as a generic lambda, [&](auto isa) { ... }, is also told
+// which level its copy is compiled for, as an isa_constant. It hands the
+// level down to helpers that pick hand-written intrinsics with
+//
+//     if constexpr (isa >= isa_level::avx2) return intersect_children_avx2(...);
+//
+// Such intrinsics live in functions marked RT_TARGET_AVX2 (or higher) and
+// guarded by RT_KERNELS_AVX2, not by #ifdef __AVX__, so a baseline build
+// still compiles them. They are plain inline rather than FORCE_INLINE: only
+// the copies for their level and above may inline them, which the flatten
+// attribute of those copies then does. Code the compiler vectorizes itself
+// needs none of this: loops, FMA contraction and the generic vectors behind
+// float_lanes<8> in a build without AVX are compiled for each copy's level.
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define RT_CPU_DISPATCH 1
+    #define RT_TARGET_SSE41  __attribute__((target("sse4.1,popcnt")))
+    #define RT_TARGET_AVX2   __attribute__((target("avx2,fma,bmi,bmi2,popcnt,lzcnt")))
+    #define RT_TARGET_AVX512 __attribute__((target("avx512f,avx512vl,avx512bw,avx512dq,avx2,fma,bmi,bmi2,popcnt,lzcnt")))
+    #define RT_FLATTEN       __attribute__((flatten))
+#else
+    // No target attributes: kernels for a level exist only when the compiler
+    // flags already enable it.
+    #define RT_TARGET_SSE41
+    #define RT_TARGET_AVX2
+    #define RT_TARGET_AVX512
+    #define RT_FLATTEN
+#endif
+
+// Hand-written AVX2 kernels can be compiled, through target attributes or
+// because the build targets AVX2 anyway.
+#if defined(RT_CPU_DISPATCH) || (defined(__AVX2__) && defined(__FMA__))
+    #define RT_KERNELS_AVX2 1
+    #include <immintrin.h>
+#endif
+
+namespace rt {
+
+enum class isa_level : uint8_t { baseline, sse41, avx2, avx512 };
+
+inline const char* isa_name(isa_level level) {
+    switch (level) {
+        case isa_level::sse41:  return "sse4.1";
+        case isa_level::avx2:   return "avx2";
+        case isa_level::avx512: return "avx512";
+        default:                return "baseline";
+    }
+}
+
+// Highest level the compiler flags already guarantee.
+constexpr isa_level compiled_isa =
+#if defined(__AVX512F__) && defined(__AVX512VL__) && defined(__AVX512BW__) && defined(__AVX512DQ__)
+    isa_level::avx512;
+#elif defined(__AVX2__) && defined(__FMA__)
+    isa_level::avx2;
+#elif defined(__SSE4_1__)
+    isa_level::sse41;
+#else
+    isa_level::baseline;
+#endif
+
+// Highest level this CPU and OS support (CPUID plus the XSAVE state check
+// libgcc does for AVX and AVX-512).
+inline isa_level detect_isa() {
+#ifdef RT_CPU_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+        __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq"))
+        return isa_level::avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return isa_level::avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return isa_level::sse41;
+    return isa_level::baseline;
+#else
+    return compiled_isa;
+#endif
+}
+
+namespace detail {
+inline const isa_level detected_isa = detect_isa();
+inline std::atomic<isa_level> active_isa{detected_isa};
+}
+
+// Level dispatch() runs.
+inline isa_level active_isa() { return detail::active_isa.load(std::memory_order_relaxed); }
+
+// Caps dispatch() at level and returns the level that will actually run. That
+// is never above what the CPU supports, and never below compiled_isa: the
+// compiler flags already put that level into every copy of a kernel, so a
+// -march=native AVX2 build has no baseline copy to fall back to. For
+// benchmarks and for ruling out a code path.
+inline isa_level limit_isa(isa_level level) {
+    isa_level use = std::max(std::min(level, detail::detected_isa), compiled_isa);
+    detail::active_isa.store(use, std::memory_order_relaxed);
+    return use;
+}
+
+// Writes the active path to std::clog, once per process.
+inline void log_isa() {
+    static std::once_flag logged;
+    std::call_once(logged, [] {
+        std::clog << "SIMD path: " << isa_name(active_isa()) << " (cpu " << isa_name(detail::detected_isa)
+                  << ", build " << isa_name(compiled_isa) << ")" << std::endl;
+    });
+}
+
+// The level a kernel copy is compiled for, as a type.
+template <isa_level Level>
+using isa_constant = std::integral_constant<isa_level, Level>;
+
+// kernel(isa_constant<Level>{}) when the kernel takes the level, else kernel().
+// Each copy below spells the call out itself: a helper in between would be
+// inlined without the copy's flatten reaching the kernel's own callees.
+#define RT_RUN_KERNEL(kernel, level)                                                      \
+    if constexpr (std::is_invocable_v<decltype(kernel)&, isa_constant<level>>)            \
+        return kernel(isa_constant<level>{});                                             \
+    else                                                                                  \
+        return kernel()
+
+#ifdef RT_CPU_DISPATCH
+namespace detail {
+template <typename Kernel> RT_TARGET_AVX512 RT_FLATTEN inline auto run_avx512(Kernel& k) { RT_RUN_KERNEL(k, isa_level::avx512); }
+template <typename Kernel> RT_TARGET_AVX2   RT_FLATTEN inline auto run_avx2(Kernel& k)   { RT_RUN_KERNEL(k, isa_level::avx2); }
+template <typename Kernel> RT_TARGET_SSE41  RT_FLATTEN inline auto run_sse41(Kernel& k)  { RT_RUN_KERNEL(k, isa_level::sse41); }
+}
+
+// Runs kernel() compiled for the active ISA level.
+template <typename Kernel>
+FORCE_INLINE auto dispatch(Kernel&& kernel) {
+    isa_level level = active_isa();
+    if constexpr (compiled_isa < isa_level::avx512)
+        if (level == isa_level::avx512) return detail::run_avx512(kernel);
+    if constexpr (compiled_isa < isa_level::avx2)
+        if (level == isa_level::avx2) return detail::run_avx2(kernel);
+    if constexpr (compiled_isa < isa_level::sse41)
+        if (level == isa_level::sse41) return detail::run_sse41(kernel);
+    RT_RUN_KERNEL(kernel, compiled_isa);
+}
+#else
+template <typename Kernel>
+FORCE_INLINE auto dispatch(Kernel&& kernel) { RT_RUN_KERNEL(kernel, compiled_isa); }
+#endif
+
+#undef RT_RUN_KERNEL
+
+} // namespace rt
@@ -10,6 +10,9 @@ using std::weak_ptr;
 using std::sqrt;
 using std::floor;
 
+#include <cstddef>
+#include <new>
+
 // compiler detection macros
 #if defined(_MSC_VER)
     #define FORCE_INLINE __forceinline
@@ -17,4 +20,47 @@ using std::floor;
     #define FORCE_INLINE inline __attribute__((always_inline))
 #else
     #define FORCE_INLINE inline
-#endif
\ No newline at end of file
+#endif
+
+// index of the lowest set bit; x must be non-zero
+#if defined(_MSC_VER)
+    #include <intrin.h>
+    FORCE_INLINE int count_trailing_zeros(unsigned int x) {
+        unsigned long index;
+        _BitScanForward(&index, x);
+        return static_cast<int>(index);
+    }
+#else
+    FORCE_INLINE int count_trailing_zeros(unsigned int x) { return __builtin_ctz(x); }
+#endif
+
+// number of set bits
+#if defined(_MSC_VER)
+    FORCE_INLINE int popcount(unsigned int x) { return static_cast<int>(__popcnt(x)); }
+#else
+    FORCE_INLINE int popcount(unsigned int x) { return __builtin_popcount(x); }
+#endif
+
+// std::allocator with a stronger alignment, for node and SIMD packet arrays
+// whose layout assumes cache-line aligned storage.
+template <typename T, std::size_t Align>
+struct aligned_allocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = aligned_allocator<U, Align>; };
+
+    aligned_allocator() = default;
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Align>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+    void deallocate(T* p, std::size_t) { ::operator delete(p, std::align_val_t(Align)); }
+
+    template <typename U>
+    bool operator==(const aligned_allocator<U, Align>&) const { return true; }
+    template <typename U>
+    bool operator!=(const aligned_allocator<U, Align>&) const { return false; }
+};
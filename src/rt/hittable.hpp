@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 #include "rtm/ray.hpp"
 #include "rtm/random.hpp"
 #include "rtm/functions.hpp"
@@ -28,6 +30,9 @@ public:
     }
 };
 
+// Most rays hit_packet() takes at once, one bit each in its result
+constexpr int max_packet_size = 16;
+
 // an abstract class of hittable objects
 class hittable {
 protected:
@@ -38,7 +43,43 @@ public:
 
     virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
 
+    // Any-hit query for shadow and visibility rays: true as soon as anything
+    // blocks the ray within ray_t. Overrides stop at the first hit and skip
+    // the normal, uv and material of the hit record.
+    virtual bool occluded(const ray& r, interval ray_t) const {
+        hit_record rec;
+        return hit(r, ray_t, rec);
+    }
+
+    // Closest hits for up to max_packet_size rays at once. ray_t holds one
+    // interval per ray; a hit shrinks its max to the hit distance like the
+    // caller of hit() would. Returns a mask with bit i set when rays[i] hit.
+    // The default traces the rays one by one; BVHs override it to share
+    // traversal between coherent rays.
+    virtual uint32_t hit_packet(const ray* rays, int count, interval* ray_t, hit_record* recs) const {
+        uint32_t mask = 0;
+        for (int i = 0; i < count; i++) {
+            if (hit(rays[i], ray_t[i], recs[i])) {
+                ray_t[i].max = recs[i].t;
+                mask |= 1u << i;
+            }
+        }
+        return mask;
+    }
+
     virtual AABB bounding_box() const = 0;
+
+    // Bounds at one instant of the shutter interval [0, 1]. Objects that move
+    // linearly override it; everything else returns the box swept over the
+    // whole shutter, which is always safe.
+    virtual AABB bounding_box_at(float) const { return bounding_box(); }
+
+    // Bounds of the part of the object inside the slab lo <= p[axis] <= hi,
+    // used by spatial-split BVH builds. Shapes that can clip tighter than
+    // their bounding box override it.
+    virtual AABB clipped_bounding_box(int axis, float lo, float hi) const {
+        return clip_box(bounding_box(), axis, lo, hi);
+    }
 };
 
 class translate : public hittable {
@@ -63,6 +104,11 @@ public:
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        return object->occluded(ray(r.origin() - offset, r.direction(), r.time()), ray_t);
+    }
+
     AABB bounding_box() const override { return bbox; }
 
 private:
@@ -112,20 +158,7 @@ public:
         : rotate_y(object, static_cast<float>(angle_degrees)) {}
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        // Transform the ray from world space to object space.
-        auto origin = point3f(
-            (cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
-            r.origin().y(),
-            (sin_theta * r.origin().x()) + (cos_theta * r.origin().z())
-        );
-
-        auto direction = vec3f(
-            (cos_theta * r.direction().x()) - (sin_theta * r.direction().z()),
-            r.direction().y(),
-            (sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
-        );
-
-        ray rotated_r(origin, direction, r.time());
+        ray rotated_r = to_object(r);
 
         // Determine whether an intersection exists in object space (and if so, where).
         if (!object->hit(rotated_r, ray_t, rec))
@@ -147,12 +180,33 @@ public:
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(to_object(r), ray_t);
+    }
+
     AABB bounding_box() const override { return bbox; }
 private:
     shared_ptr<hittable> object;
     float sin_theta;
     float cos_theta;
     AABB bbox;
+
+    // Transform the ray from world space to object space.
+    ray to_object(const ray& r) const {
+        auto origin = point3f(
+            (cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
+            r.origin().y(),
+            (sin_theta * r.origin().x()) + (cos_theta * r.origin().z())
+        );
+
+        auto direction = vec3f(
+            (cos_theta * r.direction().x()) - (sin_theta * r.direction().z()),
+            r.direction().y(),
+            (sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
+        );
+
+        return ray(origin, direction, r.time());
+    }
 };
 
 
@@ -43,6 +43,25 @@ public:
         return hit_anything;
     }
 
+    // The packet goes to every object in turn, so objects with their own
+    // BVH still trace it as a packet
+    uint32_t hit_packet(const ray* rays, int count, interval* ray_t, hit_record* recs) const override
+    {
+        uint32_t mask = 0;
+        for (const auto& object : objects)
+            mask |= object->hit_packet(rays, count, ray_t, recs);
+        return mask;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        for (const auto& object : objects) {
+            if (object->occluded(r, ray_t))
+                return true;
+        }
+        return false;
+    }
+
     AABB bounding_box() const override { return bbox; }
 
 private:
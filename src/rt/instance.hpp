@@ -0,0 +1,196 @@
+#pragma once
+
+#include <vector>
+
+#include "hittable.hpp"
+#include "linear_bvh.hpp"
+#include "rtm/affine.hpp"
+
+namespace rt {
+
+// World-space box around an object-space box under an affine transform.
+inline AABB transform_box(const AABB& box, const affine3f& m) {
+    point3f min( INF,  INF,  INF);
+    point3f max(-INF, -INF, -INF);
+
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            for (int k = 0; k < 2; k++) {
+                point3f corner(i ? box.x.max : box.x.min,
+                               j ? box.y.max : box.y.min,
+                               k ? box.z.max : box.z.min);
+                point3f tester = m.transform_point(corner);
+
+                for (int c = 0; c < 3; c++) {
+                    min[c] = std::fmin(min[c], tester[c]);
+                    max[c] = std::fmax(max[c], tester[c]);
+                }
+            }
+        }
+    }
+    return AABB(min, max);
+}
+
+// A placement of a shared bottom-level structure (BLAS) in the world. Replaces
+// chains of translate/rotate_y wrappers with a single ray transform, and many
+// instances of one mesh share its geometry and BVH.
+class instance final : public hittable {
+public:
+    instance(shared_ptr<hittable> blas, const affine3f& to_world)
+        : blas(std::move(blas))
+    {
+        set_transform(to_world);
+    }
+
+    void set_transform(const affine3f& m) {
+        to_world = m;
+        to_object = m.inverse();
+        bbox = transform_box(blas->bounding_box(), to_world);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        // The direction is not renormalized, so t is the same in both spaces.
+        ray object_r(to_object.transform_point(r.origin()),
+                     to_object.transform_vector(r.direction()), r.time());
+
+        if (!blas->hit(object_r, ray_t, rec))
+            return false;
+
+        // front_face is invariant under the transform; only p and the normal move.
+        rec.p = to_world.transform_point(rec.p);
+        rec.normal = unit_vector(to_object.transform_normal(rec.normal));
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return blas->occluded(ray(to_object.transform_point(r.origin()),
+                                  to_object.transform_vector(r.direction()), r.time()), ray_t);
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+    const affine3f& transform() const { return to_world; }
+    const shared_ptr<hittable>& geometry() const { return blas; }
+
+private:
+    shared_ptr<hittable> blas;
+    affine3f to_world;
+    affine3f to_object;
+    AABB bbox;
+};
+
+// Top-level acceleration structure: a flat BVH over instances. Only instance
+// boxes go into it, so rebuilding after moving instances costs O(n log n) in
+// the instance count and never touches the bottom-level structures. Between
+// frames of an animation, refit()/update() reuse the tree instead.
+class tlas : public hittable {
+public:
+    tlas() {}
+
+    // Returns the id used by set_transform().
+    size_t add(shared_ptr<hittable> blas, const affine3f& to_world) {
+        instances.emplace_back(std::move(blas), to_world);
+        dirty = true;
+        return instances.size() - 1;
+    }
+
+    // Moves an instance; follow with refit(), update() or build().
+    void set_transform(size_t id, const affine3f& to_world) {
+        instances[id].set_transform(to_world);
+        dirty = true;
+    }
+
+    // Rebuilds the top level from the current instance boxes; call after
+    // add() and before rendering.
+    void build() {
+        std::vector<bvh_primitive> prims(instances.size());
+        for (size_t i = 0; i < instances.size(); i++) {
+            AABB box = instances[i].bounding_box();
+            prims[i] = {box, box.centroid(), i};
+        }
+
+        bvh_build_options options;
+        options.max_leaf_size = 1;
+        flat_bvh bvh = build_flat_bvh(prims, options);
+        nodes = std::move(bvh.nodes);
+        order = std::move(bvh.indices);
+        schedule = make_refit_schedule(nodes);
+        built_cost = sah_cost(nodes);
+        bbox = nodes.empty() ? AABB::empty : nodes[0].bounds();
+        dirty = false;
+    }
+
+    // Refits the top level to the current instance boxes. Only valid when no
+    // instances were added since the last build().
+    void refit() {
+        assert(order.size() == instances.size() && "instances were added; call build()");
+        refit_flat_bvh(nodes, schedule, [&](uint32_t first, uint32_t count) {
+            AABB box = AABB::empty;
+            for (uint32_t i = first; i < first + count; i++)
+                box = AABB(box, instances[order[i]].bounding_box());
+            return box;
+        });
+        bbox = nodes.empty() ? AABB::empty : nodes[0].bounds();
+        dirty = false;
+    }
+
+    // Refits, and falls back to build() once the SAH cost has grown beyond
+    // rebuild_ratio times its value after the last build. Returns true when
+    // it rebuilt.
+    bool update(float rebuild_ratio = 1.5f) {
+        if (order.size() != instances.size()) {
+            build();
+            return true;
+        }
+        refit();
+        if (sah_cost(nodes) <= rebuild_ratio * built_cost)
+            return false;
+        build();
+        return true;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        assert(!dirty && "tlas must be built or refit after changing instances");
+        if (nodes.empty()) return false;
+
+        return traverse_flat_bvh(nodes.data(), r, ray_t,
+            [&](uint32_t first, uint32_t count, interval& t) {
+                bool hit_leaf = false;
+                for (uint32_t i = first; i < first + count; i++) {
+                    if (instances[order[i]].hit(r, t, rec)) {
+                        hit_leaf = true;
+                        t.max = rec.t;
+                    }
+                }
+                return hit_leaf;
+            });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        assert(!dirty && "tlas must be built or refit after changing instances");
+        if (nodes.empty()) return false;
+
+        return occluded_flat_bvh(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count) {
+            for (uint32_t i = first; i < first + count; i++)
+                if (instances[order[i]].occluded(r, ray_t))
+                    return true;
+            return false;
+        });
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+    size_t size() const { return instances.size(); }
+    const instance& operator[](size_t id) const { return instances[id]; }
+
+private:
+    std::vector<instance> instances;
+    std::vector<bvh_flat_node> nodes;
+    std::vector<uint32_t> order;    // instance id for every leaf slot
+    bvh_refit_schedule schedule;
+    float built_cost = 0.0f;
+    AABB bbox = AABB::empty;
+    bool dirty = false;
+};
+
+} // namespace rt
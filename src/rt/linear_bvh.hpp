@@ -0,0 +1,646 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <unordered_set>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #define RT_RAY_PACKET_SSE 1
+    #include <emmintrin.h>
+#endif
+
+#include "def.hpp"
+#include "cpu_dispatch.hpp"
+#include "AABB.hpp"
+#include "bvh_build.hpp"
+#include "sbvh.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+
+namespace rt {
+
+// Builds the subtree over [start, end) into nodes[node_index...]. A subtree
+// over n primitives never needs more than 2n - 1 nodes, so the right child's
+// slot is known before the left child is built and both halves can be built
+// by independent OpenMP tasks. Unused slots are squeezed out afterwards.
+inline void build_flat_subtree(std::vector<bvh_flat_node>& nodes, std::vector<bvh_primitive>& prims,
+                               size_t start, size_t end, size_t node_index,
+                               const bvh_build_options& options, int depth = 0)
+{
+    AABB box = bounds_of(prims, start, end);
+    size_t count = end - start;
+    bvh_flat_node& node = nodes[node_index];
+    node.set_bounds(box);
+
+    if (count <= static_cast<size_t>(options.max_leaf_size)) {
+        node.offset = static_cast<uint32_t>(start);
+        node.count = static_cast<uint16_t>(count);
+        node.axis = 0;
+        return;
+    }
+
+    auto split = partition_primitives(options.split, prims, start, end, box, depth);
+    size_t left_index = node_index + 1;
+    size_t right_index = left_index + 2 * (split.mid - start) - 1;
+    node.offset = static_cast<uint32_t>(right_index);
+    node.count = 0;
+    node.axis = static_cast<uint16_t>(split.axis);
+
+#if RT_OMP_TASKS
+    if (options.parallel && count > options.parallel_threshold) {
+        #pragma omp task default(shared)
+        build_flat_subtree(nodes, prims, start, split.mid, left_index, options, depth + 1);
+        build_flat_subtree(nodes, prims, split.mid, end, right_index, options, depth + 1);
+        #pragma omp taskwait
+        return;
+    }
+#endif
+    build_flat_subtree(nodes, prims, start, split.mid, left_index, options, depth + 1);
+    build_flat_subtree(nodes, prims, split.mid, end, right_index, options, depth + 1);
+}
+
+// Copies the reachable nodes into dense depth-first order.
+inline std::vector<bvh_flat_node> compact_flat_nodes(const std::vector<bvh_flat_node>& sparse) {
+    std::vector<bvh_flat_node> dense;
+    dense.reserve(sparse.size());
+
+    // (sparse index, dense parent waiting for its second child)
+    std::vector<std::pair<size_t, size_t>> stack{{0, SIZE_MAX}};
+    while (!stack.empty()) {
+        auto [src, parent] = stack.back();
+        stack.pop_back();
+
+        size_t dst = dense.size();
+        dense.push_back(sparse[src]);
+        if (parent != SIZE_MAX)
+            dense[parent].offset = static_cast<uint32_t>(dst);
+
+        if (!sparse[src].is_leaf()) {
+            stack.push_back({sparse[src].offset, dst});
+            stack.push_back({src + 1, SIZE_MAX});
+        }
+    }
+    return dense;
+}
+
+// Builds the flat hierarchy; prims is reordered into leaf order.
+inline flat_bvh build_flat_bvh(std::vector<bvh_primitive>& prims, const bvh_build_options& options = {}) {
+    flat_bvh bvh;
+    if (prims.empty()) return bvh;
+
+    std::vector<bvh_flat_node> sparse(2 * prims.size() - 1);
+#if RT_OMP_TASKS
+    if (options.parallel && prims.size() > options.parallel_threshold) {
+        #pragma omp parallel
+        #pragma omp single
+        build_flat_subtree(sparse, prims, 0, prims.size(), 0, options);
+    } else
+#endif
+    {
+        build_flat_subtree(sparse, prims, 0, prims.size(), 0, options);
+    }
+    bvh.nodes = compact_flat_nodes(sparse);
+
+    bvh.indices.resize(prims.size());
+    for (size_t i = 0; i < prims.size(); i++)
+        bvh.indices[i] = static_cast<uint32_t>(prims[i].index);
+    return bvh;
+}
+
+// Builds the flat hierarchy over a list of objects with the configured split
+// method. With bvh_split::spatial an object may appear in several leaves.
+inline flat_bvh build_flat_bvh(const std::vector<shared_ptr<hittable>>& source, const bvh_build_options& options) {
+    auto prims = make_bvh_primitives(source, 0, source.size());
+    if (options.split != bvh_split::spatial)
+        return build_flat_bvh(prims, options);
+
+    return build_spatial_bvh(std::move(prims),
+        [&](size_t index, int axis, float lo, float hi) {
+            return source[index]->clipped_bounding_box(axis, lo, hi);
+        }, options);
+}
+
+// Ray data needed by the slab test, computed once per traversal.
+struct bvh_ray {
+    float org[3];
+    float inv_dir[3];
+    int neg[3];
+    float time;
+
+    explicit bvh_ray(const ray& r) : time(r.time()) {
+        for (int a = 0; a < 3; a++) {
+            org[a] = r.origin()[a];
+            inv_dir[a] = 1.0f / r.direction()[a];
+            neg[a] = inv_dir[a] < 0.0f;
+        }
+    }
+};
+
+// Slab test of one node against [tmin, tmax], for any node type with
+// bmin[3]/bmax[3] arrays (bvh_flat_node, bvh_treelet_node). Node types whose
+// box is computed per ray overload hit_node() instead.
+template <typename Node>
+FORCE_INLINE bool hit_node(const Node& node, const bvh_ray& r, float tmin, float tmax) {
+    for (int a = 0; a < 3; a++) {
+        float t0 = (node.bmin[a] - r.org[a]) * r.inv_dir[a];
+        float t1 = (node.bmax[a] - r.org[a]) * r.inv_dir[a];
+        tmin = std::max(tmin, std::min(t0, t1));
+        tmax = std::min(tmax, std::max(t0, t1) * bvh_slab_margin);
+    }
+    return tmin <= tmax;
+}
+
+// Children of an interior node. Depth-first layouts keep the first child
+// right behind its parent; other layouts overload these for their node type.
+template <typename Node>
+FORCE_INLINE uint32_t first_child(const Node&, uint32_t index) { return index + 1; }
+
+template <typename Node>
+FORCE_INLINE uint32_t second_child(const Node& node, uint32_t) { return node.offset; }
+
+// Traversal hook that does nothing; see the visit argument of traverse_flat_bvh.
+struct bvh_no_visit {
+    template <typename Node>
+    FORCE_INLINE void operator()(const Node&) const {}
+};
+
+// Iterative closest-hit traversal with an explicit stack, visiting the near
+// child first. leaf(first, count, ray_t) intersects the primitives of a leaf,
+// shrinks ray_t.max on a hit and returns whether anything was hit. Node is
+// any type with the offset/count/axis fields of bvh_flat_node and a
+// hit_node() overload. visit(node) sees every node fetched, for layout
+// statistics; the default compiles away.
+template <typename Node, typename LeafFn, typename VisitFn = bvh_no_visit>
+inline bool traverse_flat_bvh_from(const Node* nodes, uint32_t root, const ray& r, interval ray_t, LeafFn&& leaf,
+                                   VisitFn&& visit = {})
+{
+    bvh_ray br(r);
+    uint32_t stack[bvh_stack_size];
+    int stack_top = 0;
+    uint32_t current = root;
+    bool hit_anything = false;
+
+    while (true) {
+        const Node& node = nodes[current];
+        visit(node);
+        if (hit_node(node, br, ray_t.min, ray_t.max)) {
+            if (node.is_leaf()) {
+                if (leaf(node.offset, node.count, ray_t))
+                    hit_anything = true;
+            } else if (br.neg[node.axis]) {
+                assert(stack_top < bvh_stack_size && "BVH deeper than the traversal stack");
+                stack[stack_top++] = first_child(node, current);
+                current = second_child(node, current);
+                continue;
+            } else {
+                assert(stack_top < bvh_stack_size && "BVH deeper than the traversal stack");
+                stack[stack_top++] = second_child(node, current);
+                current = first_child(node, current);
+                continue;
+            }
+        }
+        if (stack_top == 0) break;
+        current = stack[--stack_top];
+    }
+    return hit_anything;
+}
+
+// traverse_flat_bvh() from the root.
+template <typename Node, typename LeafFn, typename VisitFn = bvh_no_visit>
+inline bool traverse_flat_bvh(const Node* nodes, const ray& r, interval ray_t, LeafFn&& leaf,
+                              VisitFn&& visit = {})
+{
+    return traverse_flat_bvh_from(nodes, 0, r, ray_t, leaf, visit);
+}
+
+// Any-hit traversal: returns as soon as leaf(first, count) reports a
+// primitive blocking the ray within ray_t. Child order does not matter here.
+template <typename Node, typename LeafFn>
+inline bool occluded_flat_bvh(const Node* nodes, const ray& r, interval ray_t, LeafFn&& leaf) {
+    bvh_ray br(r);
+    uint32_t stack[bvh_stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const Node& node = nodes[current];
+        if (hit_node(node, br, ray_t.min, ray_t.max)) {
+            if (!node.is_leaf()) {
+                assert(stack_top < bvh_stack_size && "BVH deeper than the traversal stack");
+                stack[stack_top++] = second_child(node, current);
+                current = first_child(node, current);
+                continue;
+            }
+            if (leaf(node.offset, node.count))
+                return true;
+        }
+        if (stack_top == 0) return false;
+        current = stack[--stack_top];
+    }
+}
+
+// N rays in structure-of-arrays form for the packet slab test. Lanes past
+// the packet's ray count get an empty interval and never hit a box.
+template <int N>
+struct alignas(32) bvh_ray_packet {
+    float org[3][N];
+    float inv_dir[3][N];
+    float tmin[N];
+    float tmax[N];
+    int neg[3];     // direction signs of the first ray, for the near child
+
+    bvh_ray_packet(const ray* rays, int count, const interval* ray_t) {
+        for (int i = 0; i < N; i++) {
+            const ray& r = rays[i < count ? i : 0];
+            for (int a = 0; a < 3; a++) {
+                org[a][i] = r.origin()[a];
+                inv_dir[a][i] = 1.0f / r.direction()[a];
+            }
+            tmin[i] = i < count ? ray_t[i].min : INF;
+            tmax[i] = i < count ? ray_t[i].max : -INF;
+        }
+        for (int a = 0; a < 3; a++)
+            neg[a] = inv_dir[a][0] < 0.0f;
+    }
+};
+
+// 8-lane version of hit_node_packet() below, compiled for AVX2 in any build;
+// it only runs in the AVX2 and AVX-512 copies of a dispatch() kernel.
+#ifdef RT_KERNELS_AVX2
+template <int N, typename Node>
+RT_TARGET_AVX2 inline uint32_t hit_node_packet_avx2(const Node& node, const bvh_ray_packet<N>& p) {
+    uint32_t mask = 0;
+    for (int base = 0; base < N; base += 8) {
+        __m256 tmin = _mm256_load_ps(p.tmin + base);
+        __m256 tmax = _mm256_load_ps(p.tmax + base);
+        for (int a = 0; a < 3; a++) {
+            __m256 org = _mm256_load_ps(p.org[a] + base);
+            __m256 inv = _mm256_load_ps(p.inv_dir[a] + base);
+            __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bmin[a]), org), inv);
+            __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bmax[a]), org), inv);
+            tmin = _mm256_max_ps(_mm256_min_ps(t1, t0), tmin);
+            tmax = _mm256_min_ps(_mm256_mul_ps(_mm256_max_ps(t1, t0), _mm256_set1_ps(bvh_slab_margin)), tmax);
+        }
+        mask |= uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ))) << base;
+    }
+    return mask;
+}
+#endif
+
+// Slab test of one node against every lane; returns the mask of lanes whose
+// interval overlaps the box. Same operand order as hit_node(), so a lane
+// agrees with the single-ray test even for NaN slabs. Isa is the level of the
+// dispatch() copy the test is compiled into.
+template <isa_level Isa, int N, typename Node>
+FORCE_INLINE uint32_t hit_node_packet(const Node& node, const bvh_ray_packet<N>& p) {
+#ifdef RT_KERNELS_AVX2
+    if constexpr (N % 8 == 0 && Isa >= isa_level::avx2)
+        return hit_node_packet_avx2(node, p);
+#endif
+    uint32_t mask = 0;
+#if defined(RT_RAY_PACKET_SSE)
+    if constexpr (N % 4 == 0) {
+        for (int base = 0; base < N; base += 4) {
+            __m128 tmin = _mm_load_ps(p.tmin + base);
+            __m128 tmax = _mm_load_ps(p.tmax + base);
+            for (int a = 0; a < 3; a++) {
+                __m128 org = _mm_load_ps(p.org[a] + base);
+                __m128 inv = _mm_load_ps(p.inv_dir[a] + base);
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmin[a]), org), inv);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmax[a]), org), inv);
+                tmin = _mm_max_ps(_mm_min_ps(t1, t0), tmin);
+                tmax = _mm_min_ps(_mm_mul_ps(_mm_max_ps(t1, t0), _mm_set1_ps(bvh_slab_margin)), tmax);
+            }
+            mask |= uint32_t(_mm_movemask_ps(_mm_cmple_ps(tmin, tmax))) << base;
+        }
+        return mask;
+    }
+#endif
+    for (int i = 0; i < N; i++) {
+        float tmin = p.tmin[i], tmax = p.tmax[i];
+        for (int a = 0; a < 3; a++) {
+            float t0 = (node.bmin[a] - p.org[a][i]) * p.inv_dir[a][i];
+            float t1 = (node.bmax[a] - p.org[a][i]) * p.inv_dir[a][i];
+            tmin = std::max(tmin, std::min(t0, t1));
+            tmax = std::min(tmax, std::max(t0, t1) * bvh_slab_margin);
+        }
+        mask |= uint32_t(tmin <= tmax) << i;
+    }
+    return mask;
+}
+
+// Closest-hit traversal of up to N coherent rays with one shared stack: a
+// node is fetched once for the whole packet and box-tested for every lane
+// with SIMD. Each stack entry carries the lanes that reached it. When no more
+// than fallback_lanes lanes are left in a subtree the packet has diverged,
+// and those lanes finish it one by one with traverse_flat_bvh_from().
+// leaf(first, count, lanes) intersects the leaf's primitives with the rays in
+// the lane mask, shrinks their ray_t[lane].max on a hit and returns the mask
+// of lanes hit. Returns the mask of all lanes hit. Isa is passed on to
+// hit_node_packet().
+template <int N, isa_level Isa = compiled_isa, typename Node, typename LeafFn>
+inline uint32_t traverse_flat_bvh_packet(const Node* nodes, const ray* rays, int count, interval* ray_t,
+                                         LeafFn&& leaf, int fallback_lanes = 1)
+{
+    static_assert(N <= max_packet_size, "one mask bit per lane");
+    bvh_ray_packet<N> p(rays, count, ray_t);
+    struct entry { uint32_t node, lanes; };
+    entry stack[bvh_stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+    uint32_t lanes = count >= 32 ? ~0u : (1u << count) - 1;
+    uint32_t hits = 0;
+
+    auto each_lane = [](uint32_t mask, auto&& fn) {
+        for (; mask; mask &= mask - 1)
+            fn(count_trailing_zeros(mask));
+    };
+
+    while (true) {
+        const Node& node = nodes[current];
+        uint32_t mask = hit_node_packet<Isa>(node, p) & lanes;
+        if (mask) {
+            if (popcount(mask) <= fallback_lanes) {
+                each_lane(mask, [&](int lane) {
+                    const uint32_t bit = 1u << lane;
+                    bool hit = traverse_flat_bvh_from(nodes, current, rays[lane], ray_t[lane],
+                        [&](uint32_t first, uint32_t n, interval& t) {
+                            ray_t[lane] = t;
+                            bool hit_leaf = (leaf(first, n, bit) & bit) != 0;
+                            t = ray_t[lane];
+                            return hit_leaf;
+                        });
+                    if (hit) hits |= bit;
+                    p.tmax[lane] = ray_t[lane].max;
+                });
+            } else if (node.is_leaf()) {
+                uint32_t hit = leaf(node.offset, node.count, mask);
+                hits |= hit;
+                each_lane(hit, [&](int lane) { p.tmax[lane] = ray_t[lane].max; });
+            } else {
+                uint32_t near = p.neg[node.axis] ? second_child(node, current) : first_child(node, current);
+                uint32_t far = p.neg[node.axis] ? first_child(node, current) : second_child(node, current);
+                assert(stack_top < bvh_stack_size && "BVH deeper than the traversal stack");
+                stack[stack_top++] = {far, mask};
+                current = near;
+                lanes = mask;
+                continue;
+            }
+        }
+        if (stack_top == 0) break;
+        --stack_top;
+        current = stack[stack_top].node;
+        lanes = stack[stack_top].lanes;
+    }
+    return hits;
+}
+
+// Packet traversal with the lane count rounded up to a SIMD-friendly width.
+template <isa_level Isa = compiled_isa, typename Node, typename LeafFn>
+inline uint32_t traverse_flat_bvh_packet(const Node* nodes, const ray* rays, int count, interval* ray_t,
+                                         LeafFn&& leaf)
+{
+    if (count <= 4) return traverse_flat_bvh_packet<4, Isa>(nodes, rays, count, ray_t, leaf);
+    if (count <= 8) return traverse_flat_bvh_packet<8, Isa>(nodes, rays, count, ray_t, leaf);
+    return traverse_flat_bvh_packet<16, Isa>(nodes, rays, count, ray_t, leaf);
+}
+
+// Node indices grouped by depth, deepest level first. Every node in a level
+// only depends on the level below it, so a refit can run each level as one
+// parallel loop.
+struct bvh_refit_schedule {
+    std::vector<uint32_t> order;
+    std::vector<size_t> level_start;    // level l is order[level_start[l], level_start[l+1])
+};
+
+inline bvh_refit_schedule make_refit_schedule(const std::vector<bvh_flat_node>& nodes) {
+    bvh_refit_schedule schedule;
+    if (nodes.empty()) return schedule;
+
+    // Parents precede their children in depth-first order.
+    std::vector<uint32_t> depth(nodes.size(), 0);
+    uint32_t max_depth = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].is_leaf()) continue;
+        depth[i + 1] = depth[nodes[i].offset] = depth[i] + 1;
+        max_depth = std::max(max_depth, depth[i] + 1);
+    }
+
+    std::vector<size_t> per_level(max_depth + 1, 0);
+    for (uint32_t d : depth) per_level[max_depth - d]++;
+
+    schedule.level_start.assign(max_depth + 2, 0);
+    for (uint32_t l = 0; l <= max_depth; l++)
+        schedule.level_start[l + 1] = schedule.level_start[l] + per_level[l];
+
+    schedule.order.resize(nodes.size());
+    std::vector<size_t> fill(schedule.level_start.begin(), schedule.level_start.end() - 1);
+    for (size_t i = 0; i < nodes.size(); i++)
+        schedule.order[fill[max_depth - depth[i]]++] = static_cast<uint32_t>(i);
+    return schedule;
+}
+
+// Recomputes every node box bottom-up while keeping the topology.
+// leaf_bounds(first, count) returns the current bounds of a leaf's primitives.
+template <typename LeafBoundsFn>
+inline void refit_flat_bvh(std::vector<bvh_flat_node>& nodes, const bvh_refit_schedule& schedule,
+                           LeafBoundsFn&& leaf_bounds)
+{
+    for (size_t l = 0; l + 1 < schedule.level_start.size(); l++) {
+        long long begin = static_cast<long long>(schedule.level_start[l]);
+        long long end = static_cast<long long>(schedule.level_start[l + 1]);
+
+        #pragma omp parallel for if(end - begin > 1024)
+        for (long long k = begin; k < end; k++) {
+            uint32_t i = schedule.order[k];
+            bvh_flat_node& node = nodes[i];
+            if (node.is_leaf())
+                node.set_bounds(leaf_bounds(node.offset, node.count));
+            else
+                node.set_bounds(AABB(nodes[i + 1].bounds(), nodes[node.offset].bounds()));
+        }
+    }
+}
+
+// Expected cost of a ray query under the surface area heuristic, relative to
+// the root box: sum of area(node)/area(root) over interior nodes, plus the
+// same weighted by the primitive count over leaves. Grows as refits loosen
+// the tree, which makes it the trigger for a full rebuild.
+inline float sah_cost(const std::vector<bvh_flat_node>& nodes) {
+    if (nodes.empty()) return 0.0f;
+    float root_area = nodes[0].bounds().half_area();
+    if (root_area <= 0.0f) return 0.0f;
+
+    double cost = 0.0;
+    for (const auto& node : nodes) {
+        float area = node.bounds().half_area();
+        cost += node.is_leaf() ? area * node.count : area;
+    }
+    return static_cast<float>(cost / root_area);
+}
+
+// Pointer-free BVH over arbitrary hittables, plugged into the world as a
+// single hittable. Pass bvh_split::spatial in the options to build an SBVH,
+// e.g. for a mesh full of long, thin triangles; refits then use the whole
+// object boxes again.
+class linear_bvh : public hittable {
+public:
+    linear_bvh(const hittable_list& list, const bvh_build_options& options = {})
+        : linear_bvh(list.objects, options) {}
+
+    linear_bvh(const std::vector<shared_ptr<hittable>>& source, const bvh_build_options& options = {})
+        : options(options)
+    {
+        build(source);
+    }
+
+    // Recomputes all node boxes from the objects' current bounding_box(),
+    // keeping the tree. Meant for animation, after objects moved in place.
+    void refit() {
+        refit_flat_bvh(nodes, schedule, [&](uint32_t first, uint32_t count) {
+            AABB box = AABB::empty;
+            for (uint32_t i = first; i < first + count; i++)
+                box = AABB(box, objects[i]->bounding_box());
+            return box;
+        });
+        bbox = nodes.empty() ? AABB::empty : nodes[0].bounds();
+    }
+
+    // Refits, then rebuilds from scratch if the SAH cost has grown beyond
+    // rebuild_ratio times the cost right after the last full build.
+    // Returns true when it rebuilt.
+    bool update(float rebuild_ratio = 1.5f) {
+        refit();
+        if (cost() <= rebuild_ratio * built_cost)
+            return false;
+
+        if (options.split != bvh_split::spatial) {
+            build(objects);
+            return true;
+        }
+        // Spatial splits put some objects into several leaves.
+        std::vector<shared_ptr<hittable>> unique;
+        std::unordered_set<const hittable*> seen;
+        for (const auto& obj : objects)
+            if (seen.insert(obj.get()).second)
+                unique.push_back(obj);
+        build(unique);
+        return true;
+    }
+
+    float cost() const { return sah_cost(nodes); }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return hit(r, ray_t, rec, bvh_no_visit{});
+    }
+
+    // hit() that reports every node it fetches to visit(node).
+    template <typename VisitFn>
+    bool hit(const ray& r, interval ray_t, hit_record& rec, VisitFn&& visit) const {
+        if (nodes.empty()) return false;
+
+        return dispatch([&] {
+            return traverse_flat_bvh(nodes.data(), r, ray_t,
+                [&](uint32_t first, uint32_t count, interval& t) {
+                    bool hit_leaf = false;
+                    for (uint32_t i = first; i < first + count; i++) {
+                        if (objects[i]->hit(r, t, rec)) {
+                            hit_leaf = true;
+                            t.max = rec.t;
+                        }
+                    }
+                    return hit_leaf;
+                }, visit);
+        });
+    }
+
+    // Leaves hand the lanes that reached them to each object as a smaller
+    // packet, so meshes below keep tracing them together.
+    uint32_t hit_packet(const ray* rays, int count, interval* ray_t, hit_record* recs) const override {
+        if (nodes.empty()) return 0;
+
+        return dispatch([&](auto isa) {
+            const uint32_t all = (1u << count) - 1;
+            return traverse_flat_bvh_packet<isa>(nodes.data(), rays, count, ray_t,
+                [&](uint32_t first, uint32_t n, uint32_t lanes) {
+                    if (lanes == all) {
+                        uint32_t hit = 0;
+                        for (uint32_t i = first; i < first + n; i++)
+                            hit |= objects[i]->hit_packet(rays, count, ray_t, recs);
+                        return hit;
+                    }
+                    ray sub_rays[max_packet_size];
+                    interval sub_t[max_packet_size];
+                    hit_record sub_recs[max_packet_size];
+                    int lane_of[max_packet_size];
+                    int sub_count = 0;
+                    for (uint32_t mask = lanes; mask; mask &= mask - 1) {
+                        int lane = count_trailing_zeros(mask);
+                        lane_of[sub_count] = lane;
+                        sub_rays[sub_count] = rays[lane];
+                        sub_t[sub_count++] = ray_t[lane];
+                    }
+                    uint32_t hit = 0;
+                    for (uint32_t i = first; i < first + n; i++)
+                        hit |= objects[i]->hit_packet(sub_rays, sub_count, sub_t, sub_recs);
+                    uint32_t lanes_hit = 0;
+                    for (; hit; hit &= hit - 1) {
+                        int i = count_trailing_zeros(hit);
+                        int lane = lane_of[i];
+                        ray_t[lane] = sub_t[i];
+                        recs[lane] = std::move(sub_recs[i]);
+                        lanes_hit |= 1u << lane;
+                    }
+                    return lanes_hit;
+                });
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (nodes.empty()) return false;
+
+        return dispatch([&] {
+            return occluded_flat_bvh(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count) {
+                for (uint32_t i = first; i < first + count; i++)
+                    if (objects[i]->occluded(r, ray_t))
+                        return true;
+                return false;
+            });
+        });
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+    size_t reference_count() const { return objects.size(); }
+
+    size_t memory_bytes() const {
+        return nodes.size() * sizeof(bvh_flat_node) + objects.size() * sizeof(shared_ptr<hittable>);
+    }
+
+private:
+    std::vector<bvh_flat_node> nodes;
+    std::vector<shared_ptr<hittable>> objects;  // in leaf order
+    bvh_refit_schedule schedule;
+    bvh_build_options options;
+    float built_cost = 0.0f;
+    AABB bbox;
+
+    void build(const std::vector<shared_ptr<hittable>>& source) {
+        flat_bvh bvh = build_flat_bvh(source, options);
+
+        nodes = std::move(bvh.nodes);
+        std::vector<shared_ptr<hittable>> ordered;
+        ordered.reserve(bvh.indices.size());
+        for (uint32_t index : bvh.indices)
+            ordered.push_back(source[index]);
+        objects = std::move(ordered);
+
+        schedule = make_refit_schedule(nodes);
+        built_cost = cost();
+        bbox = nodes.empty() ? AABB::empty : nodes[0].bounds();
+    }
+};
+
+} // namespace rt
@@ -3,6 +3,7 @@
 #include "hittable.hpp"
 #include "texture.hpp"
 #include "rtm/vector.hpp"
+#include "rtm/fast_math.hpp"
 
 namespace rt {
 
@@ -94,7 +95,7 @@ private:
         // Use Schlick's approximation for reflectance
         auto r0 = (1.0f - refraction_index) / (1 + refraction_index);
         r0 *= r0;
-        return r0 + (1.0f - r0) * std::pow((1 - cosine), 5);
+        return r0 + (1.0f - r0) * math::pow5(1 - cosine);
     }
 public:
     dielectrics(float refraction_index) : refraction_index(refraction_index) {}
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "hittable_list.hpp"
+#include "material.hpp"
 #include <algorithm>
 
 #include "rtm/vector.hpp"
+#include "triangle_mesh.hpp"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "external/tiny_obj_loader.h"
@@ -19,36 +21,26 @@ public:
     mesh_triangle(const point3f& a, const point3f& b, const point3f& c, shared_ptr<material> m)
         : v0(a), v1(b), v2(c), mat(m) {}
 
-    // Möller–Trumbore intersection
-    // ref: https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        const float epsilon = std::numeric_limits<float>::epsilon();
-        vec3f edge1 = v1 - v0;
-        vec3f edge2 = v2 - v0;
-
-        vec3f h = cross(r.direction(), edge2);
-        float a = dot(edge1, h);
-        if (fabs(a) < epsilon) return false; // ray parallel
-
-        float f = 1.0f / a;
-        vec3f s = r.origin() - v0;
-        float u = f * dot(s, h);
-        if (u < 0.0f || u > 1.0f) return false;
-
-        vec3f q = cross(s, edge1);
-        float v = f * dot(r.direction(), q);
-        if (v < 0.0f || u + v > 1.0f) return false;
-
-        float t = f * dot(edge2, q);
-        if (!ray_t.surrounds(t)) return false;
+        float t;
+        if (!intersect(r, ray_t, t)) return false;
 
         rec.t = t;
         rec.p = r.at(t);
-        rec.set_face_normal(r, unit_vector(cross(edge1, edge2)));
+        rec.set_face_normal(r, unit_vector(cross(v1 - v0, v2 - v0)));
         rec.mat = mat;
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        float t;
+        return intersect(r, ray_t, t);
+    }
+
+    bool intersect(const ray& r, interval ray_t, float& t) const {
+        return intersect_triangle(r, ray_t, v0, v1, v2, t);
+    }
+
     AABB bounding_box() const override {
         point3f min_pt(fmin(v0.x(), fmin(v1.x(), v2.x())),
                       fmin(v0.y(), fmin(v1.y(), v2.y())),
@@ -58,6 +50,10 @@ public:
                       fmax(v0.z(), fmax(v1.z(), v2.z())));
         return AABB(min_pt, max_pt);
     }
+
+    AABB clipped_bounding_box(int axis, float lo, float hi) const override {
+        return clip_triangle(v0, v1, v2, axis, lo, hi);
+    }
 };
 
 shared_ptr<hittable_list> load_obj(
@@ -98,6 +94,52 @@ shared_ptr<hittable_list> load_obj(
     return mesh;
 }
 
+// Loads an OBJ file as one indexed triangle_mesh, keeping the file's shared
+// vertices. Faces without an MTL material use default_mat; the others get a
+// lambertian of their diffuse color.
+shared_ptr<triangle_mesh> load_obj_mesh(
+    const std::string& filename,
+    shared_ptr<material> default_mat,
+    const bvh_build_options& options = {})
+{
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn, err;
+
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str())) {
+        throw std::runtime_error(warn + err);
+    }
+
+    std::vector<point3f> vertices(attrib.vertices.size() / 3);
+    for (size_t i = 0; i < vertices.size(); i++)
+        vertices[i] = point3f(attrib.vertices[3 * i + 0], attrib.vertices[3 * i + 1], attrib.vertices[3 * i + 2]);
+
+    std::vector<shared_ptr<material>> table{default_mat};
+    for (const auto& m : materials)
+        table.push_back(make_shared<lambertian>(color(m.diffuse[0], m.diffuse[1], m.diffuse[2])));
+    assert(table.size() <= 65536 && "material ids are 16 bits");
+
+    std::vector<uint32_t> indices;
+    std::vector<uint16_t> material_ids;
+    for (const auto& shape : shapes) {
+        size_t index_offset = 0;
+        for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++) {
+            int fv = shape.mesh.num_face_vertices[f]; // should be 3 for triangles
+            assert(fv == 3);
+            for (int v = 0; v < fv; v++)
+                indices.push_back(static_cast<uint32_t>(shape.mesh.indices[index_offset + v].vertex_index));
+            index_offset += fv;
+            material_ids.push_back(static_cast<uint16_t>(shape.mesh.material_ids[f] + 1));
+        }
+    }
+    if (materials.empty())
+        material_ids.clear();
+
+    return make_shared<triangle_mesh>(vertices, std::move(indices), std::move(table),
+                                      std::move(material_ids), options);
+}
+
 // allow shear
 inline void transform_mesh(hittable_list& mesh, float scale, const vec3f& translate) {
     for (auto& obj : mesh.objects) {
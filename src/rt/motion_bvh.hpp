@@ -0,0 +1,150 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "def.hpp"
+#include "linear_bvh.hpp"
+
+namespace rt {
+
+// A flat BVH node with bounds at shutter open and shutter close. A ray at time
+// t tests the box interpolated between them. For primitives moving linearly
+// that box contains every primitive at t, and the union of linearly moving
+// boxes never pokes out of the interpolated union, so the test stays
+// conservative all the way up the tree.
+struct alignas(64) bvh_motion_node {
+    float bmin[3];
+    uint32_t offset;    // leaf: first primitive slot, interior: index of the second child
+    float bmax[3];
+    uint16_t count;     // primitives in the leaf, 0 for interior nodes
+    uint16_t axis;      // split axis of an interior node
+    float bmin1[3];     // bounds at shutter close; bmin/bmax hold shutter open
+    float pad0;
+    float bmax1[3];
+    float pad1;
+
+    bool is_leaf() const { return count > 0; }
+
+    AABB bounds(float time) const {
+        float lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = bmin[a] + time * (bmin1[a] - bmin[a]);
+            hi[a] = bmax[a] + time * (bmax1[a] - bmax[a]);
+        }
+        return AABB(interval(lo[0], hi[0]), interval(lo[1], hi[1]), interval(lo[2], hi[2]));
+    }
+};
+static_assert(sizeof(bvh_motion_node) == 64, "bvh_motion_node should fill one cache line");
+
+FORCE_INLINE bool hit_node(const bvh_motion_node& node, const bvh_ray& r, float tmin, float tmax) {
+    for (int a = 0; a < 3; a++) {
+        float lo = node.bmin[a] + r.time * (node.bmin1[a] - node.bmin[a]);
+        float hi = node.bmax[a] + r.time * (node.bmax1[a] - node.bmax[a]);
+        float t0 = (lo - r.org[a]) * r.inv_dir[a];
+        float t1 = (hi - r.org[a]) * r.inv_dir[a];
+        tmin = std::max(tmin, std::min(t0, t1));
+        tmax = std::min(tmax, std::max(t0, t1) * bvh_slab_margin);
+    }
+    return tmin <= tmax;
+}
+
+// Flat BVH for scenes with motion blur. The topology is built by SAH from the
+// mid-shutter boxes, then the node bounds are fitted once at shutter open and
+// once at shutter close. Rays only visit nodes whose boxes contain the moving
+// objects at their own time, instead of the boxes swept over the whole shutter.
+class motion_bvh : public hittable {
+public:
+    motion_bvh(const hittable_list& list, const bvh_build_options& options = {})
+        : motion_bvh(list.objects, options) {}
+
+    motion_bvh(const std::vector<shared_ptr<hittable>>& source, const bvh_build_options& options = {}) {
+        std::vector<bvh_primitive> prims(source.size());
+        for (size_t i = 0; i < source.size(); i++) {
+            AABB box = source[i]->bounding_box_at(0.5f);
+            prims[i] = {box, box.centroid(), i};
+        }
+        flat_bvh bvh = build_flat_bvh(prims, options);
+        if (bvh.nodes.empty()) return;
+
+        objects.reserve(bvh.indices.size());
+        for (uint32_t index : bvh.indices)
+            objects.push_back(source[index]);
+
+        // Fit the same topology at both ends of the shutter.
+        auto schedule = make_refit_schedule(bvh.nodes);
+        std::vector<bvh_flat_node> open = bvh.nodes, close = bvh.nodes;
+        auto fit = [&](std::vector<bvh_flat_node>& nodes, float time) {
+            refit_flat_bvh(nodes, schedule, [&](uint32_t first, uint32_t count) {
+                AABB box = AABB::empty;
+                for (uint32_t i = first; i < first + count; i++)
+                    box = AABB(box, objects[i]->bounding_box_at(time));
+                return box;
+            });
+        };
+        fit(open, 0.0f);
+        fit(close, 1.0f);
+
+        nodes.resize(open.size());
+        for (size_t i = 0; i < open.size(); i++) {
+            bvh_motion_node& n = nodes[i];
+            n = {};
+            for (int a = 0; a < 3; a++) {
+                n.bmin[a] = open[i].bmin[a];
+                n.bmax[a] = open[i].bmax[a];
+                n.bmin1[a] = close[i].bmin[a];
+                n.bmax1[a] = close[i].bmax[a];
+            }
+            n.offset = open[i].offset;
+            n.count = open[i].count;
+            n.axis = open[i].axis;
+        }
+        bbox = AABB(open[0].bounds(), close[0].bounds());
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty()) return false;
+
+        return traverse_flat_bvh(nodes.data(), r, ray_t,
+            [&](uint32_t first, uint32_t count, interval& t) {
+                bool hit_leaf = false;
+                for (uint32_t i = first; i < first + count; i++) {
+                    if (objects[i]->hit(r, t, rec)) {
+                        hit_leaf = true;
+                        t.max = rec.t;
+                    }
+                }
+                return hit_leaf;
+            });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (nodes.empty()) return false;
+
+        return occluded_flat_bvh(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count) {
+            for (uint32_t i = first; i < first + count; i++)
+                if (objects[i]->occluded(r, ray_t))
+                    return true;
+            return false;
+        });
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+    AABB bounding_box_at(float time) const override {
+        return nodes.empty() ? AABB::empty : nodes[0].bounds(time);
+    }
+
+    size_t node_count() const { return nodes.size(); }
+
+    size_t memory_bytes() const {
+        return nodes.size() * sizeof(bvh_motion_node) + objects.size() * sizeof(shared_ptr<hittable>);
+    }
+
+private:
+    std::vector<bvh_motion_node> nodes;
+    std::vector<shared_ptr<hittable>> objects;  // in leaf order
+    AABB bbox = AABB::empty;
+};
+
+} // namespace rt
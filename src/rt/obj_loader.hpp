@@ -0,0 +1,318 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <filesystem>
+
+#include <omp.h>
+
+#include "mesh.hpp"
+#include "mapped_file.hpp"
+
+namespace rt {
+
+// Sizes and timings of one load_obj_parallel() call.
+struct obj_load_stats {
+    size_t bytes = 0;
+    size_t vertices = 0;
+    size_t triangles = 0;
+    int chunks = 0;
+    double parse_seconds = 0.0;     // mapping the file up to filled mesh buffers
+    double build_seconds = 0.0;     // BVH build
+
+    double parse_mb_per_sec() const { return parse_seconds > 0.0 ? bytes / parse_seconds * 1e-6 : 0.0; }
+};
+
+namespace obj_parse {
+
+// A line-aligned slice of the file, and what the counting pass found in it.
+struct chunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    size_t vertices = 0;
+    size_t triangles = 0;
+    std::vector<std::string> usemtl;            // material names switched to, in order
+    std::vector<uint16_t> usemtl_ids;           // the same, resolved
+    std::string mtllib;
+    size_t vertex_base = 0;                     // where the chunk writes in the mesh buffers
+    size_t triangle_base = 0;
+    uint16_t initial_material = 0;              // in effect where the chunk starts
+    std::vector<size_t> quads;                  // first of the two triangles of every quad
+    bool error = false;
+};
+
+inline bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline const char* skip_space(const char* p, const char* end) {
+    while (p < end && is_space(*p)) p++;
+    return p;
+}
+
+inline const char* skip_token(const char* p, const char* end) {
+    while (p < end && !is_space(*p)) p++;
+    return p;
+}
+
+inline const char* line_end(const char* p, const char* end) {
+    auto nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    return nl ? nl : end;
+}
+
+// Reads the keyword of a line and moves p past it: 'v' vertex, 'f' face,
+// 'u' usemtl, 'm' mtllib, 0 for everything else (normals, texture
+// coordinates, groups and comments are skipped).
+inline char keyword(const char*& p, const char* end) {
+    p = skip_space(p, end);
+    auto is = [&](const char* word, size_t n) {
+        return size_t(end - p) > n && std::memcmp(p, word, n) == 0 && is_space(p[n]);
+    };
+    if (is("v", 1))      { p += 2; return 'v'; }
+    if (is("f", 1))      { p += 2; return 'f'; }
+    if (is("usemtl", 6)) { p += 7; return 'u'; }
+    if (is("mtllib", 6)) { p += 7; return 'm'; }
+    return 0;
+}
+
+inline std::string rest_of_line(const char* p, const char* end) {
+    p = skip_space(p, end);
+    while (end > p && is_space(end[-1])) end--;
+    return std::string(p, end);
+}
+
+inline bool parse_float(const char*& p, const char* end, float& value) {
+    p = skip_space(p, end);
+    if (p < end && *p == '+') p++;
+    auto [next, ec] = std::from_chars(p, end, value);
+    if (ec != std::errc()) return false;
+    p = next;
+    return true;
+}
+
+// One face corner ("v", "v/vt", "v//vn" or "v/vt/vn"); only the position
+// index is kept. Negative indices count back from the vertices read so far.
+inline bool parse_index(const char*& p, const char* end, size_t vertices_so_far, size_t vertex_count, uint32_t& index) {
+    long long value;
+    auto [next, ec] = std::from_chars(p, end, value);
+    if (ec != std::errc() || value == 0) return false;
+    p = skip_token(next, end);
+
+    long long resolved = value > 0 ? value - 1 : static_cast<long long>(vertices_so_far) + value;
+    if (resolved < 0 || resolved >= static_cast<long long>(vertex_count)) return false;
+    index = static_cast<uint32_t>(resolved);
+    return true;
+}
+
+// First pass: counts what the chunk will write, so every chunk knows its
+// offsets before any parsing starts.
+inline void count(chunk& c) {
+    for (const char* p = c.begin; p < c.end; ) {
+        const char* eol = line_end(p, c.end);
+        const char* q = p;
+        switch (keyword(q, eol)) {
+            case 'v':
+                c.vertices++;
+                break;
+            case 'f': {
+                size_t corners = 0;
+                for (q = skip_space(q, eol); q < eol; q = skip_space(skip_token(q, eol), eol))
+                    corners++;
+                if (corners >= 3) c.triangles += corners - 2;
+                break;
+            }
+            case 'u':
+                c.usemtl.push_back(rest_of_line(q, eol));
+                break;
+            case 'm':
+                if (c.mtllib.empty()) c.mtllib = rest_of_line(q, eol);
+                break;
+        }
+        p = eol + 1;
+    }
+}
+
+// Second pass: writes positions, fan-triangulated faces and material ids
+// straight into the mesh buffers at the chunk's offsets.
+inline void parse(chunk& c, size_t vertex_count, float* x, float* y, float* z, uint32_t* indices, uint16_t* material_ids) {
+    size_t v = c.vertex_base;
+    size_t tri = c.triangle_base;
+    size_t next_switch = 0;
+    uint16_t material = c.initial_material;
+
+    for (const char* p = c.begin; p < c.end; ) {
+        const char* eol = line_end(p, c.end);
+        const char* q = p;
+        switch (keyword(q, eol)) {
+            case 'v':
+                if (!parse_float(q, eol, x[v]) || !parse_float(q, eol, y[v]) || !parse_float(q, eol, z[v])) {
+                    c.error = true;
+                    return;
+                }
+                v++;
+                break;
+            case 'f': {
+                uint32_t first = 0, previous = 0, corner;
+                int corners = 0;
+                for (q = skip_space(q, eol); q < eol; q = skip_space(q, eol)) {
+                    if (!parse_index(q, eol, v, vertex_count, corner)) {
+                        c.error = true;
+                        return;
+                    }
+                    if (corners == 0) first = corner;
+                    if (corners >= 2) {
+                        indices[3 * tri] = first;
+                        indices[3 * tri + 1] = previous;
+                        indices[3 * tri + 2] = corner;
+                        if (material_ids) material_ids[tri] = material;
+                        tri++;
+                    }
+                    previous = corner;
+                    corners++;
+                }
+                if (corners == 4) c.quads.push_back(tri - 2);
+                break;
+            }
+            case 'u':
+                material = c.usemtl_ids[next_switch++];
+                break;
+        }
+        p = eol + 1;
+    }
+}
+
+// Quads were split along 0-2 while their vertices were possibly still being
+// parsed by other chunks; now that all positions are in, split each along
+// its shorter diagonal instead, as tinyobj does.
+inline void split_quads(const chunk& c, const float* x, const float* y, const float* z, uint32_t* indices) {
+    auto distance_squared = [&](uint32_t a, uint32_t b) {
+        float dx = x[a] - x[b], dy = y[a] - y[b], dz = z[a] - z[b];
+        return dx * dx + dy * dy + dz * dz;
+    };
+    for (size_t tri : c.quads) {
+        uint32_t* q = indices + 3 * tri;    // (0, 1, 2), (0, 2, 3)
+        uint32_t v0 = q[0], v1 = q[1], v2 = q[2], v3 = q[5];
+        if (distance_squared(v0, v2) < distance_squared(v1, v3)) continue;
+        uint32_t split[6] = {v0, v1, v3, v1, v2, v3};
+        std::copy(split, split + 6, q);
+    }
+}
+
+} // namespace obj_parse
+
+// Loads an OBJ file as one indexed triangle_mesh, like load_obj_mesh(), but
+// without tinyobj: the file is mapped, split into line-aligned chunks, and
+// the chunks are parsed in parallel in two passes. The first counts vertices
+// and triangles per chunk; after a prefix sum the second parses every chunk
+// directly into its slice of the final vertex, index and material arrays.
+// Only positions, faces and usemtl/mtllib are read. Quads are split along the
+// shorter diagonal like tinyobj does, larger polygons into a fan.
+// Throws if the file cannot be opened or holds a malformed vertex or face.
+inline shared_ptr<triangle_mesh> load_obj_parallel(
+    const std::string& filename,
+    shared_ptr<material> default_mat,
+    const bvh_build_options& options = {},
+    obj_load_stats* stats = nullptr)
+{
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+
+    mapped_file file(filename);
+    if (!file.is_open()) throw std::runtime_error("cannot open " + filename);
+    const char* data = reinterpret_cast<const char*>(file.data());
+    const size_t size = file.size();
+
+    // About 256 KiB per chunk, with enough chunks to balance the threads
+    const size_t max_chunks = 16 * static_cast<size_t>(omp_get_max_threads());
+    const size_t chunk_count = std::max<size_t>(1, std::min(size / (256 << 10), max_chunks));
+    std::vector<obj_parse::chunk> chunks(chunk_count);
+    const char* begin = data;
+    for (size_t k = 0; k < chunk_count; k++) {
+        const char* end = data + size;
+        if (k + 1 < chunk_count) {
+            end = obj_parse::line_end(std::max(begin, data + size * (k + 1) / chunk_count), data + size);
+            if (end < data + size) end++;
+        }
+        chunks[k].begin = begin;
+        chunks[k].end = end;
+        begin = end;
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int k = 0; k < static_cast<int>(chunk_count); k++)
+        obj_parse::count(chunks[k]);
+
+    // Offsets, and the materials named by usemtl
+    size_t vertex_count = 0, triangle_count = 0;
+    std::string mtllib;
+    bool has_usemtl = false;
+    for (auto& c : chunks) {
+        c.vertex_base = vertex_count;
+        c.triangle_base = triangle_count;
+        vertex_count += c.vertices;
+        triangle_count += c.triangles;
+        if (mtllib.empty()) mtllib = c.mtllib;
+        has_usemtl |= !c.usemtl.empty();
+    }
+    if (vertex_count > UINT32_MAX) throw std::runtime_error(filename + ": too many vertices");
+
+    std::vector<shared_ptr<material>> table{default_mat};
+    std::map<std::string, int> material_map;
+    if (!mtllib.empty()) {
+        std::vector<tinyobj::material_t> materials;
+        std::string warn, err;
+        std::ifstream mtl(std::filesystem::path(filename).parent_path() / mtllib);
+        if (mtl) tinyobj::LoadMtl(&material_map, &materials, &mtl, &warn, &err);
+        for (const auto& m : materials)
+            table.push_back(make_shared<lambertian>(color(m.diffuse[0], m.diffuse[1], m.diffuse[2])));
+        assert(table.size() <= 65536 && "material ids are 16 bits");
+    }
+    const bool per_triangle_materials = has_usemtl && table.size() > 1;
+
+    uint16_t material = 0;
+    for (auto& c : chunks) {
+        c.initial_material = material;
+        for (const auto& name : c.usemtl) {
+            auto it = material_map.find(name);
+            material = it == material_map.end() ? 0 : static_cast<uint16_t>(it->second + 1);
+            c.usemtl_ids.push_back(material);
+        }
+    }
+
+    std::vector<float> x(vertex_count), y(vertex_count), z(vertex_count);
+    std::vector<uint32_t> indices(3 * triangle_count);
+    std::vector<uint16_t> material_ids(per_triangle_materials ? triangle_count : 0);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int k = 0; k < static_cast<int>(chunk_count); k++)
+        obj_parse::parse(chunks[k], vertex_count, x.data(), y.data(), z.data(), indices.data(),
+                         per_triangle_materials ? material_ids.data() : nullptr);
+
+    for (const auto& c : chunks)
+        if (c.error) throw std::runtime_error(filename + ": malformed vertex or face");
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int k = 0; k < static_cast<int>(chunk_count); k++)
+        obj_parse::split_quads(chunks[k], x.data(), y.data(), z.data(), indices.data());
+
+    auto parsed = clock::now();
+    auto mesh = make_shared<triangle_mesh>(std::move(x), std::move(y), std::move(z), std::move(indices),
+                                           std::move(table), std::move(material_ids), options);
+
+    if (stats) {
+        stats->bytes = size;
+        stats->vertices = vertex_count;
+        stats->triangles = triangle_count;
+        stats->chunks = static_cast<int>(chunk_count);
+        stats->parse_seconds = std::chrono::duration<double>(parsed - start).count();
+        stats->build_seconds = std::chrono::duration<double>(clock::now() - parsed).count();
+    }
+    return mesh;
+}
+
+} // namespace rt
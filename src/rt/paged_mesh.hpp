@@ -0,0 +1,424 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <filesystem>
+#include <unordered_map>
+
+#include "def.hpp"
+#include "bvh_cache.hpp"
+#include "triangle_intersection.hpp"
+
+namespace rt {
+
+struct page_cache_stats {
+    size_t lookups = 0;
+    size_t faults = 0;              // lookups that had to read the page from disk
+    size_t evictions = 0;
+    size_t bytes_read = 0;
+    size_t resident_bytes = 0;
+    size_t peak_resident_bytes = 0;
+
+    double hit_rate() const { return lookups > 0 ? 1.0 - double(faults) / lookups : 0.0; }
+};
+
+// A BVH subtree and its triangles, as read from a paged mesh file. Node
+// offsets are local to the page.
+struct mesh_page {
+    std::vector<bvh_flat_node> nodes;
+    std::vector<cached_triangle> triangles;     // in leaf order
+
+    size_t bytes() const { return nodes.size() * sizeof(bvh_flat_node) + triangles.size() * sizeof(cached_triangle); }
+};
+
+// Least-recently-used set of resident pages under a byte budget, shared by
+// any number of paged meshes so a whole scene stays under one ceiling. Pages
+// are handed out as shared_ptrs: evicting a page that another thread is still
+// tracing only drops the cache's reference, so memory stays below the budget
+// plus one page per tracing thread.
+class page_cache {
+public:
+    explicit page_cache(size_t budget_bytes) : budget(budget_bytes) {}
+
+    page_cache(const page_cache&) = delete;
+    page_cache& operator=(const page_cache&) = delete;
+
+    // The page stored under key, read with load() on a miss. The read runs
+    // outside the lock so other threads keep tracing resident pages.
+    template <typename LoadFn>
+    std::shared_ptr<const mesh_page> get(uint64_t key, LoadFn&& load) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            counters.lookups++;
+            auto it = index.find(key);
+            if (it != index.end()) {
+                lru.splice(lru.begin(), lru, it->second);
+                return it->second->page;
+            }
+        }
+
+        std::shared_ptr<const mesh_page> page = load();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.faults++;
+        counters.bytes_read += page->bytes();
+        auto it = index.find(key);
+        if (it != index.end())
+            return it->second->page;    // another thread read it meanwhile
+
+        lru.push_front({key, page});
+        index.emplace(key, lru.begin());
+        counters.resident_bytes += page->bytes();
+        while (counters.resident_bytes > budget && lru.size() > 1) {
+            counters.resident_bytes -= lru.back().page->bytes();
+            index.erase(lru.back().key);
+            lru.pop_back();
+            counters.evictions++;
+        }
+        counters.peak_resident_bytes = std::max(counters.peak_resident_bytes, counters.resident_bytes);
+        return page;
+    }
+
+    // Each paged mesh keys its pages by (owner, page index).
+    uint32_t new_owner() { return next_owner++; }
+
+    size_t budget_bytes() const { return budget; }
+
+    page_cache_stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+
+    // Zeroes the counters; the peak restarts from what is resident now.
+    void reset_stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t resident = counters.resident_bytes;
+        counters = {};
+        counters.resident_bytes = counters.peak_resident_bytes = resident;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        lru.clear();
+        index.clear();
+        counters.resident_bytes = 0;
+    }
+
+private:
+    struct entry {
+        uint64_t key;
+        std::shared_ptr<const mesh_page> page;
+    };
+
+    size_t budget;
+    mutable std::mutex mutex;
+    std::list<entry> lru;       // most recently used first
+    std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+    page_cache_stats counters;
+    std::atomic<uint32_t> next_owner{0};
+};
+
+// Paged mesh file layout: this header, top_node_count bvh_flat_nodes,
+// page_count paged_mesh_page_entries, then the pages, each its nodes followed
+// by its triangles. The top nodes are the part of the BVH above the pages; a
+// top leaf has count 1 and its offset is a page index.
+struct paged_mesh_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t top_node_count;
+    uint64_t key;
+    uint32_t page_count;
+    uint32_t triangle_count;
+    uint32_t node_size;
+    uint32_t triangle_size;
+    uint32_t pad[6];
+
+    static constexpr char expected_magic[8] = {'R', 'T', 'P', 'A', 'G', 'E', 'D', 0};
+    static constexpr uint32_t current_version = 1;
+};
+static_assert(sizeof(paged_mesh_header) == 64, "paged_mesh_header should be one cache line");
+
+struct paged_mesh_page_entry {
+    uint64_t offset;            // from the start of the file
+    uint32_t node_count;
+    uint32_t triangle_count;
+};
+
+// Cuts a depth-first flat BVH into pages of at most page_triangles triangles
+// (or single leaves) and writes the paged file through a temporary file.
+// triangles is in leaf order. Returns false if anything fails.
+inline bool write_paged_mesh(const std::string& path, uint64_t key, const std::vector<bvh_flat_node>& nodes,
+                             const std::vector<cached_triangle>& triangles, uint32_t page_triangles)
+{
+    // Per subtree: triangle count, one past its last node, first leaf slot.
+    // Children always come after their parent in depth-first order.
+    const size_t n = nodes.size();
+    std::vector<uint32_t> subtree_triangles(n), subtree_end(n), first_slot(n);
+    for (size_t i = n; i-- > 0; ) {
+        const auto& node = nodes[i];
+        if (node.is_leaf()) {
+            subtree_triangles[i] = node.count;
+            subtree_end[i] = static_cast<uint32_t>(i + 1);
+            first_slot[i] = node.offset;
+        } else {
+            subtree_triangles[i] = subtree_triangles[i + 1] + subtree_triangles[node.offset];
+            subtree_end[i] = subtree_end[node.offset];
+            first_slot[i] = first_slot[i + 1];
+        }
+    }
+
+    std::vector<bvh_flat_node> top;
+    std::vector<uint32_t> page_roots;
+    auto cut = [&](auto&& self, uint32_t i) -> void {
+        if (nodes[i].is_leaf() || subtree_triangles[i] <= page_triangles) {
+            bvh_flat_node leaf = nodes[i];
+            leaf.count = 1;
+            leaf.offset = static_cast<uint32_t>(page_roots.size());
+            top.push_back(leaf);
+            page_roots.push_back(i);
+            return;
+        }
+        size_t at = top.size();
+        top.push_back(nodes[i]);
+        self(self, i + 1);
+        top[at].offset = static_cast<uint32_t>(top.size());
+        self(self, nodes[i].offset);
+    };
+    if (n > 0) cut(cut, 0);
+
+    paged_mesh_header header = {};
+    std::memcpy(header.magic, paged_mesh_header::expected_magic, sizeof(header.magic));
+    header.version = paged_mesh_header::current_version;
+    header.top_node_count = static_cast<uint32_t>(top.size());
+    header.key = key;
+    header.page_count = static_cast<uint32_t>(page_roots.size());
+    header.triangle_count = static_cast<uint32_t>(triangles.size());
+    header.node_size = sizeof(bvh_flat_node);
+    header.triangle_size = sizeof(cached_triangle);
+
+    std::vector<paged_mesh_page_entry> entries;
+    uint64_t offset = sizeof(header) + top.size() * sizeof(bvh_flat_node)
+                    + page_roots.size() * sizeof(paged_mesh_page_entry);
+    for (uint32_t root : page_roots) {
+        paged_mesh_page_entry e = {offset, subtree_end[root] - root, subtree_triangles[root]};
+        entries.push_back(e);
+        offset += e.node_count * sizeof(bvh_flat_node) + e.triangle_count * sizeof(cached_triangle);
+    }
+
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(top.data()), top.size() * sizeof(bvh_flat_node));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(paged_mesh_page_entry));
+        for (uint32_t root : page_roots) {
+            // Rebase the subtree onto its own root and first slot
+            std::vector<bvh_flat_node> local(nodes.begin() + root, nodes.begin() + subtree_end[root]);
+            for (auto& node : local)
+                node.offset -= node.is_leaf() ? first_slot[root] : root;
+            out.write(reinterpret_cast<const char*>(local.data()), local.size() * sizeof(bvh_flat_node));
+            out.write(reinterpret_cast<const char*>(triangles.data() + first_slot[root]),
+                      size_t(subtree_triangles[root]) * sizeof(cached_triangle));
+        }
+        if (!out) return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) std::filesystem::remove(tmp, ec);
+    return !ec;
+}
+
+// A triangle mesh that keeps only the top of its BVH in memory. The subtrees
+// below it live in a paged file and are read into the shared page_cache the
+// first time a ray reaches them, so the resident size of any number of paged
+// meshes is bounded by the cache budget instead of the scene size.
+class paged_mesh : public hittable {
+public:
+    // Opens a file written by write_paged_mesh(); check is_open(). key must
+    // match the one it was written with.
+    paged_mesh(const std::string& path, uint64_t key, shared_ptr<page_cache> cache, shared_ptr<material> mat)
+        : cache(std::move(cache)), mat(std::move(mat)), file(path, std::ios::binary)
+    {
+        paged_mesh_header header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || std::memcmp(header.magic, paged_mesh_header::expected_magic, sizeof(header.magic)) != 0
+            || header.version != paged_mesh_header::current_version
+            || header.key != key
+            || header.node_size != sizeof(bvh_flat_node)
+            || header.triangle_size != sizeof(cached_triangle))
+            return;
+
+        top.resize(header.top_node_count);
+        pages.resize(header.page_count);
+        file.read(reinterpret_cast<char*>(top.data()), top.size() * sizeof(bvh_flat_node));
+        file.read(reinterpret_cast<char*>(pages.data()), pages.size() * sizeof(paged_mesh_page_entry));
+        if (!file || top.empty()) {
+            top.clear();
+            pages.clear();
+            return;
+        }
+        num_triangles = header.triangle_count;
+        owner = uint64_t(this->cache->new_owner()) << 32;
+        bbox = top[0].bounds();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (top.empty()) return false;
+
+        triangle_ray tr(r);
+        cached_triangle closest{};
+        float closest_t = 0.0f;
+        bool hit_anything = traverse_flat_bvh(top.data(), r, ray_t,
+            [&](uint32_t page_index, uint32_t, interval& t) {
+                auto page = fetch(page_index);
+                bool hit_page = traverse_flat_bvh(page->nodes.data(), r, t,
+                    [&](uint32_t first, uint32_t count, interval& page_t) {
+                        bool hit_leaf = false;
+                        for (uint32_t i = first; i < first + count; i++) {
+                            const cached_triangle& tri = page->triangles[i];
+                            float tri_t;
+                            if (intersect_triangle(tr, page_t, tri.vertex(0), tri.vertex(1), tri.vertex(2), tri_t)) {
+                                hit_leaf = true;
+                                page_t.max = tri_t;
+                                closest = tri;      // the page may be evicted once released
+                                closest_t = tri_t;
+                            }
+                        }
+                        return hit_leaf;
+                    });
+                if (hit_page) t.max = closest_t;
+                return hit_page;
+            });
+        if (!hit_anything) return false;
+
+        point3f v0 = closest.vertex(0);
+        rec.t = closest_t;
+        rec.p = r.at(closest_t);
+        rec.set_face_normal(r, unit_vector(cross(closest.vertex(1) - v0, closest.vertex(2) - v0)));
+        rec.mat = mat;
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (top.empty()) return false;
+
+        triangle_ray tr(r);
+        return occluded_flat_bvh(top.data(), r, ray_t, [&](uint32_t page_index, uint32_t) {
+            auto page = fetch(page_index);
+            return occluded_flat_bvh(page->nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count) {
+                float t;
+                for (uint32_t i = first; i < first + count; i++) {
+                    const cached_triangle& tri = page->triangles[i];
+                    if (intersect_triangle(tr, ray_t, tri.vertex(0), tri.vertex(1), tri.vertex(2), t))
+                        return true;
+                }
+                return false;
+            });
+        });
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+    bool is_open() const { return !top.empty(); }
+    size_t page_count() const { return pages.size(); }
+    size_t triangle_count() const { return num_triangles; }
+    size_t top_node_count() const { return top.size(); }
+
+    // What stays resident regardless of the cache
+    size_t memory_bytes() const {
+        return top.size() * sizeof(bvh_flat_node) + pages.size() * sizeof(paged_mesh_page_entry);
+    }
+
+    // Size of all pages together, i.e. what the mesh would take fully loaded
+    size_t paged_bytes() const {
+        size_t bytes = 0;
+        for (const auto& e : pages)
+            bytes += e.node_count * sizeof(bvh_flat_node) + e.triangle_count * sizeof(cached_triangle);
+        return bytes;
+    }
+
+private:
+    shared_ptr<page_cache> cache;
+    shared_ptr<material> mat;
+    std::vector<bvh_flat_node> top;
+    std::vector<paged_mesh_page_entry> pages;
+    uint32_t num_triangles = 0;
+    uint64_t owner = 0;
+    AABB bbox = AABB::empty;
+
+    mutable std::ifstream file;
+    mutable std::mutex file_mutex;
+
+    std::shared_ptr<const mesh_page> fetch(uint32_t page_index) const {
+        return cache->get(owner | page_index, [&] {
+            const paged_mesh_page_entry& e = pages[page_index];
+            auto page = std::make_shared<mesh_page>();
+            page->nodes.resize(e.node_count);
+            page->triangles.resize(e.triangle_count);
+
+            std::lock_guard<std::mutex> lock(file_mutex);
+            file.seekg(static_cast<std::streamoff>(e.offset));
+            file.read(reinterpret_cast<char*>(page->nodes.data()), e.node_count * sizeof(bvh_flat_node));
+            file.read(reinterpret_cast<char*>(page->triangles.data()), e.triangle_count * sizeof(cached_triangle));
+            if (!file) throw std::runtime_error("cannot read page of a paged mesh");
+            return std::shared_ptr<const mesh_page>(std::move(page));
+        });
+    }
+};
+
+// Like load_obj_cached(), but the result is paged: the first call parses the
+// OBJ file, builds the BVH and writes it to cache_dir cut into pages of at
+// most page_triangles triangles; later calls only hash the OBJ file, streamed
+// in chunks, and read the top levels of the paged file. All meshes loaded with
+// the same cache share its budget. Throws if the paged file can neither be
+// opened nor written.
+//
+// Only the one-time conversion is not bounded by the cache: it goes through
+// build_obj_bvh(), which holds the whole mesh while building the BVH. That
+// peaks at roughly 270 bytes per triangle (the mesh_triangle objects and
+// their pointers, the build primitives and the sparse and compacted node
+// arrays), about 2.7 GB for 10M triangles, on top of the OBJ parser's own
+// vertex arrays while it reads the file. Convert such meshes once on a
+// machine with that much memory; rendering from the paged file afterwards
+// stays within the cache budget.
+inline shared_ptr<paged_mesh> load_obj_paged(
+    const std::string& filename,
+    shared_ptr<material> mat,
+    shared_ptr<page_cache> cache,
+    const affine3f& to_world = affine3f(),
+    const bvh_build_options& options = {},
+    const std::string& cache_dir = "cache",
+    uint32_t page_triangles = 4096)
+{
+    fnv1a_hash h;
+    h.add(bvh_cache_key(filename, to_world, options));
+    h.add(paged_mesh_header::current_version);
+    h.add(page_triangles);
+    std::string path = bvh_cache_path(cache_dir, filename, h.value, ".pages");
+
+    auto mesh = make_shared<paged_mesh>(path, h.value, cache, mat);
+    if (mesh->is_open()) return mesh;
+
+    std::vector<cached_triangle> triangles;
+    flat_bvh bvh = build_obj_bvh(filename, to_world, options, triangles);
+
+    std::error_code ec;
+    std::filesystem::create_directories(cache_dir, ec);
+    if (!write_paged_mesh(path, h.value, bvh.nodes, triangles, page_triangles))
+        throw std::runtime_error("cannot write " + path);
+
+    mesh = make_shared<paged_mesh>(path, h.value, std::move(cache), std::move(mat));
+    if (!mesh->is_open()) throw std::runtime_error("cannot open " + path);
+    return mesh;
+}
+
+} // namespace rt
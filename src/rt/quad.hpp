@@ -36,32 +36,29 @@ public:
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override 
     {
-        float denominator = dot(normal, r.direction());
-
-        // No hit if the ray is parallel to the plane.
-        if (std::fabs(denominator) < 1e-8) return false;
-
-        // Return false if the hit point parameter t is outside the ray interval.
-        float t = (D - dot(normal, r.origin())) / denominator;
-        if (!ray_t.contains(t)) return false;
-
-        point3f intersection = r.at(t);
-        vec3f planar_hitpt_vector = intersection - Q;
-        auto alpha = dot(w, cross(planar_hitpt_vector, v));
-        auto beta = dot(w, cross(u, planar_hitpt_vector));
+        float t, alpha, beta;
+        if (!intersect_plane(r, ray_t, t, alpha, beta))
+            return false;
 
         if (!is_interior(alpha, beta, rec))
             return false;
 
         // Ray hits the 2D shape; set the rest of the hit record and return true.
         rec.t = t;
-        rec.p = intersection;
+        rec.p = r.at(t);
         rec.mat = mat;
         rec.set_face_normal(r, normal);
 
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        float t, alpha, beta;
+        hit_record rec;
+        return intersect_plane(r, ray_t, t, alpha, beta) && is_interior(alpha, beta, rec);
+    }
+
     virtual bool is_interior(float a, float b, hit_record& rec) const 
     {
         interval unit_interval = interval(0, 1);
@@ -79,6 +76,26 @@ public:
 private:
     point3f Q;
     vec3f u, v, w;
+
+    // Intersects the plane of the quad; alpha and beta are the plane
+    // coordinates of the hit point along u and v.
+    bool intersect_plane(const ray& r, interval ray_t, float& t, float& alpha, float& beta) const
+    {
+        float denominator = dot(normal, r.direction());
+
+        // No hit if the ray is parallel to the plane.
+        if (std::fabs(denominator) < 1e-8) return false;
+
+        // Return false if the hit point parameter t is outside the ray interval.
+        t = (D - dot(normal, r.origin())) / denominator;
+        if (!ray_t.contains(t)) return false;
+
+        vec3f planar_hitpt_vector = r.at(t) - Q;
+        alpha = dot(w, cross(planar_hitpt_vector, v));
+        beta = dot(w, cross(u, planar_hitpt_vector));
+        return true;
+    }
+
     shared_ptr<material> mat;
     AABB bbox;
     vec3f normal;
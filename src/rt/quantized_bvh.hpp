@@ -0,0 +1,295 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+#include "def.hpp"
+#include "wide_bvh.hpp"
+
+namespace rt {
+
+// A W-ary BVH node whose child boxes are stored as Q-bit integers on a grid
+// spanning the node's own box:
+//   child bound = origin[a] + q * 2^exponent[a]
+// Lower bounds are rounded down and upper bounds up, so every dequantized box
+// contains the exact one. With Q = uint8_t and W = 4 a node fits in 64 bytes,
+// half of a float bvh_wide_node<4>.
+// Empty slots are marked in valid, not by their box: the conservative slab
+// test below can accept any box of a node that is tiny next to its distance
+// from the ray origin, inverted or not.
+template <int W, typename Q>
+struct alignas(16) bvh_quantized_node {
+    static constexpr int width = W;
+    static constexpr uint32_t q_max = std::numeric_limits<Q>::max();
+    static_assert(W <= 8, "valid holds one bit per slot");
+
+    float origin[3];
+    int8_t exponent[3];
+    Q qbounds[6][W];    // same plane order as bvh_wide_node::bounds
+    uint32_t child[W];  // interior: node index, leaf: first primitive slot
+    uint8_t count[W];   // primitives in a leaf child, 0 for interior or empty slots
+    uint8_t valid;      // bit i set if slot i holds a child
+
+    bool is_leaf(int i) const { return count[i] > 0; }
+
+    // 2^exponent, built from the exponent bits; std::ldexp is a library call.
+    float scale(int axis) const {
+        uint32_t bits = static_cast<uint32_t>(exponent[axis] + 127) << 23;
+        float s;
+        std::memcpy(&s, &bits, sizeof(s));
+        return s;
+    }
+};
+static_assert(sizeof(bvh_quantized_node<4, uint8_t>) == 64, "8-bit BVH4 node should fill one cache line");
+
+// Quantizes a float wide node. Empty slots are left out of valid; their box
+// is inverted only so they quantize to something deterministic.
+template <int W, typename Q>
+void quantize_wide_node(const bvh_wide_node<W>& in, bvh_quantized_node<W, Q>& out) {
+    using node = bvh_quantized_node<W, Q>;
+    const float q_max = static_cast<float>(node::q_max);
+
+    bool used[W];
+    out.valid = 0;
+    for (int i = 0; i < W; i++) {
+        used[i] = in.bounds[0][i] <= in.bounds[3][i];
+        out.valid |= static_cast<uint8_t>(used[i] << i);
+    }
+
+    for (int a = 0; a < 3; a++) {
+        float lo = INF, hi = -INF;
+        for (int i = 0; i < W; i++) {
+            if (!used[i]) continue;
+            lo = std::fmin(lo, in.bounds[a][i]);
+            hi = std::fmax(hi, in.bounds[a + 3][i]);
+        }
+
+        // Smallest power of two step whose grid still reaches the top of the box.
+        int e = static_cast<int>(std::ceil(std::log2(std::fmax(hi - lo, 1e-30f) / q_max)));
+        e = std::max(e, -126);
+        while (e < 127 && lo + q_max * std::ldexp(1.0f, e) < hi)
+            e++;
+        out.origin[a] = lo;
+        out.exponent[a] = static_cast<int8_t>(e);
+    }
+
+    for (int i = 0; i < W; i++) {
+        out.child[i] = in.child[i];
+        out.count[i] = static_cast<uint8_t>(in.count[i]);
+        for (int a = 0; a < 3; a++) {
+            if (!used[i]) {
+                out.qbounds[a][i] = static_cast<Q>(node::q_max);
+                out.qbounds[a + 3][i] = 0;
+                continue;
+            }
+            float origin = out.origin[a], s = out.scale(a);
+            float lo = in.bounds[a][i], hi = in.bounds[a + 3][i];
+
+            float ql = std::clamp(std::floor((lo - origin) / s), 0.0f, q_max);
+            float qh = std::clamp(std::ceil((hi - origin) / s), 0.0f, q_max);
+            while (ql > 0.0f && origin + ql * s > lo) ql -= 1.0f;
+            while (qh < q_max && origin + qh * s < hi) qh += 1.0f;
+            out.qbounds[a][i] = static_cast<Q>(ql);
+            out.qbounds[a + 3][i] = static_cast<Q>(qh);
+        }
+    }
+}
+
+// Per-axis terms of the slab test against quantized child boxes. The grid
+// is folded into the ray instead of dequantizing the boxes:
+//   t = q * (2^e * inv_dir) + (origin - org) * inv_dir.
+// The two terms can be far larger than t and cancel (a ray almost parallel
+// to a plane), so on top of the relative bvh_slab_margin, as in the float
+// intersect_children(), the entry and exit offsets are moved apart by an
+// absolute bound on the rounding of the sum, taken once per node and axis.
+struct quantized_slabs {
+    float scale[3];
+    float near_offset[3];
+    float far_offset[3];
+};
+
+template <int W, typename Q>
+FORCE_INLINE quantized_slabs slabs_for(const bvh_quantized_node<W, Q>& node, const wide_bvh_ray& r) {
+    constexpr float gamma3 = 3.0f * 0x1p-24f / (1.0f - 3.0f * 0x1p-24f);
+    constexpr float q_max = static_cast<float>(bvh_quantized_node<W, Q>::q_max);
+    quantized_slabs s;
+    for (int a = 0; a < 3; a++) {
+        s.scale[a] = node.scale(a) * r.inv_dir[a];
+        float offset = (node.origin[a] - r.org[a]) * r.inv_dir[a];
+        float error = gamma3 * (std::fabs(offset) + q_max * std::fabs(s.scale[a]));
+        s.near_offset[a] = offset - error;
+        s.far_offset[a] = offset + error;
+    }
+    return s;
+}
+
+#ifdef RT_KERNELS_AVX2
+// Widens eight 8- or 16-bit grid coordinates to floats. A function of its own,
+// since a lambda would not inherit the target attribute.
+template <typename Q>
+RT_TARGET_AVX2 inline __m256 load_grid_avx2(const Q* q) {
+    __m256i v;
+    if constexpr (sizeof(Q) == 1)
+        v = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q)));
+    else
+        v = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(q)));
+    return _mm256_cvtepi32_ps(v);
+}
+
+// 8-wide version of intersect_children() below, compiled for AVX2 in any
+// build; see wide_bvh.hpp.
+template <typename Q>
+RT_TARGET_AVX2 inline int intersect_children_avx2(const bvh_quantized_node<8, Q>& node, const wide_bvh_ray& r,
+                                                  float tmin, float tmax, float* tnear)
+{
+    const quantized_slabs s = slabs_for(node, r);
+    __m256 t0 = _mm256_set1_ps(tmin);
+    __m256 t1 = _mm256_set1_ps(INF);
+    for (int a = 0; a < 3; a++) {
+        __m256 scale = _mm256_set1_ps(s.scale[a]);
+        __m256 n = _mm256_add_ps(_mm256_mul_ps(load_grid_avx2(node.qbounds[r.near[a]]), scale), _mm256_set1_ps(s.near_offset[a]));
+        __m256 f = _mm256_add_ps(_mm256_mul_ps(load_grid_avx2(node.qbounds[r.far[a]]), scale), _mm256_set1_ps(s.far_offset[a]));
+        t0 = _mm256_max_ps(n, t0);
+        t1 = _mm256_min_ps(f, t1);
+    }
+    t1 = _mm256_min_ps(_mm256_mul_ps(t1, _mm256_set1_ps(bvh_slab_margin)), _mm256_set1_ps(tmax));
+    _mm256_storeu_ps(tnear, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)) & node.valid;
+}
+#endif
+
+// Slab test against quantized child boxes, with the same contract as the
+// float intersect_children(). Only slots in node.valid are ever reported.
+template <isa_level Isa, int W, typename Q>
+FORCE_INLINE int intersect_children(const bvh_quantized_node<W, Q>& node, const wide_bvh_ray& r,
+                                    float tmin, float tmax, float* tnear)
+{
+#ifdef RT_KERNELS_AVX2
+    if constexpr (W == 8 && Isa >= isa_level::avx2)
+        return intersect_children_avx2(node, r, tmin, tmax, tnear);
+#endif
+
+    const quantized_slabs s = slabs_for(node, r);
+#ifdef RT_WIDE_BVH_SSE
+    if constexpr (W == 4) {
+        // Widens four 8- or 16-bit grid coordinates to floats.
+        auto load = [](const Q* q) {
+            __m128i v;
+            if constexpr (sizeof(Q) == 1) {
+                int32_t packed;
+                std::memcpy(&packed, q, 4);
+                v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), _mm_setzero_si128());
+            } else {
+                v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(q));
+            }
+            return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, _mm_setzero_si128()));
+        };
+
+        __m128 t0 = _mm_set1_ps(tmin);
+        __m128 t1 = _mm_set1_ps(INF);
+        for (int a = 0; a < 3; a++) {
+            __m128 scale = _mm_set1_ps(s.scale[a]);
+            __m128 n = _mm_add_ps(_mm_mul_ps(load(node.qbounds[r.near[a]]), scale), _mm_set1_ps(s.near_offset[a]));
+            __m128 f = _mm_add_ps(_mm_mul_ps(load(node.qbounds[r.far[a]]), scale), _mm_set1_ps(s.far_offset[a]));
+            t0 = _mm_max_ps(n, t0);
+            t1 = _mm_min_ps(f, t1);
+        }
+        t1 = _mm_min_ps(_mm_mul_ps(t1, _mm_set1_ps(bvh_slab_margin)), _mm_set1_ps(tmax));
+        _mm_storeu_ps(tnear, t0);
+        return _mm_movemask_ps(_mm_cmple_ps(t0, t1)) & node.valid;
+    }
+#endif
+
+    int mask = 0;
+    for (int i = 0; i < W; i++) {
+        float t0 = tmin, t1 = INF;
+        for (int a = 0; a < 3; a++) {
+            t0 = std::max(t0, node.qbounds[r.near[a]][i] * s.scale[a] + s.near_offset[a]);
+            t1 = std::min(t1, node.qbounds[r.far[a]][i] * s.scale[a] + s.far_offset[a]);
+        }
+        t1 = std::min(tmax, t1 * bvh_slab_margin);
+        tnear[i] = t0;
+        mask |= (t0 <= t1) << i;
+    }
+    return mask & node.valid;
+}
+
+// Wide BVH with quantized child boxes, for meshes where node memory matters
+// more than the few extra instructions per box test.
+template <int W, typename Q = uint8_t>
+class quantized_bvh : public hittable {
+public:
+    using node_type = bvh_quantized_node<W, Q>;
+
+    quantized_bvh(const hittable_list& list, const bvh_build_options& options = {})
+        : quantized_bvh(list.objects, options) {}
+
+    quantized_bvh(const std::vector<shared_ptr<hittable>>& source, const bvh_build_options& options = {}) {
+        assert(options.max_leaf_size <= 255 && "leaf counts are stored in 8 bits");
+        flat_bvh bvh = build_flat_bvh(source, options);
+        if (bvh.nodes.empty()) return;
+
+        std::vector<bvh_wide_node<W>> wide;
+        collapse_to_wide<W>(bvh.nodes, 0, wide);
+        nodes.resize(wide.size());
+        for (size_t i = 0; i < wide.size(); i++)
+            quantize_wide_node(wide[i], nodes[i]);
+
+        objects.reserve(bvh.indices.size());
+        for (uint32_t index : bvh.indices)
+            objects.push_back(source[index]);
+        bbox = bvh.nodes[0].bounds();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty()) return false;
+
+        return dispatch([&](auto isa) {
+            return traverse_wide_bvh<isa>(nodes.data(), r, ray_t,
+                [&](uint32_t first, uint32_t count, interval& t) {
+                    bool hit_leaf = false;
+                    for (uint32_t i = first; i < first + count; i++) {
+                        if (objects[i]->hit(r, t, rec)) {
+                            hit_leaf = true;
+                            t.max = rec.t;
+                        }
+                    }
+                    return hit_leaf;
+                });
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (nodes.empty()) return false;
+
+        return dispatch([&](auto isa) {
+            return occluded_wide_bvh<isa>(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count) {
+                for (uint32_t i = first; i < first + count; i++)
+                    if (objects[i]->occluded(r, ray_t))
+                        return true;
+                return false;
+            });
+        });
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    size_t memory_bytes() const {
+        return nodes.size() * sizeof(node_type) + objects.size() * sizeof(shared_ptr<hittable>);
+    }
+
+private:
+    std::vector<node_type> nodes;
+    std::vector<shared_ptr<hittable>> objects;  // in leaf order
+    AABB bbox = AABB::empty;
+};
+
+using qbvh4 = quantized_bvh<4, uint8_t>;
+using qbvh8 = quantized_bvh<8, uint8_t>;
+
+} // namespace rt
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "AABB.hpp"
+#include "rtm/ray.hpp"
+
+namespace rt {
+
+// Spreads the low 10 bits of v so that two zero bits follow each one.
+inline uint32_t morton_spread(uint32_t v) {
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8))  & 0x0300f00f;
+    v = (v | (v << 4))  & 0x030c30c3;
+    v = (v | (v << 2))  & 0x09249249;
+    return v;
+}
+
+// 30-bit Morton code of p on a 1024^3 grid over bounds; points outside are
+// clamped to the grid.
+inline uint32_t morton_code(const point3f& p, const AABB& bounds) {
+    uint32_t code = 0;
+    for (int a = 0; a < 3; a++) {
+        const interval& ax = bounds.axis_interval(a);
+        float extent = ax.size();
+        float f = extent > 0.0f ? (p[a] - ax.min) / extent : 0.0f;
+        uint32_t cell = static_cast<uint32_t>(std::clamp(f * 1024.0f, 0.0f, 1023.0f));
+        code |= morton_spread(cell) << (2 - a);
+    }
+    return code;
+}
+
+// Sort key of a ray: the octant of its direction above the Morton code of
+// its origin. Rays with equal keys start close together and head the same
+// way, so they mostly visit the same BVH nodes.
+inline uint64_t ray_sort_key(const ray& r, const AABB& bounds) {
+    const vec3f& d = r.direction();
+    uint64_t octant = (d.x() < 0.0f ? 1u : 0u) | (d.y() < 0.0f ? 2u : 0u) | (d.z() < 0.0f ? 4u : 0u);
+    return octant << 30 | morton_code(r.origin(), bounds);
+}
+
+// Reorders index[0, count) by the ray_sort_key() of ray_of(index[i]), each
+// run of batch_size indices on its own (0 sorts all of them at once). Small
+// batches cost less and keep rays near where they were queued; large ones
+// find more coherence.
+template <typename RayOf>
+inline void sort_rays(RayOf&& ray_of, uint32_t* index, size_t count, const AABB& bounds, size_t batch_size = 0) {
+    if (batch_size == 0) batch_size = count;
+    const long long batches = batch_size > 0 ? static_cast<long long>((count + batch_size - 1) / batch_size) : 0;
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (long long b = 0; b < batches; b++) {
+        size_t first = static_cast<size_t>(b) * batch_size;
+        size_t n = std::min(batch_size, count - first);
+        std::vector<std::pair<uint64_t, uint32_t>> keyed(n);
+        for (size_t i = 0; i < n; i++)
+            keyed[i] = {ray_sort_key(ray_of(index[first + i]), bounds), index[first + i]};
+        std::sort(keyed.begin(), keyed.end());
+        for (size_t i = 0; i < n; i++)
+            index[first + i] = keyed[i].second;
+    }
+}
+
+// sort_rays() on the rays themselves.
+inline void sort_rays(std::vector<ray>& rays, const AABB& bounds, size_t batch_size = 0) {
+    std::vector<uint32_t> index(rays.size());
+    for (uint32_t i = 0; i < index.size(); i++) index[i] = i;
+    sort_rays([&](uint32_t i) -> const ray& { return rays[i]; }, index.data(), index.size(), bounds, batch_size);
+
+    std::vector<ray> sorted;
+    sorted.reserve(rays.size());
+    for (uint32_t i : index) sorted.push_back(rays[i]);
+    rays.swap(sorted);
+}
+
+} // namespace rt
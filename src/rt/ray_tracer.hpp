@@ -15,11 +15,19 @@
 #include "camera.hpp"
 #include "material.hpp"
 #include "bvh_node.hpp"
+#include "linear_bvh.hpp"
+#include "treelet_bvh.hpp"
+#include "wide_bvh.hpp"
+#include "quantized_bvh.hpp"
+#include "motion_bvh.hpp"
+#include "instance.hpp"
 #include "texture.hpp"
 #include "quad.hpp"
 #include "constant_medium.hpp"
 #include "benchmark.hpp"
+#include "trace_benchmark.hpp"
 #include "triangle.hpp"
+#include "triangle_mesh.hpp"
 
 // Math
 #include "rtm/ray.hpp"
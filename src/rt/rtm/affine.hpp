@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cmath>
+#include <cassert>
+
+#include "vector.hpp"
+#include "functions.hpp"
+
+namespace rt {
+
+// Affine transform stored as the top three rows of a 4x4 matrix:
+//   | m00 m01 m02 | m03 |
+//   | m10 m11 m12 | m13 |   linear part | translation
+//   | m20 m21 m22 | m23 |
+class affine3f {
+public:
+    float m[3][4];
+
+    affine3f() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+    static affine3f identity() { return affine3f(); }
+
+    static affine3f translation(const vec3f& t) {
+        affine3f a;
+        a.m[0][3] = t.x();
+        a.m[1][3] = t.y();
+        a.m[2][3] = t.z();
+        return a;
+    }
+
+    static affine3f scaling(const vec3f& s) {
+        affine3f a;
+        a.m[0][0] = s.x();
+        a.m[1][1] = s.y();
+        a.m[2][2] = s.z();
+        return a;
+    }
+
+    static affine3f scaling(float s) { return scaling(vec3f(s, s, s)); }
+
+    // Same convention as rotate_y: positive angles turn +x towards -z.
+    static affine3f rotation_y(float angle_degrees) {
+        float radians = degrees_to_radians(angle_degrees);
+        float s = std::sin(radians), c = std::cos(radians);
+        affine3f a;
+        a.m[0][0] = c;  a.m[0][2] = s;
+        a.m[2][0] = -s; a.m[2][2] = c;
+        return a;
+    }
+
+    static affine3f rotation_x(float angle_degrees) {
+        float radians = degrees_to_radians(angle_degrees);
+        float s = std::sin(radians), c = std::cos(radians);
+        affine3f a;
+        a.m[1][1] = c; a.m[1][2] = -s;
+        a.m[2][1] = s; a.m[2][2] = c;
+        return a;
+    }
+
+    static affine3f rotation_z(float angle_degrees) {
+        float radians = degrees_to_radians(angle_degrees);
+        float s = std::sin(radians), c = std::cos(radians);
+        affine3f a;
+        a.m[0][0] = c; a.m[0][1] = -s;
+        a.m[1][0] = s; a.m[1][1] = c;
+        return a;
+    }
+
+    point3f transform_point(const point3f& p) const {
+        return point3f(
+            m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+            m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+            m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    vec3f transform_vector(const vec3f& v) const {
+        return vec3f(
+            m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+            m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+            m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    // Multiplies by the transpose of the linear part. Called on the inverse
+    // transform, this maps object-space normals to world space.
+    vec3f transform_normal(const vec3f& n) const {
+        return vec3f(
+            m[0][0] * n.x() + m[1][0] * n.y() + m[2][0] * n.z(),
+            m[0][1] * n.x() + m[1][1] * n.y() + m[2][1] * n.z(),
+            m[0][2] * n.x() + m[1][2] * n.y() + m[2][2] * n.z());
+    }
+
+    affine3f inverse() const {
+        // Inverse of the 3x3 part by cofactors, then undo the translation.
+        float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+        assert(det != 0.0f && "affine3f is not invertible");
+        float inv_det = 1.0f / det;
+
+        affine3f r;
+        r.m[0][0] = c00 * inv_det;
+        r.m[1][0] = c01 * inv_det;
+        r.m[2][0] = c02 * inv_det;
+        r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+        r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+        r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+        r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+        for (int i = 0; i < 3; i++)
+            r.m[i][3] = -(r.m[i][0] * m[0][3] + r.m[i][1] * m[1][3] + r.m[i][2] * m[2][3]);
+        return r;
+    }
+};
+
+// Composition: (a * b) applies b first, then a.
+inline affine3f operator*(const affine3f& a, const affine3f& b) {
+    affine3f r;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+        }
+        r.m[i][3] += a.m[i][3];
+    }
+    return r;
+}
+
+} // namespace rt
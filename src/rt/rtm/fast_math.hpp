@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include "../def.hpp"
+#include "vec3_soa.hpp"
+
+// Polynomial approximations of the libm functions the renderer calls per
+// hit, for float and for float_lanes<W>; both run the same template code,
+// so the bounds below hold for either. No table lookups, no
+// errno: every function is straight-line code that inlines and vectorizes.
+//
+// Error bounds, measured against double precision libm on 2^24 points over
+// the domain (same for scalar, SSE and AVX, with or without FMA):
+//   log    x > 0                  rel 8.1e-8 (1 ulp); 0 -> -inf, < 0 -> nan,
+//                                 subnormals -> about -88
+//   sin    |x| <= 1e4             abs 1.7e-7
+//   cos    |x| <= 1e4             abs 1.7e-7
+//   acos   |x| <= 1               abs 4.2e-7 rad; |x| > 1 -> nan
+//   atan2  finite y, x            abs 2.8e-7 rad; atan2(0, 0) = 0, and a
+//                                 y of -0 counts as +0
+//   pow5   all x                  rel 2.3e-7 (3 ulp)
+// sqrt has no entry: it is one instruction (sqrtss / sqrtps) already.
+//
+// rt::math below is what the hot paths call: these approximations when
+// RT_FAST_MATH is defined, libm otherwise.
+namespace rt::fast {
+
+namespace detail {
+
+constexpr float pi      = 3.14159265358979f;
+constexpr float half_pi = 1.57079632679490f;
+constexpr float inv_pi  = 0.318309886183791f;
+
+// pi in three parts for Cody-Waite reduction; q * pi_1 is exact for |q| < 2^16
+constexpr float pi_1 = 3.140625f;
+constexpr float pi_2 = 9.67502593994140625e-4f;
+constexpr float pi_3 = 1.509957990978376432e-7f;
+
+FORCE_INLINE float select(bool mask, float a, float b) { return mask ? a : b; }
+FORCE_INLINE float abs(float x)  { return std::fabs(x); }
+FORCE_INLINE float sqrt(float x) { return std::sqrt(x); }
+
+// Nearest integer for |x| < 2^22, by adding and removing 1.5 * 2^23
+template <typename F>
+FORCE_INLINE F round_nearest(F x) { return (x + F(12582912.0f)) - F(12582912.0f); }
+
+// floor(q / 2) * 2 == q for even integers q, as 0 or 1
+template <typename F>
+FORCE_INLINE F parity(F q) {
+    F half = q * F(0.5f);
+    F floor_half = round_nearest(half);
+    floor_half = select(floor_half > half, floor_half - F(1.0f), floor_half);
+    return (half - floor_half) * F(2.0f);
+}
+
+// x = m * 2^e with m in [1, 2), for positive normal x
+FORCE_INLINE float split_exponent(float x, float& e) {
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    e = static_cast<float>(static_cast<int32_t>((bits >> 23) & 0xff) - 127);
+    bits = (bits & 0x007fffffu) | 0x3f800000u;
+    float m;
+    std::memcpy(&m, &bits, sizeof(m));
+    return m;
+}
+
+template <int W>
+FORCE_INLINE float_lanes<W> split_exponent(const float_lanes<W>& x, float_lanes<W>& e) {
+    float_lanes<W> m;
+    for (int i = 0; i < W; i++) m.v[i] = split_exponent(x.v[i], e.v[i]);
+    return m;
+}
+
+// The SIMD versions convert the masked exponent bits, k * 2^23, to float
+// (exact for 8-bit k) instead of shifting, so AVX needs no AVX2 integer ops.
+#ifdef VECN_HAS_SSE
+FORCE_INLINE float_lanes<4> split_exponent(const float_lanes<4>& x, float_lanes<4>& e) {
+    __m128i bits = _mm_castps_si128(x.v);
+    __m128 k = _mm_cvtepi32_ps(_mm_and_si128(bits, _mm_set1_epi32(0x7f800000)));
+    e = float_lanes<4>(_mm_sub_ps(_mm_mul_ps(k, _mm_set1_ps(1.0f / 8388608.0f)), _mm_set1_ps(127.0f)));
+    return float_lanes<4>(_mm_or_ps(_mm_and_ps(x.v, _mm_castsi128_ps(_mm_set1_epi32(0x007fffff))),
+                                    _mm_set1_ps(1.0f)));
+}
+#endif
+
+#ifdef VECN_HAS_AVX
+FORCE_INLINE float_lanes<8> split_exponent(const float_lanes<8>& x, float_lanes<8>& e) {
+    __m256 k = _mm256_cvtepi32_ps(_mm256_castps_si256(
+        _mm256_and_ps(x.v, _mm256_castsi256_ps(_mm256_set1_epi32(0x7f800000)))));
+    e = float_lanes<8>(_mm256_sub_ps(_mm256_mul_ps(k, _mm256_set1_ps(1.0f / 8388608.0f)), _mm256_set1_ps(127.0f)));
+    return float_lanes<8>(_mm256_or_ps(_mm256_and_ps(x.v, _mm256_castsi256_ps(_mm256_set1_epi32(0x007fffff))),
+                                       _mm256_set1_ps(1.0f)));
+}
+#endif
+
+#ifdef VECN_HAS_GNU_VECTORS
+FORCE_INLINE float_lanes<8> split_exponent(const float_lanes<8>& x, float_lanes<8>& e) {
+    using bits_type = mask_lanes<8>::vector_type;
+    using lanes_type = float_lanes<8>::vector_type;
+    bits_type bits = reinterpret_cast<bits_type>(x.v);
+    lanes_type k = __builtin_convertvector(bits & 0x7f800000, lanes_type);
+    e = float_lanes<8>(k * (1.0f / 8388608.0f) - 127.0f);
+    return float_lanes<8>(reinterpret_cast<lanes_type>((bits & 0x007fffff) | 0x3f800000));
+}
+#endif
+
+// Cephes logf: log(1 + f) for f in [sqrt(1/2) - 1, sqrt(2) - 1]
+template <typename F>
+FORCE_INLINE F log(F x) {
+    F e;
+    F m = split_exponent(x, e);
+    auto big = m > F(1.41421356f);
+    m = select(big, m * F(0.5f), m);
+    e = select(big, e + F(1.0f), e);
+
+    F f = m - F(1.0f);
+    F z = f * f;
+    F y = F(7.0376836292e-2f);
+    y = y * f + F(-1.1514610310e-1f);
+    y = y * f + F(1.1676998740e-1f);
+    y = y * f + F(-1.2420140846e-1f);
+    y = y * f + F(1.4249322787e-1f);
+    y = y * f + F(-1.6668057665e-1f);
+    y = y * f + F(2.0000714765e-1f);
+    y = y * f + F(-2.4999993993e-1f);
+    y = y * f + F(3.3333331174e-1f);
+    y = y * f * z;
+    // ln 2 = 0.693359375 - 2.12194440e-4, the first part exact in e * part
+    y = y + e * F(-2.12194440e-4f) - F(0.5f) * z;
+    F r = f + y + e * F(0.693359375f);
+
+    constexpr float inf = std::numeric_limits<float>::infinity();
+    constexpr float nan = std::numeric_limits<float>::quiet_NaN();
+    r = select(x == F(inf), F(inf), r);
+    return select(x > F(0.0f), r, select(x == F(0.0f), F(-inf), F(nan)));
+}
+
+// sin(r) for |r| <= pi/2: Taylor series to r^11, truncation below 6e-8
+template <typename F>
+FORCE_INLINE F sin_reduced(F r) {
+    F r2 = r * r;
+    F p = F(-2.50521083854e-8f);
+    p = p * r2 + F(2.75573192240e-6f);
+    p = p * r2 + F(-1.98412698413e-4f);
+    p = p * r2 + F(8.33333333333e-3f);
+    p = p * r2 + F(-1.66666666667e-1f);
+    return r + r * r2 * p;
+}
+
+// r = x - k * pi in three steps
+template <typename F>
+FORCE_INLINE F reduce_pi(F x, F k) {
+    return ((x - k * F(pi_1)) - k * F(pi_2)) - k * F(pi_3);
+}
+
+template <typename F>
+FORCE_INLINE F sin(F x) {
+    // sin(x) = (-1)^q sin(x - q pi)
+    F q = round_nearest(x * F(inv_pi));
+    F s = sin_reduced(reduce_pi(x, q));
+    return s - F(2.0f) * parity(q) * s;
+}
+
+template <typename F>
+FORCE_INLINE F cos(F x) {
+    // cos(x) = sin(x + pi/2) = (-1)^n sin(x - (n - 1/2) pi)
+    F n = round_nearest(x * F(inv_pi) + F(0.5f));
+    F s = sin_reduced(reduce_pi(x, n - F(0.5f)));
+    return s - F(2.0f) * parity(n) * s;
+}
+
+// Abramowitz and Stegun 4.4.46
+template <typename F>
+FORCE_INLINE F acos(F x) {
+    F ax = abs(x);
+    F p = F(-0.0012624911f);
+    p = p * ax + F(0.0066700901f);
+    p = p * ax + F(-0.0170881256f);
+    p = p * ax + F(0.0308918810f);
+    p = p * ax + F(-0.0501743046f);
+    p = p * ax + F(0.0889789874f);
+    p = p * ax + F(-0.2145988016f);
+    p = p * ax + F(1.5707963050f);
+    F r = sqrt(F(1.0f) - ax) * p;
+    return select(x < F(0.0f), F(pi) - r, r);
+}
+
+// Cephes atanf for t in [0, 1]: above tan(pi/8), atan(t) = pi/4 + atan((t - 1) / (t + 1))
+template <typename F>
+FORCE_INLINE F atan_unit(F t) {
+    auto big = t > F(0.414213562373f);
+    F z = select(big, (t - F(1.0f)) / (t + F(1.0f)), t);
+    F z2 = z * z;
+    F p = F(8.05374449538e-2f);
+    p = p * z2 + F(-1.38776856032e-1f);
+    p = p * z2 + F(1.99777106478e-1f);
+    p = p * z2 + F(-3.33329491539e-1f);
+    return select(big, F(0.25f * pi), F(0.0f)) + (z + z * z2 * p);
+}
+
+template <typename F>
+FORCE_INLINE F atan2(F y, F x) {
+    F ax = abs(x), ay = abs(y);
+    auto steep = ay > ax;
+    F num = select(steep, ax, ay);
+    F den = select(steep, ay, ax);
+    F t = select(den > F(0.0f), num / den, F(0.0f));
+    F a = atan_unit(t);
+    a = select(steep, F(half_pi) - a, a);
+    a = select(x < F(0.0f), F(pi) - a, a);
+    return select(y < F(0.0f), -a, a);
+}
+
+} // namespace detail
+
+// See the table at the top for the domains and error bounds.
+FORCE_INLINE float log(float x)             { return detail::log(x); }
+FORCE_INLINE float sin(float x)             { return detail::sin(x); }
+FORCE_INLINE float cos(float x)             { return detail::cos(x); }
+FORCE_INLINE float acos(float x)            { return detail::acos(x); }
+FORCE_INLINE float atan2(float y, float x)  { return detail::atan2(y, x); }
+FORCE_INLINE float pow5(float x)            { float x2 = x * x; return x2 * x2 * x; }
+
+template <int W> FORCE_INLINE float_lanes<W> log(const float_lanes<W>& x)   { return detail::log(x); }
+template <int W> FORCE_INLINE float_lanes<W> sin(const float_lanes<W>& x)   { return detail::sin(x); }
+template <int W> FORCE_INLINE float_lanes<W> cos(const float_lanes<W>& x)   { return detail::cos(x); }
+template <int W> FORCE_INLINE float_lanes<W> acos(const float_lanes<W>& x)  { return detail::acos(x); }
+template <int W> FORCE_INLINE float_lanes<W> atan2(const float_lanes<W>& y, const float_lanes<W>& x) {
+    return detail::atan2(y, x);
+}
+template <int W> FORCE_INLINE float_lanes<W> pow5(const float_lanes<W>& x) {
+    float_lanes<W> x2 = x * x;
+    return x2 * x2 * x;
+}
+
+} // namespace rt::fast
+
+namespace rt::math {
+#ifdef RT_FAST_MATH
+FORCE_INLINE float log(float x)             { return fast::log(x); }
+FORCE_INLINE float sin(float x)             { return fast::sin(x); }
+FORCE_INLINE float cos(float x)             { return fast::cos(x); }
+FORCE_INLINE float acos(float x)            { return fast::acos(x); }
+FORCE_INLINE float atan2(float y, float x)  { return fast::atan2(y, x); }
+FORCE_INLINE float pow5(float x)            { return fast::pow5(x); }
+#else
+FORCE_INLINE float log(float x)             { return std::log(x); }
+FORCE_INLINE float sin(float x)             { return std::sin(x); }
+FORCE_INLINE float cos(float x)             { return std::cos(x); }
+FORCE_INLINE float acos(float x)            { return std::acos(x); }
+FORCE_INLINE float atan2(float y, float x)  { return std::atan2(y, x); }
+// std::pow(float, int) computes in double; rounded back so callers compute
+// in float in every configuration
+FORCE_INLINE float pow5(float x)            { return static_cast<float>(std::pow(x, 5)); }
+#endif
+} // namespace rt::math
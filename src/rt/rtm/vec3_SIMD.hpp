@@ -1,6 +1,7 @@
 #pragma once
 
-#include "VecN.hpp"  // Include the base VecN implementation
+#include "vecN.hpp"  // Include the base VecN implementation
+#include "vec3_m128.hpp"
 
 // SIMD capability detection
 #ifdef _MSC_VER
@@ -87,239 +88,104 @@ namespace simd_utils {
 } // namespace simd_utils::
 
 #ifdef VECN_HAS_SSE
-// 16 bytes alignment
-template<> class alignas(16) VecN<float, 3> {
-private:
-    std::array<float, 3> e;
-    friend class VecN;
+// VecN<float, 3> stored as a vec3_m128: the value lives in an __m128 with a
+// padding lane, and the operators below forward to the register versions so
+// chained expressions never go back through memory.
+template<> class VecN<float, 3> : public vec3_m128 {
+    template <typename, size_t> friend class VecN;
 public:
 #if defined(_MSC_VER)
 #pragma region _constructors_
 #endif
     // Constructors
-    constexpr VecN() : e{0.0f, 0.0f, 0.0f} {}
-    constexpr VecN(float value) : e{value, value, value}{}
-    constexpr VecN(float x, float y, float z) : e{x, y, z} {}
-    constexpr VecN(const std::array<float, 3>& arr) : e(arr) {}
-    constexpr VecN(const float arr[3]) : e{arr[0], arr[1], arr[2]}{}
-    constexpr VecN(const VecN<float, 3>& other) : e(other.e) {}
-#if defined(_MSC_VER)
-#pragma endregion // Constructors Definition
-#endif
-    constexpr float x() const noexcept { return e[0];}
-    constexpr float y() const noexcept { return e[1];}
-    constexpr float z() const noexcept { return e[2];}
-    constexpr float r() const noexcept { return e[0];}
-    constexpr float g() const noexcept { return e[1];}
-    constexpr float b() const noexcept { return e[2];}
-
-    float& operator[](size_t i) {
-        assert(i < 3 && "Index out of bounds");
-        return e[i];
-    }
-
-    const float& operator[](size_t i) const {
-        assert(i < 3 && "Index out of bounds");
-        return e[i];
-    }
-
-    float* data() noexcept { return e.data(); }
-    const float* data() const noexcept { return e.data(); }
-
-    // === UNARY OPERATORS ===
-    VecN& operator=(const VecN&) = default;
-
-    // Operations implemented with SIMD
-    // ps = single precision floating point
-    // pd = double precision floating point
-    VecN<float, 3> operator-() const noexcept
-    {
-        __m128 v = simd_utils::load_vec3(e.data());
-        __m128 zero = _mm_setzero_ps();
-        __m128 result = _mm_sub_ps(zero, v);
+    VecN() = default;
+    VecN(const vec3_m128& v) : vec3_m128(v) {}
+    explicit VecN(float value) : vec3_m128(value) {}
 
-        VecN<float, 3> ret;
-        simd_utils::store_vec3(result, ret.data());
-        return ret;
-    }
+    template<typename X, typename Y, typename Z,
+         typename = typename std::enable_if<(std::conjunction<std::is_convertible<X, float>,
+                                                              std::is_convertible<Y, float>,
+                                                              std::is_convertible<Z, float>>::value)>::type>
+    explicit VecN(X x, Y y, Z z) : vec3_m128(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)) {}
 
-    VecN<float, 3>& operator+=(const VecN<float, 3>& other) noexcept
+    explicit VecN(std::initializer_list<float> init_list)
     {
-        __m128 a = simd_utils::load_vec3(e.data());
-        __m128 b = simd_utils::load_vec3(other.data());
-        __m128 result = _mm_add_ps(a, b);
-        simd_utils::store_vec3(result, e.data());
-        return *this;
-    }
-
-    VecN<float, 3>& operator-=(const VecN<float, 3>& other) noexcept {
-        __m128 a = simd_utils::load_vec3(e.data());
-        __m128 b = simd_utils::load_vec3(other.data());
-        __m128 result = _mm_sub_ps(a, b);
-        simd_utils::store_vec3(result, e.data());
-        return *this;
+        if (init_list.size() != 3)
+            throw std::invalid_argument("Initializer list size must match vector dimension");
+        std::copy(init_list.begin(), init_list.end(), e);
     }
 
-    /// @brief Hadamard product
-    VecN<float, 3>& operator*=(const VecN<float, 3>& other) noexcept
+    explicit VecN(const float (&arr)[3]) : vec3_m128(arr[0], arr[1], arr[2]) {}
+    explicit VecN(const float* arr)
     {
-        __m128 a = simd_utils::load_vec3(e.data());
-        __m128 b = simd_utils::load_vec3(other.data());
-        __m128 result = _mm_mul_ps(a, b);   // element by element mult
-        simd_utils::store_vec3(result, e.data());
-        return *this;
-    }
-
-    VecN<float, 3>& operator*=(float scalar) noexcept
-    {
-        __m128 v = simd_utils::load_vec3(e.data());
-        __m128 s = simd_utils::load_scalar(scalar);
-        __m128 result = _mm_mul_ps(v, s);
-        simd_utils::store_vec3(result, e.data());
-        return *this;
-    }
-
-    VecN<float, 3>& operator/=(float scalar) {
-        if (nearlyEqual(scalar, 0.0f))
-            throw std::invalid_argument("Division by zero");
-        
-        __m128 v = simd_utils::load_vec3(e.data());
-        __m128 s = _mm_set1_ps(1.0f / scalar);
-        __m128 result = _mm_mul_ps(v, s);
-        simd_utils::store_vec3(result, e.data());
-        return *this;
-    }
-
-    [[nodiscard]] 
-    float length() const noexcept {
-        return std::sqrt(length_squared());
+        if (arr == nullptr)
+            throw std::invalid_argument("Null pointer passed to VecN constructor");
+        v = _mm_set_ps(0.0f, arr[2], arr[1], arr[0]);
     }
+    explicit VecN(const std::array<float, 3>& arr) : vec3_m128(arr[0], arr[1], arr[2]) {}
 
-    [[nodiscard]] 
-    float length_squared() const noexcept {
-        __m128 v = simd_utils::load_vec3(e.data());
-        __m128 sq = _mm_mul_ps(v, v);
-        return simd_utils::horizontal_sum_sse(sq);
-    }
-
-    bool near_zero() const {
-        constexpr float epsilon = std::numeric_limits<float>::epsilon();
-        return (nearlyEqual(e[0], 0.0f)) && 
-               (nearlyEqual(e[1], 0.0f)) && 
-               (nearlyEqual(e[2], 0.0f));
-    }
+    template <typename U>
+    explicit VecN(const VecN<U, 3>& other)
+        : vec3_m128(static_cast<float>(other.e[0]), static_cast<float>(other.e[1]), static_cast<float>(other.e[2])) {}
+#if defined(_MSC_VER)
+#pragma endregion // Constructors Definition
+#endif
 
-    static VecN<float, 3> random()
-    {
-        VecN<float, 3> result;
-        for (size_t i = 0; i < 3; ++i) {
-            result[i] = random_real<float>();
-        }
-        return result;
-    }
+    // === UNARY OPERATORS ===
+    VecN operator-() const noexcept { return vec3_m128::operator-(); }
 
-    static VecN<float, 3> random(float a, float b)
-    {
-        VecN<float, 3> result;
-        for (size_t i = 0; i < 3; ++i) {
-            result[i] = random_real<float>(a, b);
-        }
-        return result;
-    }
+    VecN& operator+=(const VecN& other) noexcept { vec3_m128::operator+=(other); return *this; }
+    VecN& operator-=(const VecN& other) noexcept { vec3_m128::operator-=(other); return *this; }
+    /// @brief Hadamard product
+    VecN& operator*=(const VecN& other) noexcept { vec3_m128::operator*=(other); return *this; }
+    VecN& operator*=(float scalar) noexcept { vec3_m128::operator*=(scalar); return *this; }
+    // No zero check: dividing by zero gives inf/nan as in scalar code
+    VecN& operator/=(float scalar) noexcept { vec3_m128::operator/=(scalar); return *this; }
 
-    static constexpr size_t dimension() noexcept { return 3; }
+    static VecN random() { return vec3_m128::random(); }
+    static VecN random(float a, float b) { return vec3_m128::random(a, b); }
 };
 
-// SIMD operators for Vec3<float>
+// Non-template overloads win over the generic VecN templates for float
+// vectors, so every vec3f expression runs on the register type.
 inline VecN<float, 3> operator+(const VecN<float, 3>& a, const VecN<float, 3>& b) noexcept {
-    __m128 va = simd_utils::load_vec3(a.data());
-    __m128 vb = simd_utils::load_vec3(b.data());
-    __m128 result = _mm_add_ps(va, vb);
-    
-    VecN<float, 3> ret;
-    simd_utils::store_vec3(result, ret.data());
-    return ret;
+    return static_cast<const vec3_m128&>(a) + static_cast<const vec3_m128&>(b);
 }
 
 inline VecN<float, 3> operator-(const VecN<float, 3>& a, const VecN<float, 3>& b) noexcept {
-    __m128 va = simd_utils::load_vec3(a.data());
-    __m128 vb = simd_utils::load_vec3(b.data());
-    __m128 result = _mm_sub_ps(va, vb);
-    
-    VecN<float, 3> ret;
-    simd_utils::store_vec3(result, ret.data());
-    return ret;
+    return static_cast<const vec3_m128&>(a) - static_cast<const vec3_m128&>(b);
 }
 
 inline VecN<float, 3> operator*(const VecN<float, 3>& a, const VecN<float, 3>& b) noexcept {
-    __m128 va = simd_utils::load_vec3(a.data());
-    __m128 vb = simd_utils::load_vec3(b.data());
-    __m128 result = _mm_mul_ps(va, vb);
-    
-    VecN<float, 3> ret;
-    simd_utils::store_vec3(result, ret.data());
-    return ret;
+    return static_cast<const vec3_m128&>(a) * static_cast<const vec3_m128&>(b);
 }
 
-inline VecN<float, 3> operator*(float scalar, const VecN<float, 3>& v) noexcept {
-    __m128 vv = simd_utils::load_vec3(v.data());
-    __m128 s = _mm_set1_ps(scalar);
-    __m128 result = _mm_mul_ps(vv, s);
-    
-    VecN<float, 3> ret;
-    simd_utils::store_vec3(result, ret.data());
-    return ret;
+template <typename S, typename = typename std::enable_if<std::is_arithmetic<S>::value>::type>
+inline VecN<float, 3> operator*(S scalar, const VecN<float, 3>& v) noexcept {
+    return static_cast<float>(scalar) * static_cast<const vec3_m128&>(v);
 }
 
-inline VecN<float, 3> operator*(const VecN<float, 3>& v, float scalar) noexcept {
-    return scalar * v;
+template <typename S, typename = typename std::enable_if<std::is_arithmetic<S>::value>::type>
+inline VecN<float, 3> operator*(const VecN<float, 3>& v, S scalar) noexcept {
+    return static_cast<float>(scalar) * static_cast<const vec3_m128&>(v);
 }
 
-inline VecN<float, 3> operator/(const VecN<float, 3>& v, float scalar) {
-    if (nearlyEqual(scalar, 0.0f))
-        throw std::invalid_argument("Division by zero");
-    
-    __m128 vv = simd_utils::load_vec3(v.data());
-    __m128 s = _mm_set1_ps(1.0f / scalar);
-    __m128 result = _mm_mul_ps(vv, s);
-    
-    VecN<float, 3> ret;
-    simd_utils::store_vec3(result, ret.data());
-    return ret;
+// No zero check, see vec3_m128
+template <typename S, typename = typename std::enable_if<std::is_arithmetic<S>::value>::type>
+inline VecN<float, 3> operator/(const VecN<float, 3>& v, S scalar) noexcept {
+    return static_cast<const vec3_m128&>(v) / static_cast<float>(scalar);
 }
 
-// SIMD dot product
 [[nodiscard]]
 inline float dot(const VecN<float, 3>& a, const VecN<float, 3>& b) noexcept {
-    __m128 va = simd_utils::load_vec3(a.data());
-    __m128 vb = simd_utils::load_vec3(b.data());
-    __m128 mul = _mm_mul_ps(va, vb);
-    return simd_utils::horizontal_sum_sse(mul);
+    return dot(static_cast<const vec3_m128&>(a), static_cast<const vec3_m128&>(b));
 }
 
-// SIMD cross product
 [[nodiscard]]
 inline VecN<float, 3> cross(const VecN<float, 3>& a, const VecN<float, 3>& b) noexcept {
-    __m128 va = simd_utils::load_vec3(a.data());
-    __m128 vb = simd_utils::load_vec3(b.data());
-    
-    // a.yzx
-    __m128 a_yzx = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1));
-    // b.zxy  
-    __m128 b_zxy = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 1, 0, 2));
-    // a.zxy
-    __m128 a_zxy = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 1, 0, 2));
-    // b.yzx
-    __m128 b_yzx = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
-    
-    __m128 result = _mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx));
-    
-    VecN<float, 3> ret;
-    simd_utils::store_vec3(result, ret.data());
-    return ret;
+    return cross(static_cast<const vec3_m128&>(a), static_cast<const vec3_m128&>(b));
 }
 
 #endif // VECN_HAS_SSE
 
 }
-
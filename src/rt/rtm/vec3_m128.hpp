@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <cassert>
+
+#include "random.hpp"
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+#if defined(__SSE__) || (defined(_M_X64) || defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #define VECN_HAS_SSE 1
+    #include <emmintrin.h>
+#endif
+
+#if defined(__SSE4_1__)
+    #define VECN_HAS_SSE4_1 1
+    #include <smmintrin.h>
+#endif
+
+namespace rt {
+
+#ifdef VECN_HAS_SSE
+// A float 3-vector that lives in one __m128, x, y, z and a padding lane w.
+// Every operator works on the register and returns a register, so chained
+// expressions like a - 2 * dot(a, n) * n stay out of memory; the compiler
+// only spills when it runs out of registers. w is never read back: it may
+// end up as anything (0 * inf is nan), and dot() and length() only sum x, y
+// and z. Division never throws: dividing by zero gives inf or nan like
+// scalar float code does.
+class alignas(16) vec3_m128 {
+public:
+    union {
+        __m128 v;
+        float e[4];
+    };
+
+    vec3_m128() : v(_mm_setzero_ps()) {}
+    explicit vec3_m128(float value) : v(_mm_set_ps(0.0f, value, value, value)) {}
+    vec3_m128(float x, float y, float z) : v(_mm_set_ps(0.0f, z, y, x)) {}
+    explicit vec3_m128(__m128 v) : v(v) {}
+    vec3_m128(const vec3_m128&) = default;
+    vec3_m128& operator=(const vec3_m128&) = default;
+
+    float x() const noexcept { return _mm_cvtss_f32(v); }
+    float y() const noexcept { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))); }
+    float z() const noexcept { return _mm_cvtss_f32(_mm_movehl_ps(v, v)); }
+    float r() const noexcept { return x(); }
+    float g() const noexcept { return y(); }
+    float b() const noexcept { return z(); }
+
+    float& operator[](size_t i) { assert(i < 3 && "Index out of bounds"); return e[i]; }
+    const float& operator[](size_t i) const { assert(i < 3 && "Index out of bounds"); return e[i]; }
+
+    float* data() noexcept { return e; }
+    const float* data() const noexcept { return e; }
+
+    vec3_m128 operator-() const noexcept { return vec3_m128(_mm_xor_ps(v, _mm_set1_ps(-0.0f))); }
+
+    vec3_m128& operator+=(const vec3_m128& o) noexcept { v = _mm_add_ps(v, o.v); return *this; }
+    vec3_m128& operator-=(const vec3_m128& o) noexcept { v = _mm_sub_ps(v, o.v); return *this; }
+    vec3_m128& operator*=(const vec3_m128& o) noexcept { v = _mm_mul_ps(v, o.v); return *this; }
+    vec3_m128& operator*=(float t) noexcept { v = _mm_mul_ps(v, _mm_set1_ps(t)); return *this; }
+    vec3_m128& operator/=(float t) noexcept { v = _mm_mul_ps(v, _mm_set1_ps(1.0f / t)); return *this; }
+
+    [[nodiscard]] float length_squared() const noexcept { return sum(_mm_mul_ps(v, v)); }
+    [[nodiscard]] float length() const noexcept { return std::sqrt(length_squared()); }
+
+    bool near_zero() const noexcept {
+        // |x|, |y| and |z| all below epsilon; w is ignored
+        __m128 abs = _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+        __m128 small = _mm_cmplt_ps(abs, _mm_set1_ps(std::numeric_limits<float>::epsilon()));
+        return (_mm_movemask_ps(small) & 0x7) == 0x7;
+    }
+
+    // Draws in x, y, z order: function arguments have no evaluation order
+    static vec3_m128 random() {
+        float x = random_real<float>();
+        float y = random_real<float>();
+        return vec3_m128(x, y, random_real<float>());
+    }
+    static vec3_m128 random(float min, float max) {
+        float x = random_real<float>(min, max);
+        float y = random_real<float>(min, max);
+        return vec3_m128(x, y, random_real<float>(min, max));
+    }
+
+    static constexpr size_t dimension() noexcept { return 3; }
+
+    // x + y + z of m, added in that order like the scalar loop does
+    static float sum(__m128 m) noexcept {
+        __m128 y = _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1));
+        __m128 z = _mm_movehl_ps(m, m);
+        return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(m, y), z));
+    }
+};
+
+inline vec3_m128 operator+(const vec3_m128& a, const vec3_m128& b) noexcept { return vec3_m128(_mm_add_ps(a.v, b.v)); }
+inline vec3_m128 operator-(const vec3_m128& a, const vec3_m128& b) noexcept { return vec3_m128(_mm_sub_ps(a.v, b.v)); }
+// Hadamard product
+inline vec3_m128 operator*(const vec3_m128& a, const vec3_m128& b) noexcept { return vec3_m128(_mm_mul_ps(a.v, b.v)); }
+inline vec3_m128 operator*(float t, const vec3_m128& a) noexcept { return vec3_m128(_mm_mul_ps(_mm_set1_ps(t), a.v)); }
+inline vec3_m128 operator*(const vec3_m128& a, float t) noexcept { return t * a; }
+// One division and a multiply; no zero check
+inline vec3_m128 operator/(const vec3_m128& a, float t) noexcept { return vec3_m128(_mm_mul_ps(a.v, _mm_set1_ps(1.0f / t))); }
+
+[[nodiscard]]
+inline float dot(const vec3_m128& a, const vec3_m128& b) noexcept { return vec3_m128::sum(_mm_mul_ps(a.v, b.v)); }
+
+[[nodiscard]]
+inline vec3_m128 cross(const vec3_m128& a, const vec3_m128& b) noexcept {
+    // a.yzx * b.zxy - a.zxy * b.yzx
+    __m128 a_yzx = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps(b.v, b.v, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 a_zxy = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 b_zxy = _mm_shuffle_ps(b.v, b.v, _MM_SHUFFLE(3, 1, 0, 2));
+    return vec3_m128(_mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx)));
+}
+
+// Zero vectors become (1, 0, 0), as for VecN
+[[nodiscard]]
+inline vec3_m128 unit_vector(const vec3_m128& a) noexcept {
+    float len = a.length();
+    if (len == 0.0f) return vec3_m128(1.0f, 0.0f, 0.0f);
+    return a / len;
+}
+#endif // VECN_HAS_SSE
+
+} // namespace rt
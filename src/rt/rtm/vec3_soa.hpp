@@ -0,0 +1,420 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+
+#include "vector.hpp"
+
+#if defined(__SSE__) || (defined(_M_X64) || defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #define VECN_HAS_SSE 1
+    #include <emmintrin.h>
+#endif
+
+#if defined(__AVX__)
+    #define VECN_HAS_AVX 1
+    #include <immintrin.h>
+#endif
+
+// Without AVX, GCC and Clang still get 8 lanes as one generic vector
+#if !defined(VECN_HAS_AVX) && defined(VECN_HAS_SSE) && (defined(__GNUC__) || defined(__clang__))
+    #define VECN_HAS_GNU_VECTORS 1
+    #include <cstring>
+#endif
+
+// Structure-of-arrays vectors: W lanes of x, W of y and W of z, one SIMD
+// register per component, so every lane does useful work. float_lanes<W>,
+// mask_lanes<W> and vec3_lanes<W> follow the VecN and vec_functions.hpp API
+// so kernels over 4 or 8 rays or triangles read like the scalar code:
+//
+//     vec3x8 h = cross(d, e2);
+//     floatx8 a = dot(e1, h);
+//     maskx8 valid = abs(a) >= epsilon;
+//
+// W = 4 uses SSE and W = 8 uses AVX when the target has them; every other
+// case falls back to plain loops the compiler may vectorize. A GCC or Clang
+// build without AVX (RT_PORTABLE) holds 8 lanes in a generic vector instead,
+// which the compiler lowers per function: to SSE pairs in baseline code and
+// to AVX in the AVX2 and AVX-512 copies of a dispatch() kernel
+// (cpu_dispatch.hpp). Unlike VecN,
+// division never throws: a lane divided by zero becomes inf or nan, and the
+// masks of the comparisons decide which lanes count.
+namespace rt {
+
+template <int W> struct mask_lanes;
+template <int W> struct float_lanes;
+
+// === PORTABLE LANES ===
+template <int W>
+struct mask_lanes {
+    uint32_t m = 0;     // bit i set: lane i is active
+
+    mask_lanes() = default;
+    explicit mask_lanes(bool all) : m(all ? (W >= 32 ? ~0u : (1u << W) - 1) : 0u) {}
+
+    int bits() const noexcept { return static_cast<int>(m); }
+    bool operator[](int i) const noexcept { return (m >> i) & 1u; }
+
+    friend mask_lanes operator&(mask_lanes a, mask_lanes b) { return from(a.m & b.m); }
+    friend mask_lanes operator|(mask_lanes a, mask_lanes b) { return from(a.m | b.m); }
+    friend mask_lanes operator^(mask_lanes a, mask_lanes b) { return from(a.m ^ b.m); }
+    mask_lanes operator~() const { return from(~m & mask_lanes(true).m); }
+
+    static mask_lanes from(uint32_t bits) { mask_lanes r; r.m = bits; return r; }
+};
+
+template <int W>
+struct alignas(32) float_lanes {
+    float v[W];
+
+    float_lanes() : v{} {}
+    float_lanes(float s) { std::fill(v, v + W, s); }
+
+    static float_lanes load(const float* p)  { float_lanes r; std::copy(p, p + W, r.v); return r; }
+    static float_lanes loadu(const float* p) { return load(p); }
+    void store(float* p) const  { std::copy(v, v + W, p); }
+    void storeu(float* p) const { store(p); }
+
+    float operator[](int i) const noexcept { return v[i]; }
+
+    template <typename F>
+    static float_lanes map(const float_lanes& a, const float_lanes& b, F f) {
+        float_lanes r;
+        for (int i = 0; i < W; i++) r.v[i] = f(a.v[i], b.v[i]);
+        return r;
+    }
+    template <typename F>
+    static mask_lanes<W> test(const float_lanes& a, const float_lanes& b, F f) {
+        uint32_t bits = 0;
+        for (int i = 0; i < W; i++) bits |= uint32_t(f(a.v[i], b.v[i])) << i;
+        return mask_lanes<W>::from(bits);
+    }
+
+    float_lanes operator-() const { return map(*this, *this, [](float a, float) { return -a; }); }
+    friend float_lanes operator+(const float_lanes& a, const float_lanes& b) { return map(a, b, [](float x, float y) { return x + y; }); }
+    friend float_lanes operator-(const float_lanes& a, const float_lanes& b) { return map(a, b, [](float x, float y) { return x - y; }); }
+    friend float_lanes operator*(const float_lanes& a, const float_lanes& b) { return map(a, b, [](float x, float y) { return x * y; }); }
+    friend float_lanes operator/(const float_lanes& a, const float_lanes& b) { return map(a, b, [](float x, float y) { return x / y; }); }
+
+    friend mask_lanes<W> operator<(const float_lanes& a, const float_lanes& b)  { return test(a, b, [](float x, float y) { return x < y; }); }
+    friend mask_lanes<W> operator<=(const float_lanes& a, const float_lanes& b) { return test(a, b, [](float x, float y) { return x <= y; }); }
+    friend mask_lanes<W> operator>(const float_lanes& a, const float_lanes& b)  { return test(a, b, [](float x, float y) { return x > y; }); }
+    friend mask_lanes<W> operator>=(const float_lanes& a, const float_lanes& b) { return test(a, b, [](float x, float y) { return x >= y; }); }
+    friend mask_lanes<W> operator==(const float_lanes& a, const float_lanes& b) { return test(a, b, [](float x, float y) { return x == y; }); }
+    friend mask_lanes<W> operator!=(const float_lanes& a, const float_lanes& b) { return test(a, b, [](float x, float y) { return x != y; }); }
+
+    friend float_lanes min(const float_lanes& a, const float_lanes& b) { return map(a, b, [](float x, float y) { return y < x ? y : x; }); }
+    friend float_lanes max(const float_lanes& a, const float_lanes& b) { return map(a, b, [](float x, float y) { return y > x ? y : x; }); }
+    friend float_lanes abs(const float_lanes& a)  { return map(a, a, [](float x, float) { return std::fabs(x); }); }
+    friend float_lanes sqrt(const float_lanes& a) { return map(a, a, [](float x, float) { return std::sqrt(x); }); }
+
+    // a where mask is set, b elsewhere
+    friend float_lanes select(const mask_lanes<W>& mask, const float_lanes& a, const float_lanes& b) {
+        float_lanes r;
+        for (int i = 0; i < W; i++) r.v[i] = mask[i] ? a.v[i] : b.v[i];
+        return r;
+    }
+};
+
+// === SSE: 4 LANES ===
+#ifdef VECN_HAS_SSE
+template <>
+struct mask_lanes<4> {
+    __m128 m = _mm_setzero_ps();    // all bits set in active lanes
+
+    mask_lanes() = default;
+    explicit mask_lanes(bool all) : m(all ? _mm_castsi128_ps(_mm_set1_epi32(-1)) : _mm_setzero_ps()) {}
+    explicit mask_lanes(__m128 m) : m(m) {}
+
+    int bits() const noexcept { return _mm_movemask_ps(m); }
+    bool operator[](int i) const noexcept { return (bits() >> i) & 1; }
+
+    friend mask_lanes operator&(mask_lanes a, mask_lanes b) { return mask_lanes(_mm_and_ps(a.m, b.m)); }
+    friend mask_lanes operator|(mask_lanes a, mask_lanes b) { return mask_lanes(_mm_or_ps(a.m, b.m)); }
+    friend mask_lanes operator^(mask_lanes a, mask_lanes b) { return mask_lanes(_mm_xor_ps(a.m, b.m)); }
+    mask_lanes operator~() const { return mask_lanes(_mm_xor_ps(m, mask_lanes(true).m)); }
+};
+
+template <>
+struct float_lanes<4> {
+    __m128 v;
+
+    float_lanes() : v(_mm_setzero_ps()) {}
+    float_lanes(float s) : v(_mm_set1_ps(s)) {}
+    explicit float_lanes(__m128 v) : v(v) {}
+
+    static float_lanes load(const float* p)  { return float_lanes(_mm_load_ps(p)); }
+    static float_lanes loadu(const float* p) { return float_lanes(_mm_loadu_ps(p)); }
+    void store(float* p) const  { _mm_store_ps(p, v); }
+    void storeu(float* p) const { _mm_storeu_ps(p, v); }
+
+    float operator[](int i) const noexcept { alignas(16) float f[4]; _mm_store_ps(f, v); return f[i]; }
+
+    float_lanes operator-() const { return float_lanes(_mm_xor_ps(v, _mm_set1_ps(-0.0f))); }
+    friend float_lanes operator+(const float_lanes& a, const float_lanes& b) { return float_lanes(_mm_add_ps(a.v, b.v)); }
+    friend float_lanes operator-(const float_lanes& a, const float_lanes& b) { return float_lanes(_mm_sub_ps(a.v, b.v)); }
+    friend float_lanes operator*(const float_lanes& a, const float_lanes& b) { return float_lanes(_mm_mul_ps(a.v, b.v)); }
+    friend float_lanes operator/(const float_lanes& a, const float_lanes& b) { return float_lanes(_mm_div_ps(a.v, b.v)); }
+
+    friend mask_lanes<4> operator<(const float_lanes& a, const float_lanes& b)  { return mask_lanes<4>(_mm_cmplt_ps(a.v, b.v)); }
+    friend mask_lanes<4> operator<=(const float_lanes& a, const float_lanes& b) { return mask_lanes<4>(_mm_cmple_ps(a.v, b.v)); }
+    friend mask_lanes<4> operator>(const float_lanes& a, const float_lanes& b)  { return mask_lanes<4>(_mm_cmpgt_ps(a.v, b.v)); }
+    friend mask_lanes<4> operator>=(const float_lanes& a, const float_lanes& b) { return mask_lanes<4>(_mm_cmpge_ps(a.v, b.v)); }
+    friend mask_lanes<4> operator==(const float_lanes& a, const float_lanes& b) { return mask_lanes<4>(_mm_cmpeq_ps(a.v, b.v)); }
+    friend mask_lanes<4> operator!=(const float_lanes& a, const float_lanes& b) { return mask_lanes<4>(_mm_cmpneq_ps(a.v, b.v)); }
+
+    // Operands swapped so that min(a, b) and max(a, b) give a when either is
+    // nan, as the portable y < x ? y : x does
+    friend float_lanes min(const float_lanes& a, const float_lanes& b) { return float_lanes(_mm_min_ps(b.v, a.v)); }
+    friend float_lanes max(const float_lanes& a, const float_lanes& b) { return float_lanes(_mm_max_ps(b.v, a.v)); }
+    friend float_lanes abs(const float_lanes& a)  { return float_lanes(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)); }
+    friend float_lanes sqrt(const float_lanes& a) { return float_lanes(_mm_sqrt_ps(a.v)); }
+
+    friend float_lanes select(const mask_lanes<4>& mask, const float_lanes& a, const float_lanes& b) {
+        return float_lanes(_mm_or_ps(_mm_and_ps(mask.m, a.v), _mm_andnot_ps(mask.m, b.v)));
+    }
+};
+#endif
+
+// === AVX: 8 LANES ===
+#ifdef VECN_HAS_AVX
+template <>
+struct mask_lanes<8> {
+    __m256 m = _mm256_setzero_ps();
+
+    mask_lanes() = default;
+    explicit mask_lanes(bool all) : m(all ? _mm256_castsi256_ps(_mm256_set1_epi32(-1)) : _mm256_setzero_ps()) {}
+    explicit mask_lanes(__m256 m) : m(m) {}
+
+    int bits() const noexcept { return _mm256_movemask_ps(m); }
+    bool operator[](int i) const noexcept { return (bits() >> i) & 1; }
+
+    friend mask_lanes operator&(mask_lanes a, mask_lanes b) { return mask_lanes(_mm256_and_ps(a.m, b.m)); }
+    friend mask_lanes operator|(mask_lanes a, mask_lanes b) { return mask_lanes(_mm256_or_ps(a.m, b.m)); }
+    friend mask_lanes operator^(mask_lanes a, mask_lanes b) { return mask_lanes(_mm256_xor_ps(a.m, b.m)); }
+    mask_lanes operator~() const { return mask_lanes(_mm256_xor_ps(m, mask_lanes(true).m)); }
+};
+
+template <>
+struct float_lanes<8> {
+    __m256 v;
+
+    float_lanes() : v(_mm256_setzero_ps()) {}
+    float_lanes(float s) : v(_mm256_set1_ps(s)) {}
+    explicit float_lanes(__m256 v) : v(v) {}
+
+    static float_lanes load(const float* p)  { return float_lanes(_mm256_load_ps(p)); }
+    static float_lanes loadu(const float* p) { return float_lanes(_mm256_loadu_ps(p)); }
+    void store(float* p) const  { _mm256_store_ps(p, v); }
+    void storeu(float* p) const { _mm256_storeu_ps(p, v); }
+
+    float operator[](int i) const noexcept { alignas(32) float f[8]; _mm256_store_ps(f, v); return f[i]; }
+
+    float_lanes operator-() const { return float_lanes(_mm256_xor_ps(v, _mm256_set1_ps(-0.0f))); }
+    friend float_lanes operator+(const float_lanes& a, const float_lanes& b) { return float_lanes(_mm256_add_ps(a.v, b.v)); }
+    friend float_lanes operator-(const float_lanes& a, const float_lanes& b) { return float_lanes(_mm256_sub_ps(a.v, b.v)); }
+    friend float_lanes operator*(const float_lanes& a, const float_lanes& b) { return float_lanes(_mm256_mul_ps(a.v, b.v)); }
+    friend float_lanes operator/(const float_lanes& a, const float_lanes& b) { return float_lanes(_mm256_div_ps(a.v, b.v)); }
+
+    friend mask_lanes<8> operator<(const float_lanes& a, const float_lanes& b)  { return mask_lanes<8>(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+    friend mask_lanes<8> operator<=(const float_lanes& a, const float_lanes& b) { return mask_lanes<8>(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)); }
+    friend mask_lanes<8> operator>(const float_lanes& a, const float_lanes& b)  { return mask_lanes<8>(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+    friend mask_lanes<8> operator>=(const float_lanes& a, const float_lanes& b) { return mask_lanes<8>(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)); }
+    friend mask_lanes<8> operator==(const float_lanes& a, const float_lanes& b) { return mask_lanes<8>(_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)); }
+    friend mask_lanes<8> operator!=(const float_lanes& a, const float_lanes& b) { return mask_lanes<8>(_mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ)); }
+
+    friend float_lanes min(const float_lanes& a, const float_lanes& b) { return float_lanes(_mm256_min_ps(b.v, a.v)); }
+    friend float_lanes max(const float_lanes& a, const float_lanes& b) { return float_lanes(_mm256_max_ps(b.v, a.v)); }
+    friend float_lanes abs(const float_lanes& a)  { return float_lanes(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)); }
+    friend float_lanes sqrt(const float_lanes& a) { return float_lanes(_mm256_sqrt_ps(a.v)); }
+
+    friend float_lanes select(const mask_lanes<8>& mask, const float_lanes& a, const float_lanes& b) {
+        return float_lanes(_mm256_blendv_ps(b.v, a.v, mask.m));
+    }
+};
+#endif
+
+// === GCC VECTORS: 8 LANES WITHOUT AVX ===
+#ifdef VECN_HAS_GNU_VECTORS
+template <>
+struct mask_lanes<8> {
+    typedef int32_t vector_type __attribute__((vector_size(32)));
+    vector_type m{};    // all bits set in active lanes
+
+    mask_lanes() = default;
+    explicit mask_lanes(bool all) : m(vector_type{} - (all ? 1 : 0)) {}
+    explicit mask_lanes(const vector_type& m) : m(m) {}
+
+    // One movemask per 4-lane half; baseline SSE has no wider one
+    int bits() const noexcept {
+        __m128 half[2];
+        std::memcpy(half, &m, sizeof(m));
+        return _mm_movemask_ps(half[0]) | (_mm_movemask_ps(half[1]) << 4);
+    }
+    bool operator[](int i) const noexcept { return m[i] != 0; }
+
+    friend mask_lanes operator&(mask_lanes a, mask_lanes b) { return mask_lanes(a.m & b.m); }
+    friend mask_lanes operator|(mask_lanes a, mask_lanes b) { return mask_lanes(a.m | b.m); }
+    friend mask_lanes operator^(mask_lanes a, mask_lanes b) { return mask_lanes(a.m ^ b.m); }
+    mask_lanes operator~() const { return mask_lanes(~m); }
+};
+
+template <>
+struct alignas(32) float_lanes<8> {
+    typedef float vector_type __attribute__((vector_size(32)));
+    vector_type v;
+
+    float_lanes() : v{} {}
+    float_lanes(float s) : v(vector_type{} + s) {}
+    explicit float_lanes(const vector_type& v) : v(v) {}
+
+    static float_lanes load(const float* p)  { float_lanes r; std::memcpy(&r.v, p, sizeof(r.v)); return r; }
+    static float_lanes loadu(const float* p) { return load(p); }
+    void store(float* p) const  { std::memcpy(p, &v, sizeof(v)); }
+    void storeu(float* p) const { store(p); }
+
+    float operator[](int i) const noexcept { return v[i]; }
+
+    float_lanes operator-() const { return float_lanes(-v); }
+    friend float_lanes operator+(const float_lanes& a, const float_lanes& b) { return float_lanes(a.v + b.v); }
+    friend float_lanes operator-(const float_lanes& a, const float_lanes& b) { return float_lanes(a.v - b.v); }
+    friend float_lanes operator*(const float_lanes& a, const float_lanes& b) { return float_lanes(a.v * b.v); }
+    friend float_lanes operator/(const float_lanes& a, const float_lanes& b) { return float_lanes(a.v / b.v); }
+
+    friend mask_lanes<8> operator<(const float_lanes& a, const float_lanes& b)  { return mask_lanes<8>(a.v < b.v); }
+    friend mask_lanes<8> operator<=(const float_lanes& a, const float_lanes& b) { return mask_lanes<8>(a.v <= b.v); }
+    friend mask_lanes<8> operator>(const float_lanes& a, const float_lanes& b)  { return mask_lanes<8>(a.v > b.v); }
+    friend mask_lanes<8> operator>=(const float_lanes& a, const float_lanes& b) { return mask_lanes<8>(a.v >= b.v); }
+    friend mask_lanes<8> operator==(const float_lanes& a, const float_lanes& b) { return mask_lanes<8>(a.v == b.v); }
+    friend mask_lanes<8> operator!=(const float_lanes& a, const float_lanes& b) { return mask_lanes<8>(a.v != b.v); }
+
+    friend float_lanes min(const float_lanes& a, const float_lanes& b) { return float_lanes(b.v < a.v ? b.v : a.v); }
+    friend float_lanes max(const float_lanes& a, const float_lanes& b) { return float_lanes(b.v > a.v ? b.v : a.v); }
+    friend float_lanes abs(const float_lanes& a) {
+        return float_lanes(reinterpret_cast<vector_type>(reinterpret_cast<mask_lanes<8>::vector_type>(a.v) & 0x7fffffff));
+    }
+    friend float_lanes sqrt(const float_lanes& a) {
+        float_lanes r;
+        for (int i = 0; i < 8; i++) r.v[i] = std::sqrt(a.v[i]);
+        return r;
+    }
+
+    friend float_lanes select(const mask_lanes<8>& mask, const float_lanes& a, const float_lanes& b) {
+        return float_lanes(mask.m ? a.v : b.v);
+    }
+};
+#endif
+
+// === MASK QUERIES ===
+template <int W> inline bool any(const mask_lanes<W>& m)  { return m.bits() != 0; }
+template <int W> inline bool none(const mask_lanes<W>& m) { return m.bits() == 0; }
+template <int W> inline bool all(const mask_lanes<W>& m)  { return m.bits() == mask_lanes<W>(true).bits(); }
+
+// === COMPOUND ASSIGNMENT ===
+template <int W> inline float_lanes<W>& operator+=(float_lanes<W>& a, const float_lanes<W>& b) { return a = a + b; }
+template <int W> inline float_lanes<W>& operator-=(float_lanes<W>& a, const float_lanes<W>& b) { return a = a - b; }
+template <int W> inline float_lanes<W>& operator*=(float_lanes<W>& a, const float_lanes<W>& b) { return a = a * b; }
+template <int W> inline float_lanes<W>& operator/=(float_lanes<W>& a, const float_lanes<W>& b) { return a = a / b; }
+
+// === VECTORS ===
+template <int W>
+struct vec3_lanes {
+    float_lanes<W> x, y, z;
+
+    vec3_lanes() = default;
+    vec3_lanes(const float_lanes<W>& x, const float_lanes<W>& y, const float_lanes<W>& z) : x(x), y(y), z(z) {}
+    // Broadcast one vector to every lane
+    vec3_lanes(const VecN<float, 3>& v) : x(v.x()), y(v.y()), z(v.z()) {}
+
+    // From the W-float component arrays of a structure-of-arrays block,
+    // aligned to the lane width
+    static vec3_lanes load(const float* xs, const float* ys, const float* zs) {
+        return {float_lanes<W>::load(xs), float_lanes<W>::load(ys), float_lanes<W>::load(zs)};
+    }
+    static vec3_lanes load(const float (&soa)[3][W]) { return load(soa[0], soa[1], soa[2]); }
+
+    // From W separate vectors
+    static vec3_lanes gather(const VecN<float, 3>* v) {
+        alignas(32) float c[3][W];
+        for (int i = 0; i < W; i++)
+            for (int k = 0; k < 3; k++) c[k][i] = v[i][k];
+        return load(c);
+    }
+
+    VecN<float, 3> lane(int i) const { return VecN<float, 3>(x[i], y[i], z[i]); }
+
+    vec3_lanes operator-() const { return {-x, -y, -z}; }
+
+    vec3_lanes& operator+=(const vec3_lanes& v) { x += v.x; y += v.y; z += v.z; return *this; }
+    vec3_lanes& operator-=(const vec3_lanes& v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+    vec3_lanes& operator*=(const vec3_lanes& v) { x *= v.x; y *= v.y; z *= v.z; return *this; }
+    vec3_lanes& operator*=(const float_lanes<W>& t) { x *= t; y *= t; z *= t; return *this; }
+    vec3_lanes& operator/=(const float_lanes<W>& t) { return *this *= float_lanes<W>(1.0f) / t; }
+
+    float_lanes<W> length_squared() const { return x * x + y * y + z * z; }
+    float_lanes<W> length() const { return sqrt(length_squared()); }
+
+    mask_lanes<W> near_zero() const {
+        const float_lanes<W> epsilon(std::numeric_limits<float>::epsilon());
+        return (abs(x) < epsilon) & (abs(y) < epsilon) & (abs(z) < epsilon);
+    }
+};
+
+template <int W> inline vec3_lanes<W> operator+(const vec3_lanes<W>& a, const vec3_lanes<W>& b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+template <int W> inline vec3_lanes<W> operator-(const vec3_lanes<W>& a, const vec3_lanes<W>& b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+// Hadamard product
+template <int W> inline vec3_lanes<W> operator*(const vec3_lanes<W>& a, const vec3_lanes<W>& b) { return {a.x * b.x, a.y * b.y, a.z * b.z}; }
+// Per-lane scalars
+template <int W> inline vec3_lanes<W> operator*(const float_lanes<W>& t, const vec3_lanes<W>& v) { return {t * v.x, t * v.y, t * v.z}; }
+template <int W> inline vec3_lanes<W> operator*(const vec3_lanes<W>& v, const float_lanes<W>& t) { return t * v; }
+template <int W> inline vec3_lanes<W> operator/(const vec3_lanes<W>& v, const float_lanes<W>& t) { return (float_lanes<W>(1.0f) / t) * v; }
+template <int W> inline vec3_lanes<W> operator*(float t, const vec3_lanes<W>& v) { return float_lanes<W>(t) * v; }
+template <int W> inline vec3_lanes<W> operator*(const vec3_lanes<W>& v, float t) { return float_lanes<W>(t) * v; }
+template <int W> inline vec3_lanes<W> operator/(const vec3_lanes<W>& v, float t) { return v / float_lanes<W>(t); }
+
+template <int W> [[nodiscard]]
+inline float_lanes<W> dot(const vec3_lanes<W>& a, const vec3_lanes<W>& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+template <int W> [[nodiscard]]
+inline vec3_lanes<W> cross(const vec3_lanes<W>& a, const vec3_lanes<W>& b) {
+    return {a.y * b.z - a.z * b.y,
+            a.z * b.x - a.x * b.z,
+            a.x * b.y - a.y * b.x};
+}
+
+template <int W> [[nodiscard]]
+inline vec3_lanes<W> select(const mask_lanes<W>& mask, const vec3_lanes<W>& a, const vec3_lanes<W>& b) {
+    return {select(mask, a.x, b.x), select(mask, a.y, b.y), select(mask, a.z, b.z)};
+}
+
+// Lanes of zero length become (1, 0, 0), as unit_vector() does for VecN
+template <int W> [[nodiscard]]
+inline vec3_lanes<W> unit_vector(const vec3_lanes<W>& v) {
+    float_lanes<W> len = v.length();
+    mask_lanes<W> zero = len == float_lanes<W>(0.0f);
+    return select(zero, vec3_lanes<W>(VecN<float, 3>(1.0f, 0.0f, 0.0f)), v / len);
+}
+
+template <int W> [[nodiscard]]
+inline vec3_lanes<W> reflect(const vec3_lanes<W>& v, const vec3_lanes<W>& n) {
+    return v - 2.0f * dot(v, n) * n;
+}
+
+template <int W> [[nodiscard]]
+inline vec3_lanes<W> refract(const vec3_lanes<W>& uv, const vec3_lanes<W>& n, const float_lanes<W>& eta_ratio) {
+    float_lanes<W> cos_theta = min(dot(-uv, n), float_lanes<W>(1.0f));
+    vec3_lanes<W> r_out_perp = eta_ratio * (uv + cos_theta * n);
+    vec3_lanes<W> r_out_parallel = -sqrt(abs(float_lanes<W>(1.0f) - r_out_perp.length_squared())) * n;
+    return r_out_perp + r_out_parallel;
+}
+
+// === CONVENIENT ALIAS ===
+using floatx4 = float_lanes<4>;
+using floatx8 = float_lanes<8>;
+using maskx4  = mask_lanes<4>;
+using maskx8  = mask_lanes<8>;
+using vec3x4  = vec3_lanes<4>;
+using vec3x8  = vec3_lanes<8>;
+
+} // namespace rt
@@ -47,26 +47,7 @@ void save_framebuffer(const std::vector<color>& framebuffer,
 
     // Convert framebuffer -> unsigned char buffer
     std::vector<unsigned char> image_buffer(width * height * 3);
-    static const interval intensity(0.000f, 0.999f);
-
-    for (int j = 0; j < height; ++j) {
-        for (int i = 0; i < width; ++i) {
-            const color& pixel_color = framebuffer[j * width + i];
-
-            auto r = linear_to_gamma(pixel_color.r());
-            auto g = linear_to_gamma(pixel_color.g());
-            auto b = linear_to_gamma(pixel_color.b());
-
-            int rbyte = static_cast<int>(256 * intensity.clamp(r));
-            int gbyte = static_cast<int>(256 * intensity.clamp(g));
-            int bbyte = static_cast<int>(256 * intensity.clamp(b));
-
-            int idx = (j * width + i) * 3;
-            image_buffer[idx + 0] = static_cast<unsigned char>(rbyte);
-            image_buffer[idx + 1] = static_cast<unsigned char>(gbyte);
-            image_buffer[idx + 2] = static_cast<unsigned char>(bbyte);
-        }
-    }
+    tonemap_to_bytes(framebuffer.data(), static_cast<size_t>(width) * height, image_buffer.data());
 
     if (format == "png") {
         stbi_write_png(filename.c_str(), width, height, 3, image_buffer.data(), width * 3);
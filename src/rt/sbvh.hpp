@@ -0,0 +1,267 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "AABB.hpp"
+#include "bvh_build.hpp"
+
+namespace rt {
+
+// Spatial-split BVH builder (Stich et al., "Spatial Splits in Bounding Volume
+// Hierarchies"). Besides the binned object split it considers splitting space
+// itself: a primitive straddling the plane is referenced from both children,
+// each reference clipped to its side. That removes most of the child overlap
+// caused by long, thin triangles, at the price of duplicate references.
+//
+// clip(index, axis, lo, hi) returns the bounds of source primitive `index`
+// inside the slab lo <= p[axis] <= hi, see hittable::clipped_bounding_box().
+template <typename ClipFn>
+class spatial_split_builder {
+public:
+    static constexpr int bin_count = 16;
+    // Spatial splits and the reference duplication they bring stop at this
+    // depth. Below it every split is a median split, which keeps the whole
+    // tree within bvh_max_depth.
+    static constexpr int max_spatial_depth = bvh_median_depth;
+
+    spatial_split_builder(ClipFn clip, const bvh_build_options& options)
+        : clip(std::move(clip)), options(options) {}
+
+    flat_bvh build(std::vector<bvh_primitive> refs) {
+        flat_bvh bvh;
+        if (refs.empty()) return bvh;
+
+        AABB root = bounds_of(refs, 0, refs.size());
+        min_overlap = options.spatial_overlap * root.half_area();
+        budget = static_cast<size_t>(options.spatial_budget * refs.size());
+        out = &bvh;
+        build_node(refs, 0);
+        return bvh;
+    }
+
+private:
+    struct spatial_split {
+        int axis = -1;
+        int bin = 0;        // the plane lies between bins bin and bin + 1
+        float cost = INF;
+        AABB left, right;
+        size_t left_count = 0, right_count = 0;
+    };
+
+    ClipFn clip;
+    const bvh_build_options& options;
+    float min_overlap = 0.0f;
+    size_t budget = 0;      // duplicate references still allowed
+    flat_bvh* out = nullptr;
+
+    static bvh_primitive make_ref(size_t index, const AABB& box) {
+        return {box, box.centroid(), index};
+    }
+
+    // Nodes are appended depth first, so the left child always follows its parent.
+    void build_node(std::vector<bvh_primitive>& refs, int depth) {
+        size_t node_index = out->nodes.size();
+        out->nodes.emplace_back();
+        AABB box = bounds_of(refs, 0, refs.size());
+        out->nodes[node_index].set_bounds(box);
+
+        if (refs.size() <= static_cast<size_t>(options.max_leaf_size)) {
+            bvh_flat_node& leaf = out->nodes[node_index];
+            leaf.offset = static_cast<uint32_t>(out->indices.size());
+            leaf.count = static_cast<uint16_t>(refs.size());
+            leaf.axis = 0;
+            for (const auto& r : refs)
+                out->indices.push_back(static_cast<uint32_t>(r.index));
+            return;
+        }
+
+        std::vector<bvh_primitive> left, right;
+        int axis = split(refs, box, depth, left, right);
+        std::vector<bvh_primitive>().swap(refs);    // release before recursing
+
+        build_node(left, depth + 1);
+        bvh_flat_node& node = out->nodes[node_index];
+        node.offset = static_cast<uint32_t>(out->nodes.size());
+        node.count = 0;
+        node.axis = static_cast<uint16_t>(axis);
+        build_node(right, depth + 1);
+    }
+
+    // Distributes refs into left and right and returns the split axis.
+    int split(std::vector<bvh_primitive>& refs, const AABB& box, int depth,
+              std::vector<bvh_primitive>& left, std::vector<bvh_primitive>& right)
+    {
+        using binner = sah_binner<bin_count>;
+        size_t n = refs.size();
+        AABB cbounds = centroid_bounds_of(refs, 0, n);
+        sah_split object = binner::find(refs, 0, n, cbounds);
+
+        // Spatial splits are only worth evaluating when the object split
+        // leaves children that overlap noticeably.
+        bool try_spatial = budget > 0 && depth < max_spatial_depth;
+        if (try_spatial && object.axis >= 0) {
+            AABB l = AABB::empty, r = AABB::empty;
+            for (const auto& p : refs) {
+                if (binner::bin_of(p.centroid, cbounds, object.axis) <= object.bin)
+                    l = AABB(l, p.bbox);
+                else
+                    r = AABB(r, p.bbox);
+            }
+            AABB both = overlap(l, r);
+            try_spatial = both.x.min <= both.x.max && both.half_area() > min_overlap;
+        }
+
+        if (try_spatial) {
+            spatial_split s = find_spatial(refs, box);
+            size_t duplicates = s.left_count + s.right_count - n;
+            if (s.axis >= 0 && s.cost < object.cost && duplicates <= budget) {
+                split_spatial(refs, box, s, left, right);
+                if (!left.empty() && !right.empty()) {
+                    budget -= std::min(budget, left.size() + right.size() - n);
+                    return s.axis;
+                }
+                left.clear();
+                right.clear();
+            }
+        }
+
+        bvh_partition p = object.axis >= 0 && depth < bvh_median_depth
+            ? bvh_partition{static_cast<size_t>(std::partition(refs.begin(), refs.end(),
+                  [&](const bvh_primitive& r) {
+                      return binner::bin_of(r.centroid, cbounds, object.axis) <= object.bin;
+                  }) - refs.begin()), object.axis}
+            : partition_median(refs, 0, n, box);
+        left.assign(refs.begin(), refs.begin() + p.mid);
+        right.assign(refs.begin() + p.mid, refs.end());
+        return p.axis;
+    }
+
+    int bin_of(float x, const interval& ax) const {
+        int b = static_cast<int>(bin_count * ((x - ax.min) / ax.size()));
+        return std::clamp(b, 0, bin_count - 1);
+    }
+
+    float plane_of(int bin, const interval& ax) const {
+        return ax.min + (bin + 1) * (ax.size() / bin_count);
+    }
+
+    // Bins the clipped pieces of every reference into equal slabs of the node
+    // box and sweeps the bin boundaries of all three axes, like sah_binner.
+    spatial_split find_spatial(const std::vector<bvh_primitive>& refs, const AABB& box) {
+        spatial_split best;
+
+        for (int axis = 0; axis < 3; axis++) {
+            const interval& ax = box.axis_interval(axis);
+            if (ax.size() <= 0.0f) continue;
+
+            AABB bin_box[bin_count];
+            size_t entry[bin_count] = {}, exit[bin_count] = {};
+            for (int b = 0; b < bin_count; b++)
+                bin_box[b] = AABB::empty;
+
+            for (const auto& r : refs) {
+                int first = bin_of(r.bbox.axis_interval(axis).min, ax);
+                int last = bin_of(r.bbox.axis_interval(axis).max, ax);
+                entry[first]++;
+                exit[last]++;
+                if (first == last) {
+                    bin_box[first] = AABB(bin_box[first], r.bbox);
+                    continue;
+                }
+                for (int b = first; b <= last; b++) {
+                    float lo = b == first ? -INF : plane_of(b - 1, ax);
+                    float hi = b == last ? INF : plane_of(b, ax);
+                    AABB piece = overlap(clip(r.index, axis, lo, hi), r.bbox);
+                    bin_box[b] = AABB(bin_box[b], piece);
+                }
+            }
+
+            AABB right_box[bin_count];
+            size_t right_count[bin_count];
+            AABB acc = AABB::empty;
+            size_t count = 0;
+            for (int b = bin_count - 1; b > 0; b--) {
+                acc = AABB(acc, bin_box[b]);
+                count += exit[b];
+                right_box[b - 1] = acc;
+                right_count[b - 1] = count;
+            }
+
+            acc = AABB::empty;
+            count = 0;
+            for (int b = 0; b < bin_count - 1; b++) {
+                acc = AABB(acc, bin_box[b]);
+                count += entry[b];
+                if (count == 0 || right_count[b] == 0) continue;
+                float cost = count * acc.half_area() + right_count[b] * right_box[b].half_area();
+                if (cost < best.cost) {
+                    best.axis = axis;
+                    best.bin = b;
+                    best.cost = cost;
+                    best.left = acc;
+                    best.right = right_box[b];
+                    best.left_count = count;
+                    best.right_count = right_count[b];
+                }
+            }
+        }
+        return best;
+    }
+
+    // Sends every reference to its side of the plane. A straddling reference
+    // is clipped into both children, unless moving it whole to one side is
+    // cheaper under the SAH ("reference unsplitting").
+    void split_spatial(const std::vector<bvh_primitive>& refs, const AABB& box, spatial_split s,
+                       std::vector<bvh_primitive>& left, std::vector<bvh_primitive>& right)
+    {
+        const interval& ax = box.axis_interval(s.axis);
+        float plane = plane_of(s.bin, ax);
+        left.reserve(s.left_count);
+        right.reserve(s.right_count);
+
+        for (const auto& r : refs) {
+            int first = bin_of(r.bbox.axis_interval(s.axis).min, ax);
+            int last = bin_of(r.bbox.axis_interval(s.axis).max, ax);
+            if (last <= s.bin) {
+                left.push_back(r);
+                continue;
+            }
+            if (first > s.bin) {
+                right.push_back(r);
+                continue;
+            }
+
+            float nl = static_cast<float>(s.left_count), nr = static_cast<float>(s.right_count);
+            float split_cost = s.left.half_area() * nl + s.right.half_area() * nr;
+            float left_cost = AABB(s.left, r.bbox).half_area() * nl + s.right.half_area() * (nr - 1);
+            float right_cost = s.left.half_area() * (nl - 1) + AABB(s.right, r.bbox).half_area() * nr;
+
+            if (left_cost < split_cost && left_cost <= right_cost) {
+                left.push_back(r);
+                s.left = AABB(s.left, r.bbox);
+                s.right_count--;
+            } else if (right_cost < split_cost) {
+                right.push_back(r);
+                s.right = AABB(s.right, r.bbox);
+                s.left_count--;
+            } else {
+                AABB l = overlap(clip(r.index, s.axis, -INF, plane), r.bbox);
+                AABB rb = overlap(clip(r.index, s.axis, plane, INF), r.bbox);
+                if (l.x.min <= l.x.max) left.push_back(make_ref(r.index, l));
+                if (rb.x.min <= rb.x.max) right.push_back(make_ref(r.index, rb));
+            }
+        }
+    }
+};
+
+// Builds a flat SBVH over prims, in the same layout as build_flat_bvh(). Leaf
+// slots may repeat a primitive index.
+template <typename ClipFn>
+flat_bvh build_spatial_bvh(std::vector<bvh_primitive> prims, ClipFn&& clip, const bvh_build_options& options) {
+    spatial_split_builder<std::decay_t<ClipFn>> builder(std::forward<ClipFn>(clip), options);
+    return builder.build(std::move(prims));
+}
+
+} // namespace rt
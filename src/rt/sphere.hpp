@@ -9,6 +9,7 @@
 #include "rtm/vector.hpp"
 #include "rtm/ray.hpp"
 #include "rtm/constants.hpp"
+#include "rtm/fast_math.hpp"
 
 namespace rt {
 
@@ -41,23 +42,10 @@ public:
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override
     {
         point3f current_center = center.at(r.time());
-        vec3f oc = current_center - r.origin();
-        auto a = r.direction().length_squared();
-        auto h = dot(r.direction(), oc);
-        auto c = oc.length_squared() - radius * radius;
+        float root;
+        if (!intersect(r, current_center, ray_t, root))
+            return false;
 
-        auto discriminant = h * h - a * c;
-        if(discriminant < 0) return false;
-
-        auto sqrtd = std::sqrt(discriminant);
-        
-        // Find the nearest root that lies in the acceptable range
-        auto root = (h - sqrtd) / a;
-        if(root <= ray_t.min || ray_t.max <= root) {
-            root = (h + sqrtd) / a;
-            if(root <= ray_t.min || ray_t.max <= root)
-                return false;
-        }
         rec.t = root;
         rec.p = r.at(rec.t);
         vec3f outward_normal = (rec.p - current_center) / radius;
@@ -68,6 +56,12 @@ public:
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        float root;
+        return intersect(r, center.at(r.time()), ray_t, root);
+    }
+
     // p: a given point on the sphere of radius one, centered at the origin.
     // u: returned value [0,1] of angle around the Y axis from X=-1.
     // v: returned value [0,1] of angle from Y=-1 to Y=+1.
@@ -76,8 +70,8 @@ public:
     //     <0 1 0> yields <0.50 1.00>       < 0 -1  0> yields <0.50 0.00>
     //     <0 0 1> yields <0.25 0.50>       < 0  0 -1> yields <0.75 0.50>
     static void get_sphere_uv(const point3f& p, float& u, float& v) {
-        float theta = std::acos(-p.y());
-        float phi = std::atan2(-p.z(), p.x()) + PI;
+        float theta = math::acos(-p.y());
+        float phi = math::atan2(-p.z(), p.x()) + PI;
 
         u = phi / (2 * PI);
         v = theta / PI;
@@ -87,6 +81,36 @@ public:
     {
         return bbox;
     }
+
+    AABB bounding_box_at(float time) const override
+    {
+        auto rvec = vec3f(radius, radius, radius);
+        return AABB(center.at(time) - rvec, center.at(time) + rvec);
+    }
+
+private:
+    // Nearest root of the ray-sphere quadratic inside ray_t.
+    bool intersect(const ray& r, const point3f& current_center, interval ray_t, float& root) const
+    {
+        vec3f oc = current_center - r.origin();
+        auto a = r.direction().length_squared();
+        auto h = dot(r.direction(), oc);
+        auto c = oc.length_squared() - radius * radius;
+
+        auto discriminant = h * h - a * c;
+        if(discriminant < 0) return false;
+
+        auto sqrtd = std::sqrt(discriminant);
+
+        // Find the nearest root that lies in the acceptable range
+        root = (h - sqrtd) / a;
+        if(root <= ray_t.min || ray_t.max <= root) {
+            root = (h + sqrtd) / a;
+            if(root <= ray_t.min || ray_t.max <= root)
+                return false;
+        }
+        return true;
+    }
 };
 
 } // namespace rt
\ No newline at end of file
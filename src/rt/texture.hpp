@@ -2,6 +2,7 @@
 #include "def.hpp"
 #include "rtw_stb_image.hpp"
 #include "perlin.hpp"
+#include "rtm/fast_math.hpp"
 
 namespace rt
 {
@@ -79,7 +80,7 @@ public:
 
     color value(float u, float v, const point3f& p) const override 
     {
-        return color(0.5f, 0.5f, 0.5f) * (1.0f + sin(scale * p.z() + 10.0f * noise.turbulence(p, 7)));
+        return color(0.5f, 0.5f, 0.5f) * (1.0f + math::sin(scale * p.z() + 10.0f * noise.turbulence(p, 7)));
     }
 
 private:
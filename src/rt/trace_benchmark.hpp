@@ -0,0 +1,275 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+#include <omp.h>
+
+#include "def.hpp"
+#include "hittable.hpp"
+#include "material.hpp"
+#include "rtm/functions.hpp"
+
+// Helpers for measuring raw intersection throughput (no shading), used to
+// compare acceleration structures on the same set of rays.
+namespace rt::benchmark {
+
+struct trace_result {
+    size_t rays = 0;
+    size_t hits = 0;
+    double seconds = 0.0;
+
+    double mrays_per_sec() const { return seconds > 0.0 ? rays / seconds * 1e-6 : 0.0; }
+};
+
+// One pinhole ray through the center of every pixel; no jitter, so every run
+// traces exactly the same rays.
+inline std::vector<ray> primary_rays(const point3f& lookfrom, const point3f& lookat, const vec3f& vup,
+                                     float vfov, int width, int height)
+{
+    auto h = std::tan(degrees_to_radians(vfov) / 2);
+    auto viewport_height = 2.0f * h;
+    auto viewport_width = viewport_height * (static_cast<float>(width) / height);
+
+    vec3f w = unit_vector(lookfrom - lookat);
+    vec3f u = unit_vector(cross(vup, w));
+    vec3f v = cross(w, u);
+
+    vec3f du = (viewport_width / width) * u;
+    vec3f dv = (viewport_height / height) * (-v);
+    point3f upper_left = lookfrom - w - (viewport_width / 2) * u + (viewport_height / 2) * v;
+
+    std::vector<ray> rays;
+    rays.reserve(static_cast<size_t>(width) * height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            point3f pixel = upper_left + (i + 0.5f) * du + (j + 0.5f) * dv;
+            rays.emplace_back(lookfrom, pixel - lookfrom, 0.0f);
+        }
+    }
+    return rays;
+}
+
+// Primary rays framing bbox from the front (-z), far enough back that the
+// whole box fits the 40 degree field of view. elevation raises the camera by
+// that fraction of the box's extent, to look down on it.
+inline std::vector<ray> framing_rays(const AABB& bbox, int width = 512, int height = 512, float elevation = 0.0f) {
+    auto extent = std::fmax(bbox.x.size(), bbox.y.size());
+    auto center = bbox.centroid();
+    return primary_rays(center - vec3f(0, -elevation * extent, 1.5f * extent + bbox.z.size()), center,
+                        vec3f(0, 1, 0), 40, width, height);
+}
+
+// Closest-hit queries for every ray, spread over all OpenMP threads.
+inline trace_result trace_rays(const hittable& world, const std::vector<ray>& rays, int repeats = 1,
+                               interval ray_t = interval(0.001f, INF))
+{
+    trace_result result;
+    size_t hits = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int rep = 0; rep < repeats; rep++) {
+        size_t rep_hits = 0;
+        #pragma omp parallel for schedule(dynamic, 1024) reduction(+:rep_hits)
+        for (long long i = 0; i < static_cast<long long>(rays.size()); i++) {
+            hit_record rec;
+            if (world.hit(rays[i], ray_t, rec))
+                rep_hits++;
+        }
+        hits += rep_hits;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    result.rays = rays.size() * repeats;
+    result.hits = hits;
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    return result;
+}
+
+// Reorders a row-major width x height image of rays into block_w x
+// block_h pixel blocks, so every run of block_w * block_h rays is one
+// coherent packet. Blocks at the right and bottom edges are smaller.
+inline std::vector<ray> block_ordered(const std::vector<ray>& rays, int width, int height, int block_w, int block_h) {
+    std::vector<ray> ordered;
+    ordered.reserve(rays.size());
+    for (int by = 0; by < height; by += block_h)
+        for (int bx = 0; bx < width; bx += block_w)
+            for (int j = by; j < std::min(by + block_h, height); j++)
+                for (int i = bx; i < std::min(bx + block_w, width); i++)
+                    ordered.push_back(rays[static_cast<size_t>(j) * width + i]);
+    return ordered;
+}
+
+// trace_rays() through world.hit_packet(), packet_size consecutive rays at a
+// time; pair with block_ordered() rays.
+inline trace_result trace_packets(const hittable& world, const std::vector<ray>& rays, int packet_size,
+                                  int repeats = 1, interval ray_t = interval(0.001f, INF))
+{
+    trace_result result;
+    size_t hits = 0;
+    const long long packets = (static_cast<long long>(rays.size()) + packet_size - 1) / packet_size;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int rep = 0; rep < repeats; rep++) {
+        size_t rep_hits = 0;
+        #pragma omp parallel for schedule(dynamic, 64) reduction(+:rep_hits)
+        for (long long p = 0; p < packets; p++) {
+            size_t first = static_cast<size_t>(p) * packet_size;
+            int count = static_cast<int>(std::min<size_t>(packet_size, rays.size() - first));
+            interval t[max_packet_size];
+            hit_record recs[max_packet_size];
+            for (int k = 0; k < count; k++) t[k] = ray_t;
+            rep_hits += popcount(world.hit_packet(rays.data() + first, count, t, recs));
+        }
+        hits += rep_hits;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    result.rays = rays.size() * repeats;
+    result.hits = hits;
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    return result;
+}
+
+// Any-hit queries for every ray, as traced for shadow rays. For rays aimed at
+// a point, ray_t = (eps, 1 - eps) covers the segment in between.
+inline trace_result trace_occlusion(const hittable& world, const std::vector<ray>& rays, int repeats = 1,
+                                    interval ray_t = interval(0.001f, INF))
+{
+    trace_result result;
+    size_t hits = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int rep = 0; rep < repeats; rep++) {
+        size_t rep_hits = 0;
+        #pragma omp parallel for schedule(dynamic, 1024) reduction(+:rep_hits)
+        for (long long i = 0; i < static_cast<long long>(rays.size()); i++) {
+            if (world.occluded(rays[i], ray_t))
+                rep_hits++;
+        }
+        hits += rep_hits;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    result.rays = rays.size() * repeats;
+    result.hits = hits;
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    return result;
+}
+
+// Rays from the closest hit of every ray in `rays` towards `light`, with the
+// light at t = 1. Rays that miss the world produce no shadow ray.
+inline std::vector<ray> shadow_rays(const hittable& world, const std::vector<ray>& rays, const point3f& light) {
+    std::vector<ray> shadow;
+    shadow.reserve(rays.size());
+    for (const auto& r : rays) {
+        hit_record rec;
+        if (world.hit(r, interval(0.001f, INF), rec))
+            shadow.emplace_back(rec.p, light - rec.p, r.time());
+    }
+    return shadow;
+}
+
+// The first bounce of every ray in `rays`: the ray its closest hit's
+// material scatters, as traced next by the path tracer. Rays that miss or
+// are absorbed produce none.
+inline std::vector<ray> scattered_rays(const hittable& world, const std::vector<ray>& rays) {
+    std::vector<ray> scattered;
+    scattered.reserve(rays.size());
+    for (const auto& r : rays) {
+        hit_record rec;
+        color attenuation;
+        ray next;
+        if (world.hit(r, interval(0.001f, INF), rec) && rec.mat->scatter(r, rec, attenuation, next))
+            scattered.push_back(next);
+    }
+    return scattered;
+}
+
+// Fully associative LRU cache of `lines` blocks of line_bytes each. Fed with
+// node addresses it gives a rough, repeatable stand-in for hardware cache
+// and TLB miss counters.
+class cache_model {
+public:
+    cache_model(size_t lines, size_t line_bytes) : capacity(lines), line_bytes(line_bytes) {}
+
+    // Touches the block holding p; returns true on a miss.
+    bool access(const void* p) {
+        uintptr_t block = reinterpret_cast<uintptr_t>(p) / line_bytes;
+        auto it = where.find(block);
+        if (it != where.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            return false;
+        }
+        lru.push_front(block);
+        where[block] = lru.begin();
+        if (lru.size() > capacity) {
+            where.erase(lru.back());
+            lru.pop_back();
+        }
+        misses++;
+        return true;
+    }
+
+    size_t misses = 0;
+
+private:
+    size_t capacity;
+    size_t line_bytes;
+    std::list<uintptr_t> lru;
+    std::unordered_map<uintptr_t, std::list<uintptr_t>::iterator> where;
+};
+
+struct footprint_result {
+    size_t rays = 0;
+    size_t nodes = 0;       // node fetches
+    size_t l1_misses = 0;   // 32 KiB of 64-byte lines
+    size_t l2_misses = 0;   // 1 MiB of 64-byte lines
+    size_t tlb_misses = 0;  // 64 entries of 4 KiB pages
+};
+
+// Replays the rays in order on one thread through bvh.hit(r, t, rec, visit)
+// and runs every node fetch through the cache models. Only node memory is
+// modelled; primitives are the same for every layout.
+template <typename BVH>
+footprint_result trace_footprint(const BVH& bvh, const std::vector<ray>& rays) {
+    footprint_result result;
+    cache_model l1(512, 64), l2(16384, 64), tlb(64, 4096);
+    for (const auto& r : rays) {
+        hit_record rec;
+        bvh.hit(r, interval(0.001f, INF), rec, [&](const auto& node) {
+            result.nodes++;
+            l1.access(&node);
+            l2.access(&node);
+            tlb.access(&node);
+        });
+    }
+    result.rays = rays.size();
+    result.l1_misses = l1.misses;
+    result.l2_misses = l2.misses;
+    result.tlb_misses = tlb.misses;
+    return result;
+}
+
+inline void print_footprint_result(const std::string& name, const footprint_result& f, std::ostream& out = std::cout) {
+    double rays = static_cast<double>(std::max<size_t>(f.rays, 1));
+    out << std::left << std::setw(28) << name << std::right
+        << std::fixed << std::setprecision(2)
+        << std::setw(7) << f.nodes / rays << " nodes/ray, misses/ray: L1 "
+        << f.l1_misses / rays << ", L2 " << f.l2_misses / rays
+        << ", TLB " << f.tlb_misses / rays << std::endl;
+}
+
+inline void print_trace_result(const std::string& name, const trace_result& r, std::ostream& out = std::cout) {
+    out << std::left << std::setw(28) << name << std::right
+        << std::fixed << std::setprecision(2)
+        << std::setw(9) << r.mrays_per_sec() << " Mrays/s  ("
+        << r.hits << " hits / " << r.rays << " rays)" << std::endl;
+}
+
+} // namespace rt::benchmark
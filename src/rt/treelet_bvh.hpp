@@ -0,0 +1,167 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <deque>
+#include <cstdint>
+
+#include "def.hpp"
+#include "linear_bvh.hpp"
+
+namespace rt {
+
+// bvh_flat_node with both children of an interior node stored side by side at
+// offset and offset + 1. Every sibling pair fills one 64-byte line, so the
+// far child is already cached when the traversal comes back for it, and pairs
+// can be moved around freely to cluster subtrees.
+struct alignas(32) bvh_treelet_node {
+    float bmin[3];
+    uint32_t offset;    // leaf: first primitive slot, interior: index of the first child
+    float bmax[3];
+    uint16_t count;     // primitives in the leaf, 0 for interior nodes
+    uint16_t axis;      // split axis of an interior node
+
+    bool is_leaf() const { return count > 0; }
+
+    AABB bounds() const {
+        return AABB(interval(bmin[0], bmax[0]), interval(bmin[1], bmax[1]), interval(bmin[2], bmax[2]));
+    }
+};
+static_assert(sizeof(bvh_treelet_node) == 32, "two bvh_treelet_nodes should fill a cache line");
+
+FORCE_INLINE uint32_t first_child(const bvh_treelet_node& node, uint32_t) { return node.offset; }
+FORCE_INLINE uint32_t second_child(const bvh_treelet_node& node, uint32_t) { return node.offset + 1; }
+
+using treelet_node_array = std::vector<bvh_treelet_node, aligned_allocator<bvh_treelet_node, 64>>;
+
+// Reorders a depth-first flat BVH into treelets of about treelet_bytes.
+// A treelet grows from its root greedily, always adding the children of the
+// node with the largest surface area, i.e. the one most rays will enter;
+// whatever is left on its frontier becomes the roots of later treelets. The
+// treelets are emitted breadth first, so the top of the tree is packed into
+// the first few pages instead of being spread along the depth-first order.
+// Index 0 holds the root and index 1 is padding, so every sibling pair starts
+// on a cache line.
+inline treelet_node_array layout_treelets(const std::vector<bvh_flat_node>& nodes, size_t treelet_bytes = 4096) {
+    treelet_node_array out;
+    if (nodes.empty()) return out;
+
+    auto convert = [](const bvh_flat_node& n) {
+        bvh_treelet_node t;
+        for (int a = 0; a < 3; a++) {
+            t.bmin[a] = n.bmin[a];
+            t.bmax[a] = n.bmax[a];
+        }
+        t.offset = n.offset;
+        t.count = n.count;
+        t.axis = n.axis;
+        return t;
+    };
+
+    const size_t pairs_per_treelet = std::max<size_t>(1, treelet_bytes / (2 * sizeof(bvh_treelet_node)));
+    std::vector<uint32_t> position(nodes.size());   // depth-first index -> new index
+    out.reserve(nodes.size() + 1);
+    out.push_back(convert(nodes[0]));
+    position[0] = 0;
+    if (nodes[0].is_leaf()) return out;
+    out.push_back(bvh_treelet_node{});
+
+    // (half area, depth-first index) of interior nodes whose children are unplaced
+    using entry = std::pair<float, uint32_t>;
+    auto area = [&](uint32_t i) { return nodes[i].bounds().half_area(); };
+    std::deque<uint32_t> roots{0};
+
+    while (!roots.empty()) {
+        std::priority_queue<entry> frontier;
+        frontier.push({area(roots.front()), roots.front()});
+        roots.pop_front();
+
+        for (size_t placed = 0; placed < pairs_per_treelet && !frontier.empty(); placed++) {
+            uint32_t parent = frontier.top().second;
+            frontier.pop();
+
+            uint32_t children[2] = {parent + 1, nodes[parent].offset};
+            uint32_t pair = static_cast<uint32_t>(out.size());
+            out[position[parent]].offset = pair;
+            for (int c = 0; c < 2; c++) {
+                position[children[c]] = pair + c;
+                out.push_back(convert(nodes[children[c]]));
+                if (!nodes[children[c]].is_leaf())
+                    frontier.push({area(children[c]), children[c]});
+            }
+        }
+        for (; !frontier.empty(); frontier.pop())
+            roots.push_back(frontier.top().second);
+    }
+    return out;
+}
+
+// Flat BVH built like linear_bvh, then laid out in treelets by
+// layout_treelets(). Traces the same rays with fewer distinct cache lines and
+// pages once the tree no longer fits in cache.
+class treelet_bvh : public hittable {
+public:
+    treelet_bvh(const hittable_list& list, const bvh_build_options& options = {}, size_t treelet_bytes = 4096)
+        : treelet_bvh(list.objects, options, treelet_bytes) {}
+
+    treelet_bvh(const std::vector<shared_ptr<hittable>>& source, const bvh_build_options& options = {},
+                size_t treelet_bytes = 4096)
+    {
+        flat_bvh bvh = build_flat_bvh(source, options);
+        if (bvh.nodes.empty()) return;
+
+        nodes = layout_treelets(bvh.nodes, treelet_bytes);
+        objects.reserve(bvh.indices.size());
+        for (uint32_t index : bvh.indices)
+            objects.push_back(source[index]);
+        bbox = bvh.nodes[0].bounds();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return hit(r, ray_t, rec, bvh_no_visit{});
+    }
+
+    // hit() that reports every node it fetches to visit(node).
+    template <typename VisitFn>
+    bool hit(const ray& r, interval ray_t, hit_record& rec, VisitFn&& visit) const {
+        if (nodes.empty()) return false;
+
+        return traverse_flat_bvh(nodes.data(), r, ray_t,
+            [&](uint32_t first, uint32_t count, interval& t) {
+                bool hit_leaf = false;
+                for (uint32_t i = first; i < first + count; i++) {
+                    if (objects[i]->hit(r, t, rec)) {
+                        hit_leaf = true;
+                        t.max = rec.t;
+                    }
+                }
+                return hit_leaf;
+            }, visit);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (nodes.empty()) return false;
+
+        return occluded_flat_bvh(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count) {
+            for (uint32_t i = first; i < first + count; i++)
+                if (objects[i]->occluded(r, ray_t))
+                    return true;
+            return false;
+        });
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    size_t memory_bytes() const {
+        return nodes.size() * sizeof(bvh_treelet_node) + objects.size() * sizeof(shared_ptr<hittable>);
+    }
+
+private:
+    treelet_node_array nodes;
+    std::vector<shared_ptr<hittable>> objects;  // in leaf order
+    AABB bbox = AABB::empty;
+};
+
+} // namespace rt
@@ -4,6 +4,7 @@
 #include "rtm/vector.hpp"
 #include "quad.hpp"
 #include "hittable_list.hpp"
+#include "triangle_intersection.hpp"
 
 namespace rt
 {
@@ -16,7 +17,6 @@ public:
         u = b - a;
         v = c - a;
         normal = unit_vector(cross(u, v));
-        D = dot(normal, a);
         set_bounding_box();
     }
 
@@ -38,33 +38,35 @@ public:
 
     AABB bounding_box() const override { return bbox; }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        float denom = dot(normal, r.direction());
-        if (std::fabs(denom) < 1e-8) return false;
-
-        float t = (D - dot(normal, r.origin())) / denom;
-        if (!ray_t.contains(t)) return false;
-
-        point3f p = r.at(t);
-        // Inside-outside test using cross products
-        vec3f c0 = cross(b - a, p - a);
-        vec3f c1 = cross(c - b, p - b);
-        vec3f c2 = cross(a - c, p - c);
+    AABB clipped_bounding_box(int axis, float lo, float hi) const override {
+        return clip_triangle(a, b, c, axis, lo, hi);
+    }
 
-        if (dot(normal, c0) < 0 || dot(normal, c1) < 0 || dot(normal, c2) < 0)
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        float t;
+        if (!intersect(r, ray_t, t))
             return false;
 
         rec.t = t;
-        rec.p = p;
+        rec.p = r.at(t);
         rec.mat = mat;
         rec.set_face_normal(r, normal);
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        float t;
+        return intersect(r, ray_t, t);
+    }
+
 private:
     point3f a, b, c;
     vec3f u, v, normal;
-    float D;
+
+    bool intersect(const ray& r, interval ray_t, float& t) const {
+        return intersect_triangle(r, ray_t, a, b, c, t);
+    }
+
     shared_ptr<material> mat;
     AABB bbox;
 };
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "rtm/ray.hpp"
+#include "rtm/vector.hpp"
+#include "rtm/interval.hpp"
+
+namespace rt {
+
+// Ray/triangle test used by triangle, mesh_triangle, triangle_mesh and
+// cached_mesh. Möller–Trumbore is slightly cheaper, but decides edge hits
+// from barycentrics computed per triangle, so a ray through an edge shared by
+// two triangles can miss both. The watertight test never lets such a ray
+// through.
+enum class triangle_test { moller_trumbore, watertight };
+
+inline triangle_test triangle_test_mode = triangle_test::watertight;
+
+// Per-ray constants of the watertight test (Woop, Benthin and Wald,
+// "Watertight Ray/Triangle Intersection", JCGT 2013): the ray is translated
+// to the origin and sheared so that it points down the +z axis, after which
+// the edge tests are 2D and evaluated the same way for both triangles of an
+// edge.
+struct triangle_ray {
+    const ray* r = nullptr;
+    triangle_test mode = triangle_test::moller_trumbore;
+    int kx = 0, ky = 1, kz = 2;     // kz: dominant axis of the direction
+    float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+
+    triangle_ray() = default;
+
+    explicit triangle_ray(const ray& r, triangle_test mode = triangle_test_mode) : r(&r), mode(mode) {
+        if (mode != triangle_test::watertight) return;
+
+        const vec3f& d = r.direction();
+        float ax = std::fabs(d.x()), ay = std::fabs(d.y()), az = std::fabs(d.z());
+        kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+        if (d[kz] < 0.0f) std::swap(kx, ky);    // keep the winding
+
+        sx = d[kx] / d[kz];
+        sy = d[ky] / d[kz];
+        sz = 1.0f / d[kz];
+    }
+};
+
+// Möller–Trumbore intersection
+// ref: https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
+inline bool intersect_triangle_mt(const ray& r, interval ray_t,
+                                  const point3f& v0, const point3f& v1, const point3f& v2, float& t)
+{
+    const float epsilon = std::numeric_limits<float>::epsilon();
+    vec3f edge1 = v1 - v0;
+    vec3f edge2 = v2 - v0;
+
+    vec3f h = cross(r.direction(), edge2);
+    float a = dot(edge1, h);
+    if (fabs(a) < epsilon) return false; // ray parallel
+
+    float f = 1.0f / a;
+    vec3f s = r.origin() - v0;
+    float u = f * dot(s, h);
+    if (u < 0.0f || u > 1.0f) return false;
+
+    vec3f q = cross(s, edge1);
+    float v = f * dot(r.direction(), q);
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    t = f * dot(edge2, q);
+    return ray_t.surrounds(t);
+}
+
+// Watertight intersection, two-sided.
+inline bool intersect_triangle_watertight(const triangle_ray& tr, interval ray_t,
+                                          const point3f& v0, const point3f& v1, const point3f& v2, float& t)
+{
+    const point3f& o = tr.r->origin();
+    vec3f a = v0 - o, b = v1 - o, c = v2 - o;
+
+    // Shear and scale the vertices into ray space
+    float ax = a[tr.kx] - tr.sx * a[tr.kz], ay = a[tr.ky] - tr.sy * a[tr.kz];
+    float bx = b[tr.kx] - tr.sx * b[tr.kz], by = b[tr.ky] - tr.sy * b[tr.kz];
+    float cx = c[tr.kx] - tr.sx * c[tr.kz], cy = c[tr.ky] - tr.sy * c[tr.kz];
+
+    // Scaled barycentrics: the signed areas the ray makes with each edge.
+    // Products of floats are exact in double, so each difference is rounded
+    // once and the two triangles of an edge get exactly opposite values, even
+    // where the compiler would fuse a float expression into an FMA.
+    float u = static_cast<float>(double(cx) * double(by) - double(cy) * double(bx));
+    float v = static_cast<float>(double(ax) * double(cy) - double(ay) * double(cx));
+    float w = static_cast<float>(double(bx) * double(ay) - double(by) * double(ax));
+
+    if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+        return false;
+
+    float det = u + v + w;
+    if (det == 0.0f) return false;
+
+    float az = tr.sz * a[tr.kz], bz = tr.sz * b[tr.kz], cz = tr.sz * c[tr.kz];
+    t = (u * az + v * bz + w * cz) / det;
+    return ray_t.surrounds(t);
+}
+
+inline bool intersect_triangle(const triangle_ray& tr, interval ray_t,
+                               const point3f& v0, const point3f& v1, const point3f& v2, float& t)
+{
+    if (tr.mode == triangle_test::watertight)
+        return intersect_triangle_watertight(tr, ray_t, v0, v1, v2, t);
+    return intersect_triangle_mt(*tr.r, ray_t, v0, v1, v2, t);
+}
+
+// Single test; loops over many triangles should build one triangle_ray per ray.
+inline bool intersect_triangle(const ray& r, interval ray_t,
+                               const point3f& v0, const point3f& v1, const point3f& v2, float& t)
+{
+    return intersect_triangle(triangle_ray(r), ray_t, v0, v1, v2, t);
+}
+
+} // namespace rt
@@ -0,0 +1,546 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+
+#include "def.hpp"
+#include "AABB.hpp"
+#include "hittable.hpp"
+#include "linear_bvh.hpp"
+#include "sbvh.hpp"
+#include "triangle_intersection.hpp"
+#include "rtm/affine.hpp"
+#include "rtm/vec3_soa.hpp"
+
+namespace rt {
+
+// W triangles in structure-of-arrays lanes. The vertices are kept as they
+// are, not as Möller–Trumbore edges, since the watertight test needs the
+// exact positions. Unused lanes are all zero, a degenerate triangle both
+// tests reject.
+template <int W>
+struct alignas(32) triangle_packet {
+    float v0[3][W];
+    float v1[3][W];
+    float v2[3][W];
+    uint32_t slot[W];   // triangle slot of each lane
+
+    void set(int lane, const point3f& a, const point3f& b, const point3f& c, uint32_t tri) {
+        for (int k = 0; k < 3; k++) {
+            v0[k][lane] = a[k];
+            v1[k][lane] = b[k];
+            v2[k][lane] = c[k];
+        }
+        slot[lane] = tri;
+    }
+
+    void clear(int lane) {
+        for (int k = 0; k < 3; k++)
+            v0[k][lane] = v1[k][lane] = v2[k][lane] = 0.0f;
+        slot[lane] = 0;
+    }
+};
+
+// Möller–Trumbore against every lane at once. Returns a mask of the lanes
+// hit inside ray_t and stores their distances in t.
+template <int W>
+FORCE_INLINE int intersect_packet_mt(const triangle_packet<W>& p, const ray& r, interval ray_t, float* t) {
+    using lanes = float_lanes<W>;
+    const lanes epsilon(std::numeric_limits<float>::epsilon());
+    const vec3_lanes<W> d(r.direction());
+    const vec3_lanes<W> v0 = vec3_lanes<W>::load(p.v0);
+    const vec3_lanes<W> e1 = vec3_lanes<W>::load(p.v1) - v0;
+    const vec3_lanes<W> e2 = vec3_lanes<W>::load(p.v2) - v0;
+
+    vec3_lanes<W> h = cross(d, e2);
+    lanes a = dot(e1, h);
+    mask_lanes<W> valid = abs(a) >= epsilon;
+
+    lanes f = lanes(1.0f) / a;
+    vec3_lanes<W> s = vec3_lanes<W>(r.origin()) - v0;
+    lanes u = f * dot(s, h);
+
+    vec3_lanes<W> q = cross(s, e1);
+    lanes v = f * dot(d, q);
+    lanes tt = f * dot(e2, q);
+
+    valid = valid & (u >= 0.0f) & (u <= 1.0f) & (v >= 0.0f) & (u + v <= 1.0f);
+    valid = valid & (tt > ray_t.min) & (tt < ray_t.max);
+    tt.storeu(t);
+    return valid.bits();
+}
+
+// intersect_triangle_watertight() against every lane at once. The edge
+// functions are evaluated in float lanes, where the compiler may fuse a
+// product and the difference into an FMA and the two triangles of an edge
+// no longer get exactly opposite values. Only the sign matters, though: a
+// lane whose edge function is within the rounding bound of zero is redone
+// in double as in the scalar test, all others already have the exact sign.
+template <int W>
+FORCE_INLINE int intersect_packet_watertight(const triangle_packet<W>& p, const triangle_ray& tr, interval ray_t,
+                                             float* t)
+{
+    using lanes = float_lanes<W>;
+    const point3f& o = tr.r->origin();
+    const lanes sx(tr.sx), sy(tr.sy), sz(tr.sz);
+
+    // Vertex relative to the origin, sheared and scaled into ray space
+    struct sheared { lanes x, y, z; };
+    auto shear = [&](const float (&v)[3][W]) {
+        lanes z = lanes::load(v[tr.kz]) - lanes(o[tr.kz]);
+        return sheared{lanes::load(v[tr.kx]) - lanes(o[tr.kx]) - sx * z,
+                       lanes::load(v[tr.ky]) - lanes(o[tr.ky]) - sy * z, sz * z};
+    };
+    sheared a = shear(p.v0), b = shear(p.v1), c = shear(p.v2);
+
+    mask_lanes<W> unsure;
+    auto edge = [&](const sheared& p0, const sheared& p1) {
+        lanes l = p0.x * p1.y, r = p0.y * p1.x;
+        lanes e = l - r;
+        lanes bound = lanes(0x1p-22f) * (abs(l) + abs(r));
+        unsure = unsure | ((abs(e) <= bound) & (bound > lanes(0.0f)));
+        return e;
+    };
+    lanes u = edge(c, b), v = edge(a, c), w = edge(b, a);
+
+    if (int redo = unsure.bits()) {
+        alignas(32) float uf[W], vf[W], wf[W];
+        u.store(uf);
+        v.store(vf);
+        w.store(wf);
+        auto exact = [](float px, float py, float qx, float qy) {
+            return static_cast<float>(double(px) * double(qy) - double(py) * double(qx));
+        };
+        for (; redo; redo &= redo - 1) {
+            int i = count_trailing_zeros(redo);
+            uf[i] = exact(c.x[i], c.y[i], b.x[i], b.y[i]);
+            vf[i] = exact(a.x[i], a.y[i], c.x[i], c.y[i]);
+            wf[i] = exact(b.x[i], b.y[i], a.x[i], a.y[i]);
+        }
+        u = lanes::load(uf);
+        v = lanes::load(vf);
+        w = lanes::load(wf);
+    }
+
+    const lanes zero(0.0f);
+    mask_lanes<W> negative = (u < zero) | (v < zero) | (w < zero);
+    mask_lanes<W> positive = (u > zero) | (v > zero) | (w > zero);
+    lanes det = u + v + w;
+    lanes tt = (u * a.z + v * b.z + w * c.z) / det;
+
+    mask_lanes<W> valid = ~(negative & positive) & (det != zero);
+    valid = valid & (tt > ray_t.min) & (tt < ray_t.max);
+    tt.storeu(t);
+    return valid.bits();
+}
+
+// The packet test triangle_test_mode selects, as intersect_triangle() does.
+template <int W>
+FORCE_INLINE int intersect_packet(const triangle_packet<W>& p, const triangle_ray& tr, interval ray_t, float* t) {
+    if (tr.mode == triangle_test::watertight)
+        return intersect_packet_watertight(p, tr, ray_t, t);
+    return intersect_packet_mt(p, *tr.r, ray_t, t);
+}
+
+// An indexed triangle mesh as a single hittable: shared vertex positions in
+// structure-of-arrays form, three vertex indices per triangle, a material
+// table, and its own flat BVH over the triangles. Compared to one
+// mesh_triangle per face there is no per-triangle allocation, vtable,
+// shared_ptr<material> or duplicated vertex, and no virtual call per
+// triangle test.
+class triangle_mesh : public hittable {
+public:
+    // material_ids holds one entry per triangle indexing into materials; leave
+    // it empty when every triangle uses materials[0].
+    triangle_mesh(const std::vector<point3f>& vertices, std::vector<uint32_t> indices,
+                  std::vector<shared_ptr<material>> materials, std::vector<uint16_t> material_ids = {},
+                  const bvh_build_options& options = {})
+        : indices(std::move(indices)), material_ids(std::move(material_ids)), materials(std::move(materials))
+    {
+        assert(this->indices.size() % 3 == 0 && "three indices per triangle");
+        assert(!this->materials.empty() && "a mesh needs at least one material");
+        assert((this->material_ids.empty() || this->material_ids.size() * 3 == this->indices.size())
+               && "one material id per triangle");
+
+        x.reserve(vertices.size());
+        y.reserve(vertices.size());
+        z.reserve(vertices.size());
+        for (const auto& v : vertices) {
+            x.push_back(v.x());
+            y.push_back(v.y());
+            z.push_back(v.z());
+        }
+        build(options);
+    }
+
+    // Same, with the vertex positions already split into x, y and z arrays,
+    // which are taken over without a copy.
+    triangle_mesh(std::vector<float> x, std::vector<float> y, std::vector<float> z, std::vector<uint32_t> indices,
+                  std::vector<shared_ptr<material>> materials, std::vector<uint16_t> material_ids = {},
+                  const bvh_build_options& options = {})
+        : x(std::move(x)), y(std::move(y)), z(std::move(z)),
+          indices(std::move(indices)), material_ids(std::move(material_ids)), materials(std::move(materials))
+    {
+        assert(this->x.size() == this->y.size() && this->x.size() == this->z.size() && "one x, y and z per vertex");
+        assert(this->indices.size() % 3 == 0 && "three indices per triangle");
+        assert(!this->materials.empty() && "a mesh needs at least one material");
+        assert((this->material_ids.empty() || this->material_ids.size() * 3 == this->indices.size())
+               && "one material id per triangle");
+        build(options);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty()) return false;
+        return dispatch([&] {
+            if (packet_width == 4) return hit_packets(packets4, r, ray_t, rec);
+            if (packet_width == 8) return hit_packets(packets8, r, ray_t, rec);
+
+            triangle_ray tr(r);
+            uint32_t closest = 0;
+            float closest_t = 0.0f;
+            bool hit_anything = traverse_flat_bvh(nodes.data(), r, ray_t,
+                [&](uint32_t first, uint32_t count, interval& t) {
+                    bool hit_leaf = false;
+                    for (uint32_t i = first; i < first + count; i++) {
+                        float tri_t;
+                        if (intersect(i, tr, t, tri_t)) {
+                            hit_leaf = true;
+                            t.max = tri_t;
+                            closest = i;
+                            closest_t = tri_t;
+                        }
+                    }
+                    return hit_leaf;
+                });
+            if (!hit_anything) return false;
+
+            set_hit_record(closest, closest_t, r, rec);
+            return true;
+        });
+    }
+
+    // Coherent rays share the node tests; leaves still test one ray at a
+    // time. Meshes with leaf packets trace the rays one by one instead.
+    uint32_t hit_packet(const ray* rays, int count, interval* ray_t, hit_record* recs) const override {
+        if (nodes.empty()) return 0;
+        if (packet_width != 0) return hittable::hit_packet(rays, count, ray_t, recs);
+
+        return dispatch([&](auto isa) {
+            triangle_ray tr[max_packet_size];
+            uint32_t closest[max_packet_size];
+            for (int i = 0; i < count; i++) tr[i] = triangle_ray(rays[i]);
+
+            uint32_t hits = traverse_flat_bvh_packet<isa>(nodes.data(), rays, count, ray_t,
+                [&](uint32_t first, uint32_t n, uint32_t lanes) {
+                    uint32_t hit_lanes = 0;
+                    for (; lanes; lanes &= lanes - 1) {
+                        int lane = count_trailing_zeros(lanes);
+                        for (uint32_t i = first; i < first + n; i++) {
+                            float tri_t;
+                            if (intersect(i, tr[lane], ray_t[lane], tri_t)) {
+                                ray_t[lane].max = tri_t;
+                                closest[lane] = i;
+                                hit_lanes |= 1u << lane;
+                            }
+                        }
+                    }
+                    return hit_lanes;
+                });
+
+            for (uint32_t lanes = hits; lanes; lanes &= lanes - 1) {
+                int lane = count_trailing_zeros(lanes);
+                set_hit_record(closest[lane], ray_t[lane].max, rays[lane], recs[lane]);
+            }
+            return hits;
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (nodes.empty()) return false;
+        return dispatch([&] {
+            if (packet_width == 4) return occluded_packets(packets4, r, ray_t);
+            if (packet_width == 8) return occluded_packets(packets8, r, ray_t);
+
+            triangle_ray tr(r);
+            return occluded_flat_bvh(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count) {
+                float t;
+                for (uint32_t i = first; i < first + count; i++)
+                    if (intersect(i, tr, ray_t, t))
+                        return true;
+                return false;
+            });
+        });
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+    // Moves every vertex and refits the BVH to the new positions. Quantized
+    // vertices are decoded, moved and quantized again in the new bounds, so
+    // each call adds up to another half step of error per axis: animate a
+    // quantized mesh by transforming a float copy and rebuilding from it each
+    // frame, not by chaining transform() calls.
+    void transform(const affine3f& to_world) {
+        bool quantized = is_quantized();
+        if (quantized) dequantize();
+        for (size_t i = 0; i < x.size(); i++) {
+            point3f p = to_world.transform_point(vertex(static_cast<uint32_t>(i)));
+            x[i] = p.x();
+            y[i] = p.y();
+            z[i] = p.z();
+        }
+        if (quantized) quantize();
+        if (packet_width == 4) pack_leaves(packets4);
+        if (packet_width == 8) pack_leaves(packets8);
+        refit_flat_bvh(nodes, schedule, [&](uint32_t first, uint32_t count) {
+            AABB box = AABB::empty;
+            for (uint32_t i = 0; i < count; i++)
+                box = AABB(box, triangle_bounds(leaf_slot(first, i)));
+            return box;
+        });
+        bbox = nodes.empty() ? AABB::empty : nodes[0].bounds();
+    }
+
+    point3f vertex(uint32_t i) const {
+        if (is_quantized()) {
+            const quantized_vertex& q = qvertices[i];
+            return point3f(q_origin[0] + q_scale[0] * q.v[0], q_origin[1] + q_scale[1] * q.v[1],
+                           q_origin[2] + q_scale[2] * q.v[2]);
+        }
+        return point3f(x[i], y[i], z[i]);
+    }
+
+    size_t vertex_count() const { return is_quantized() ? qvertices.size() : x.size(); }
+    bool is_quantized() const { return !qvertices.empty(); }
+
+    // Quantization step on the coarsest axis; decoded positions are within
+    // half a step of the originals. 0 when not quantized.
+    float quantization_step() const { return std::max({q_scale[0], q_scale[1], q_scale[2]}); }
+    // Leaf slots; larger than the input triangle count after spatial splits.
+    size_t triangle_count() const { return indices.size() / 3; }
+    size_t node_count() const { return nodes.size(); }
+
+    size_t memory_bytes() const {
+        return 3 * x.size() * sizeof(float) + qvertices.size() * sizeof(quantized_vertex)
+             + indices.size() * sizeof(uint32_t)
+             + material_ids.size() * sizeof(uint16_t) + materials.size() * sizeof(shared_ptr<material>)
+             + nodes.size() * sizeof(bvh_flat_node)
+             + packets4.size() * sizeof(triangle_packet<4>) + packets8.size() * sizeof(triangle_packet<8>);
+    }
+
+private:
+    // A position as 16-bit fractions of the mesh bounds on each axis
+    struct quantized_vertex { uint16_t v[3]; };
+
+    std::vector<float> x, y, z;             // vertex positions, empty when quantized
+    std::vector<quantized_vertex> qvertices;
+    float q_origin[3] = {0.0f, 0.0f, 0.0f}; // vertex = q_origin + q_scale * q
+    float q_scale[3] = {0.0f, 0.0f, 0.0f};
+    std::vector<uint32_t> indices;          // three per triangle, in leaf order
+    std::vector<uint16_t> material_ids;     // per triangle in leaf order, or empty
+    std::vector<shared_ptr<material>> materials;
+    std::vector<bvh_flat_node> nodes;       // with packets, a leaf's offset is its packet index
+    bvh_refit_schedule schedule;
+    AABB bbox = AABB::empty;
+
+    int packet_width = 0;
+    std::vector<triangle_packet<4>> packets4;
+    std::vector<triangle_packet<8>> packets8;
+
+    // Triangle slot of the i-th triangle of a leaf.
+    uint32_t leaf_slot(uint32_t first, uint32_t i) const {
+        if (packet_width == 4) return packets4[first].slot[i];
+        if (packet_width == 8) return packets8[first].slot[i];
+        return first + i;
+    }
+
+    void set_hit_record(uint32_t tri, float t, const ray& r, hit_record& rec) const {
+        // Shading data only for the closest triangle
+        point3f v0 = vertex(indices[3 * tri]);
+        point3f v1 = vertex(indices[3 * tri + 1]);
+        point3f v2 = vertex(indices[3 * tri + 2]);
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.set_face_normal(r, unit_vector(cross(v1 - v0, v2 - v0)));
+        rec.mat = materials[material_ids.empty() ? 0 : material_ids[tri]];
+    }
+
+    template <int W>
+    bool hit_packets(const std::vector<triangle_packet<W>>& packets, const ray& r, interval ray_t,
+                     hit_record& rec) const
+    {
+        triangle_ray tr(r);
+        uint32_t closest = 0;
+        float closest_t = 0.0f;
+        bool hit_anything = traverse_flat_bvh(nodes.data(), r, ray_t,
+            [&](uint32_t first, uint32_t, interval& t) {
+                alignas(32) float tri_t[W];
+                int mask = intersect_packet(packets[first], tr, t, tri_t);
+                if (!mask) return false;
+                while (mask) {
+                    int i = count_trailing_zeros(mask);
+                    mask &= mask - 1;
+                    if (tri_t[i] < t.max) {
+                        t.max = tri_t[i];
+                        closest = packets[first].slot[i];
+                        closest_t = tri_t[i];
+                    }
+                }
+                return true;
+            });
+        if (!hit_anything) return false;
+
+        set_hit_record(closest, closest_t, r, rec);
+        return true;
+    }
+
+    template <int W>
+    bool occluded_packets(const std::vector<triangle_packet<W>>& packets, const ray& r, interval ray_t) const {
+        triangle_ray tr(r);
+        return occluded_flat_bvh(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t) {
+            alignas(32) float tri_t[W];
+            return intersect_packet(packets[first], tr, ray_t, tri_t) != 0;
+        });
+    }
+
+    // Fills one packet per leaf from the current vertices. The first call
+    // turns every leaf's offset from a slot into its packet index.
+    template <int W>
+    void pack_leaves(std::vector<triangle_packet<W>>& packets) {
+        bool first_pack = packets.empty();
+        for (auto& node : nodes) {
+            if (!node.is_leaf()) continue;
+            assert(node.count <= W && "leaves must fit in one packet");
+            if (first_pack) {
+                uint32_t slot = node.offset;
+                node.offset = static_cast<uint32_t>(packets.size());
+                packets.emplace_back();
+                for (int lane = 0; lane < W; lane++)
+                    packets.back().slot[lane] = slot + lane;
+            }
+            triangle_packet<W>& p = packets[node.offset];
+            for (int lane = 0; lane < W; lane++) {
+                if (lane >= node.count) {
+                    p.clear(lane);
+                    continue;
+                }
+                uint32_t tri = p.slot[lane];
+                p.set(lane, vertex(indices[3 * tri]), vertex(indices[3 * tri + 1]), vertex(indices[3 * tri + 2]), tri);
+            }
+        }
+    }
+
+    bool intersect(uint32_t tri, const triangle_ray& r, interval ray_t, float& t) const {
+        return intersect_triangle(r, ray_t, vertex(indices[3 * tri]), vertex(indices[3 * tri + 1]),
+                                  vertex(indices[3 * tri + 2]), t);
+    }
+
+    // Replaces x, y and z by 6-byte quantized positions. Six bytes instead of
+    // twelve per vertex; the error is at most half a step, 1/131070 of the
+    // mesh extent per axis.
+    void quantize() {
+        if (x.empty()) return;
+        float lo[3], hi[3];
+        const std::vector<float>* axes[3] = {&x, &y, &z};
+        for (int a = 0; a < 3; a++) {
+            auto [min_it, max_it] = std::minmax_element(axes[a]->begin(), axes[a]->end());
+            lo[a] = *min_it;
+            hi[a] = *max_it;
+            q_origin[a] = lo[a];
+            q_scale[a] = (hi[a] - lo[a]) / 65535.0f;
+        }
+        qvertices.resize(x.size());
+        for (size_t i = 0; i < x.size(); i++) {
+            for (int a = 0; a < 3; a++) {
+                float f = q_scale[a] > 0.0f ? ((*axes[a])[i] - lo[a]) / q_scale[a] : 0.0f;
+                qvertices[i].v[a] = static_cast<uint16_t>(std::clamp(std::lround(f), 0l, 65535l));
+            }
+        }
+        x = {};
+        y = {};
+        z = {};
+    }
+
+    void dequantize() {
+        size_t n = qvertices.size();
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+        for (uint32_t i = 0; i < n; i++) {
+            point3f p = vertex(i);
+            x[i] = p.x();
+            y[i] = p.y();
+            z[i] = p.z();
+        }
+        qvertices = {};
+    }
+
+    AABB triangle_bounds(uint32_t tri) const {
+        return AABB(AABB(vertex(indices[3 * tri]), vertex(indices[3 * tri + 1])),
+                    AABB(vertex(indices[3 * tri + 2]), vertex(indices[3 * tri + 2])));
+    }
+
+    // Builds the BVH over the triangles, then stores the index triples and
+    // material ids in leaf order so a leaf reads one contiguous run.
+    void build(bvh_build_options options) {
+        assert((options.leaf_packet == 0 || options.leaf_packet == 4 || options.leaf_packet == 8)
+               && "leaf packets hold 4 or 8 triangles");
+        // Packets hold their own float copy of every vertex, and the packet
+        // test reads only that, so 16-bit positions would be pure overhead.
+        assert(!(options.leaf_packet > 0 && options.quantize_vertices)
+               && "leaf packets and quantized vertices do not combine");
+        if (options.leaf_packet > 0)
+            options.max_leaf_size = options.leaf_packet;
+        // Before the build, so the boxes bound the decoded positions
+        if (options.quantize_vertices)
+            quantize();
+
+        uint32_t n = static_cast<uint32_t>(indices.size() / 3);
+        std::vector<bvh_primitive> prims(n);
+        for (uint32_t i = 0; i < n; i++) {
+            AABB box = triangle_bounds(i);
+            prims[i] = {box, box.centroid(), i};
+        }
+
+        flat_bvh bvh = options.split == bvh_split::spatial
+            ? build_spatial_bvh(std::move(prims), [&](size_t i, int axis, float lo, float hi) {
+                  return clip_triangle(vertex(indices[3 * i]), vertex(indices[3 * i + 1]),
+                                       vertex(indices[3 * i + 2]), axis, lo, hi);
+              }, options)
+            : build_flat_bvh(prims, options);
+
+        std::vector<uint32_t> ordered(3 * bvh.indices.size());
+        for (size_t slot = 0; slot < bvh.indices.size(); slot++)
+            for (int k = 0; k < 3; k++)
+                ordered[3 * slot + k] = indices[3 * bvh.indices[slot] + k];
+        if (!material_ids.empty()) {
+            std::vector<uint16_t> ordered_ids(bvh.indices.size());
+            for (size_t slot = 0; slot < bvh.indices.size(); slot++)
+                ordered_ids[slot] = material_ids[bvh.indices[slot]];
+            material_ids = std::move(ordered_ids);
+        }
+        indices = std::move(ordered);
+
+        nodes = std::move(bvh.nodes);
+        schedule = make_refit_schedule(nodes);
+        bbox = nodes.empty() ? AABB::empty : nodes[0].bounds();
+
+        packet_width = options.leaf_packet;
+        if (packet_width == 4) pack_leaves(packets4);
+        if (packet_width == 8) pack_leaves(packets8);
+    }
+};
+
+// allow shear
+inline void transform_mesh(triangle_mesh& mesh, float scale, const vec3f& translate) {
+    mesh.transform(affine3f::translation(translate) * affine3f::scaling(scale));
+}
+
+// only scale size
+inline void transform_mesh(triangle_mesh& mesh, const vec3f& scale, const vec3f& translate) {
+    mesh.transform(affine3f::translation(translate) * affine3f::scaling(scale));
+}
+
+} // namespace rt
@@ -0,0 +1,386 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #define RT_WIDE_BVH_SSE 1
+    #include <emmintrin.h>
+#endif
+
+#include "def.hpp"
+#include "cpu_dispatch.hpp"
+#include "linear_bvh.hpp"
+
+namespace rt {
+
+// A W-ary BVH node. Child boxes are stored as structure of arrays so all W
+// slabs of one axis plane load as a single SIMD register:
+//   bounds[0..2] = min x/y/z, bounds[3..5] = max x/y/z.
+// Empty slots carry an inverted box, which the sign-selected slab test below
+// always rejects.
+template <int W>
+struct alignas(64) bvh_wide_node {
+    static constexpr int width = W;
+
+    float bounds[6][W];
+    uint32_t child[W];  // interior: node index, leaf: first primitive slot
+    uint16_t count[W];  // primitives in a leaf child, 0 for interior or empty slots
+
+    bool is_leaf(int i) const { return count[i] > 0; }
+
+    void clear() {
+        for (int i = 0; i < W; i++) {
+            for (int a = 0; a < 3; a++) {
+                bounds[a][i] = INF;
+                bounds[a + 3][i] = -INF;
+            }
+            child[i] = 0;
+            count[i] = 0;
+        }
+    }
+
+    void set_child_bounds(int i, const bvh_flat_node& node) {
+        for (int a = 0; a < 3; a++) {
+            bounds[a][i] = node.bmin[a];
+            bounds[a + 3][i] = node.bmax[a];
+        }
+    }
+};
+
+// Collapses the binary subtree rooted at bin_index into one wide node and
+// recurses into its interior children. Returns the index of the new node.
+template <int W>
+uint32_t collapse_to_wide(const std::vector<bvh_flat_node>& bin, uint32_t bin_index,
+                          std::vector<bvh_wide_node<W>>& out)
+{
+    uint32_t children[W];
+    int n = 0;
+    const bvh_flat_node& root = bin[bin_index];
+    if (root.is_leaf()) {
+        children[n++] = bin_index;
+    } else {
+        children[n++] = bin_index + 1;
+        children[n++] = root.offset;
+    }
+
+    // Open the interior child with the largest surface area until the node is full.
+    while (n < W) {
+        int best = -1;
+        float best_area = -1.0f;
+        for (int i = 0; i < n; i++) {
+            const bvh_flat_node& c = bin[children[i]];
+            if (c.is_leaf()) continue;
+            float area = c.bounds().half_area();
+            if (area > best_area) {
+                best_area = area;
+                best = i;
+            }
+        }
+        if (best < 0) break;
+
+        const bvh_flat_node& opened = bin[children[best]];
+        children[n++] = opened.offset;
+        children[best] = children[best] + 1;
+    }
+
+    uint32_t wide_index = static_cast<uint32_t>(out.size());
+    out.emplace_back();
+    out[wide_index].clear();
+
+    for (int i = 0; i < n; i++) {
+        const bvh_flat_node& c = bin[children[i]];
+        uint32_t child_index = c.offset;
+        uint16_t count = c.count;
+        if (!c.is_leaf())
+            child_index = collapse_to_wide<W>(bin, children[i], out);
+
+        // out may have been reallocated by the recursion
+        bvh_wide_node<W>& node = out[wide_index];
+        node.set_child_bounds(i, c);
+        node.child[i] = child_index;
+        node.count[i] = count;
+    }
+    return wide_index;
+}
+
+// Ray data for the wide slab test. near[a]/far[a] pick the bounds plane that
+// is entered/left first along axis a, so no min/max per lane is needed.
+struct wide_bvh_ray {
+    float org[3];
+    float inv_dir[3];
+    int near[3], far[3];
+
+    explicit wide_bvh_ray(const ray& r) {
+        for (int a = 0; a < 3; a++) {
+            org[a] = r.origin()[a];
+            inv_dir[a] = 1.0f / r.direction()[a];
+            bool neg = inv_dir[a] < 0.0f;
+            near[a] = neg ? a + 3 : a;
+            far[a] = neg ? a : a + 3;
+        }
+    }
+};
+
+// SIMD versions of intersect_children() below, one per node width. SSE2 is
+// part of every x86-64 target; the AVX2 version is compiled for AVX2 in any
+// build and only runs in the AVX2 and AVX-512 copies of a dispatch() kernel.
+#ifdef RT_WIDE_BVH_SSE
+FORCE_INLINE int intersect_children_sse(const bvh_wide_node<4>& node, const wide_bvh_ray& r,
+                                        float tmin, float tmax, float* tnear)
+{
+    __m128 t0 = _mm_set1_ps(tmin);
+    __m128 t1 = _mm_set1_ps(INF);
+    for (int a = 0; a < 3; a++) {
+        __m128 o = _mm_set1_ps(r.org[a]);
+        __m128 inv = _mm_set1_ps(r.inv_dir[a]);
+        __m128 n = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[r.near[a]]), o), inv);
+        __m128 f = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[r.far[a]]), o), inv);
+        t0 = _mm_max_ps(n, t0);
+        t1 = _mm_min_ps(f, t1);
+    }
+    t1 = _mm_min_ps(_mm_mul_ps(t1, _mm_set1_ps(bvh_slab_margin)), _mm_set1_ps(tmax));
+    _mm_storeu_ps(tnear, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+#endif
+
+#ifdef RT_KERNELS_AVX2
+RT_TARGET_AVX2 inline int intersect_children_avx2(const bvh_wide_node<8>& node, const wide_bvh_ray& r,
+                                                  float tmin, float tmax, float* tnear)
+{
+    __m256 t0 = _mm256_set1_ps(tmin);
+    __m256 t1 = _mm256_set1_ps(INF);
+    for (int a = 0; a < 3; a++) {
+        __m256 o = _mm256_set1_ps(r.org[a]);
+        __m256 inv = _mm256_set1_ps(r.inv_dir[a]);
+        __m256 n = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[r.near[a]]), o), inv);
+        __m256 f = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[r.far[a]]), o), inv);
+        t0 = _mm256_max_ps(n, t0);
+        t1 = _mm256_min_ps(f, t1);
+    }
+    t1 = _mm256_min_ps(_mm256_mul_ps(t1, _mm256_set1_ps(bvh_slab_margin)), _mm256_set1_ps(tmax));
+    _mm256_storeu_ps(tnear, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif
+
+// Slab test of a ray against every child of a node. Returns a bit mask of the
+// children hit and writes the entry distance of each into tnear. The exit
+// distance is widened by bvh_slab_margin once, after the three axes. A ray in
+// a bounds plane gives 0 * inf = nan there, which the min and max ignore, so
+// the slab stays open; the SIMD versions pass the new distance first, since
+// _mm_min_ps and _mm_max_ps return their second operand on a nan.
+// Isa is the level of the dispatch() copy the test is compiled into.
+template <isa_level Isa, int W>
+FORCE_INLINE int intersect_children(const bvh_wide_node<W>& node, const wide_bvh_ray& r,
+                                    float tmin, float tmax, float* tnear)
+{
+#ifdef RT_KERNELS_AVX2
+    if constexpr (W == 8 && Isa >= isa_level::avx2)
+        return intersect_children_avx2(node, r, tmin, tmax, tnear);
+#endif
+#ifdef RT_WIDE_BVH_SSE
+    if constexpr (W == 4)
+        return intersect_children_sse(node, r, tmin, tmax, tnear);
+#endif
+
+    int mask = 0;
+    for (int i = 0; i < W; i++) {
+        float t0 = tmin, t1 = INF;
+        for (int a = 0; a < 3; a++) {
+            t0 = std::max(t0, (node.bounds[r.near[a]][i] - r.org[a]) * r.inv_dir[a]);
+            t1 = std::min(t1, (node.bounds[r.far[a]][i] - r.org[a]) * r.inv_dir[a]);
+        }
+        t1 = std::min(tmax, t1 * bvh_slab_margin);
+        tnear[i] = t0;
+        mask |= (t0 <= t1) << i;
+    }
+    return mask;
+}
+
+// Closest-hit traversal of a wide BVH. Leaf children that are hit are
+// intersected in place, so a hit shrinks ray_t before the interior children
+// are ordered. Traversal then descends into the nearest interior child and
+// pushes the others far to near; entries that start beyond the closest hit
+// are skipped on pop. Only the children of one node are ever sorted, and only
+// when more than two were hit. leaf() has the same contract as in
+// traverse_flat_bvh.
+// Works on any node type with width, child[] and count[] members and an
+// intersect_children<Isa>() overload.
+template <isa_level Isa = compiled_isa, typename Node, typename LeafFn>
+inline bool traverse_wide_bvh(const Node* nodes, const ray& r, interval ray_t, LeafFn&& leaf) {
+    constexpr int W = Node::width;
+    struct entry {
+        uint32_t node;
+        float t;
+    };
+
+    wide_bvh_ray wr(r);
+    entry stack[W * bvh_stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+
+    while (true) {
+        const Node& node = nodes[current];
+        alignas(32) float tnear[W];
+        int mask = intersect_children<Isa>(node, wr, ray_t.min, ray_t.max, tnear);
+
+        int interior = mask;
+        for (int i = 0; i < W; i++)
+            interior &= ~((node.count[i] != 0) << i);
+        if (int leaves = mask & ~interior) {
+            float closest = ray_t.max;
+            for (; leaves; leaves &= leaves - 1) {
+                int i = count_trailing_zeros(leaves);
+                if (leaf(node.child[i], node.count[i], ray_t))
+                    hit_anything = true;
+            }
+            // A hit may have moved the closest hit in front of some children.
+            if (ray_t.max < closest)
+                for (int m = interior; m; m &= m - 1)
+                    if (tnear[count_trailing_zeros(m)] > ray_t.max)
+                        interior &= ~(1 << count_trailing_zeros(m));
+        }
+
+        // Descend into the nearest interior child: directly when only one
+        // was hit, after one compare for two, or after sorting the rest onto
+        // the stack far to near.
+        if (interior) {
+            int i = count_trailing_zeros(interior);
+            interior &= interior - 1;
+            if (!interior) {
+                current = node.child[i];
+                continue;
+            }
+            int k = count_trailing_zeros(interior);
+            interior &= interior - 1;
+            assert(stack_top + W <= W * bvh_stack_size && "BVH deeper than the traversal stack");
+            if (!interior) {
+                bool near_i = tnear[i] <= tnear[k];
+                stack[stack_top++] = near_i ? entry{node.child[k], tnear[k]} : entry{node.child[i], tnear[i]};
+                current = near_i ? node.child[i] : node.child[k];
+                continue;
+            }
+            const int base = stack_top;
+            auto insert = [&](int c) {
+                entry e{node.child[c], tnear[c]};
+                int j = stack_top++;
+                while (j > base && stack[j - 1].t < e.t) {
+                    stack[j] = stack[j - 1];
+                    j--;
+                }
+                stack[j] = e;
+            };
+            insert(i);
+            insert(k);
+            for (; interior; interior &= interior - 1)
+                insert(count_trailing_zeros(interior));
+            current = stack[--stack_top].node;
+            continue;
+        }
+
+        do {
+            if (stack_top == 0) return hit_anything;
+            --stack_top;
+        } while (stack[stack_top].t > ray_t.max);
+        current = stack[stack_top].node;
+    }
+}
+
+// Any-hit traversal of a wide BVH; children are pushed unsorted and the
+// search stops at the first leaf where leaf(first, count) reports a blocker.
+template <isa_level Isa = compiled_isa, typename Node, typename LeafFn>
+inline bool occluded_wide_bvh(const Node* nodes, const ray& r, interval ray_t, LeafFn&& leaf) {
+    constexpr int W = Node::width;
+    wide_bvh_ray wr(r);
+    uint32_t stack[W * bvh_stack_size];
+    int stack_top = 0;
+    stack[stack_top++] = 0;
+
+    while (stack_top > 0) {
+        const Node& node = nodes[stack[--stack_top]];
+        alignas(32) float tnear[W];
+        int mask = intersect_children<Isa>(node, wr, ray_t.min, ray_t.max, tnear);
+        while (mask) {
+            int i = count_trailing_zeros(mask);
+            mask &= mask - 1;
+            if (node.count[i] == 0) {
+                assert(stack_top < W * bvh_stack_size && "BVH deeper than the traversal stack");
+                stack[stack_top++] = node.child[i];
+            } else if (leaf(node.child[i], node.count[i])) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// BVH with W children per node, collapsed from the binary SAH tree.
+template <int W>
+class wide_bvh : public hittable {
+public:
+    wide_bvh(const hittable_list& list, const bvh_build_options& options = {})
+        : wide_bvh(list.objects, options) {}
+
+    wide_bvh(const std::vector<shared_ptr<hittable>>& source, const bvh_build_options& options = {}) {
+        flat_bvh bvh = build_flat_bvh(source, options);
+        if (bvh.nodes.empty()) return;
+
+        collapse_to_wide<W>(bvh.nodes, 0, nodes);
+        objects.reserve(bvh.indices.size());
+        for (uint32_t index : bvh.indices)
+            objects.push_back(source[index]);
+        bbox = bvh.nodes[0].bounds();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty()) return false;
+
+        return dispatch([&](auto isa) {
+            return traverse_wide_bvh<isa>(nodes.data(), r, ray_t,
+                [&](uint32_t first, uint32_t count, interval& t) {
+                    bool hit_leaf = false;
+                    for (uint32_t i = first; i < first + count; i++) {
+                        if (objects[i]->hit(r, t, rec)) {
+                            hit_leaf = true;
+                            t.max = rec.t;
+                        }
+                    }
+                    return hit_leaf;
+                });
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (nodes.empty()) return false;
+
+        return dispatch([&](auto isa) {
+            return occluded_wide_bvh<isa>(nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count) {
+                for (uint32_t i = first; i < first + count; i++)
+                    if (objects[i]->occluded(r, ray_t))
+                        return true;
+                return false;
+            });
+        });
+    }
+
+    AABB bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    size_t memory_bytes() const {
+        return nodes.size() * sizeof(bvh_wide_node<W>) + objects.size() * sizeof(shared_ptr<hittable>);
+    }
+
+private:
+    std::vector<bvh_wide_node<W>> nodes;
+    std::vector<shared_ptr<hittable>> objects;  // in leaf order
+    AABB bbox = AABB::empty;
+};
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+} // namespace rt